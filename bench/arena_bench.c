@@ -0,0 +1,462 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libxml/parser.h>
+
+#include "sylverant/config.h"
+#include "sylverant/quest.h"
+#include "sylverant/memory.h"
+
+/* Enough that the ship config has a few of everything, and that the quest
+   list is about the size of a real one. */
+#define SHIP_INFOS      8
+#define SHIP_LIMITS     4
+#define QUEST_CATS      8
+#define QUEST_PER_CAT   64
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+static char ship_fn[] = "/tmp/arena_benchXXXXXX";
+static char quest_fn[] = "/tmp/arena_benchXXXXXX";
+
+/* All of the plain strings in the ship config. */
+#define SHIP_STR(x) offsetof(sylverant_ship_t, x)
+static const size_t ship_strings[] = {
+    SHIP_STR(shipgate_host), SHIP_STR(name), SHIP_STR(ship_cert),
+    SHIP_STR(ship_key), SHIP_STR(shipgate_ca), SHIP_STR(gm_file),
+    SHIP_STR(quests_file), SHIP_STR(quests_dir), SHIP_STR(bans_file),
+    SHIP_STR(scripts_file), SHIP_STR(bb_param_dir), SHIP_STR(v2_param_dir),
+    SHIP_STR(bb_map_dir), SHIP_STR(v2_map_dir), SHIP_STR(gc_map_dir),
+    SHIP_STR(v2_ptdata_file), SHIP_STR(gc_ptdata_file),
+    SHIP_STR(bb_ptdata_file), SHIP_STR(v2_pmtdata_file),
+    SHIP_STR(gc_pmtdata_file), SHIP_STR(bb_pmtdata_file),
+    SHIP_STR(v2_rtdata_file), SHIP_STR(gc_rtdata_file),
+    SHIP_STR(bb_rtdata_file), SHIP_STR(smutdata_file), SHIP_STR(sg_data_dir),
+    SHIP_STR(ship_host), SHIP_STR(ship_host6)
+};
+#define SHIP_STRINGS (sizeof(ship_strings) / sizeof(ship_strings[0]))
+#define SHIP_STRING(c, i) (*(char **)((uint8_t *)(c) + ship_strings[i]))
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* There's no DTD for the files written here, so libxml2 complains about each
+   one it reads. */
+static void xml_quiet(void *ctx, const char *msg, ...) {
+    (void)ctx;
+    (void)msg;
+}
+
+static FILE *open_temp(char *fn) {
+    FILE *fp;
+    int fd;
+
+    if((fd = mkstemp(fn)) < 0) {
+        perror("mkstemp");
+        return NULL;
+    }
+
+    if(!(fp = fdopen(fd, "w"))) {
+        perror("fdopen");
+        close(fd);
+        unlink(fn);
+    }
+
+    return fp;
+}
+
+static int write_ship(void) {
+    FILE *fp;
+    int i;
+
+    if(!(fp = open_temp(ship_fn)))
+        return -1;
+
+    fprintf(fp, "<?xml version=\"1.0\"?>\n<ships>\n"
+            "  <shipgate ip=\"127.0.0.1\" port=\"3455\" ca=\"ca.pem\" />\n"
+            "  <ship name=\"Alpha\" blocks=\"4\" key=\"ship-key.pem\" "
+            "gms=\"gms.xml\" menu=\"\" gmonly=\"false\" cert=\"ship.pem\">\n"
+            "    <net ip=\"10.0.0.1\" port=\"5000\" ip6=\"::1\" />\n");
+
+    for(i = 0; i < SHIP_INFOS; ++i) {
+        fprintf(fp, "    <info file=\"info%d.txt\" desc=\"Info file %d\" />\n",
+                i, i);
+    }
+
+    fprintf(fp, "    <quests dir=\"quests\" />\n"
+            "    <limits file=\"limits.xml\" />\n");
+
+    for(i = 1; i < SHIP_LIMITS; ++i) {
+        fprintf(fp, "    <limits id=\"%d\" name=\"Limits %d\" "
+                "file=\"limits%d.xml\" />\n", i, i, i);
+    }
+
+    fprintf(fp, "    <bans file=\"bans.xml\" />\n"
+            "    <itempt v2=\"pt_v2\" gc=\"pt_gc\" />\n"
+            "    <events><defaults game=\"0\" lobby=\"0\" />"
+            "<event game=\"1\" lobby=\"2\"><start month=\"1\" day=\"2\"/>"
+            "<end month=\"3\" day=\"4\"/></event>"
+            "<event game=\"3\" lobby=\"4\"><start month=\"10\" day=\"20\"/>"
+            "<end month=\"11\" day=\"1\"/></event></events>\n"
+            "    <smutdata file=\"smut.dat\" />\n"
+            "  </ship>\n</ships>\n");
+
+    if(fclose(fp)) {
+        perror("fclose");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Each quest uses the quest list itself as its script, since the reader wants
+   the file to be there. */
+static int write_quests(void) {
+    FILE *fp;
+    int i, j, id = 0;
+
+    if(!(fp = open_temp(quest_fn)))
+        return -1;
+
+    fprintf(fp, "<?xml version=\"1.0\"?>\n<quests>\n");
+
+    for(i = 0; i < QUEST_CATS; ++i) {
+        fprintf(fp, "  <category name=\"Category %d\" type=\"%s\" "
+                "episodes=\"1\">\n    <description>Category number %d"
+                "</description>\n", i, (i & 1) ? "battle" : "normal", i);
+
+        for(j = 0; j < QUEST_PER_CAT; ++j, ++id) {
+            fprintf(fp, "    <quest name=\"Quest %d\" prefix=\"q%d\" "
+                    "v1=\"true\" v2=\"true\" gc=\"true\" bb=\"%s\" "
+                    "episode=\"%d\" event=\"0\" format=\"qst\" id=\"%d\" "
+                    "minpl=\"1\" maxpl=\"4\">\n"
+                    "      <short>Quest number %d</short>\n"
+                    "      <long>The long description of quest %d, which "
+                    "goes on for a while (%*s).</long>\n", id, id,
+                    (j & 1) ? "true" : "false", (j & 1) + 1, id, id, id,
+                    j % 37, "");
+
+            if(j % 3 == 0)
+                fprintf(fp, "      <drops default=\"norare\" type=\"server\">"
+                        "<monster type=\"%d\" drops=\"none\"/>"
+                        "<monster id=\"%d\" drops=\"free\"/></drops>\n",
+                        j % 5 + 1, j);
+
+            if(j % 4 == 0)
+                fprintf(fp, "      <syncregs default=\"none\" "
+                        "list=\"%d,%d,%d\" />\n", j % 7, j % 7 + 1, j % 7 + 5);
+
+            if(j % 5 == 0)
+                fprintf(fp, "      <script load=\"%s\" />\n", quest_fn);
+
+            fprintf(fp, "    </quest>\n");
+        }
+
+        fprintf(fp, "  </category>\n");
+    }
+
+    fprintf(fp, "</quests>\n");
+
+    if(fclose(fp)) {
+        perror("fclose");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int str_diff(const char *a, const char *b) {
+    if(!a || !b)
+        return a != b;
+
+    return strcmp(a, b);
+}
+
+static int ship_diff(const sylverant_ship_t *a, const sylverant_ship_t *b) {
+    size_t j;
+    int i;
+
+    for(j = 0; j < SHIP_STRINGS; ++j) {
+        if(str_diff(SHIP_STRING(a, j), SHIP_STRING(b, j)))
+            return -1;
+    }
+
+    if(a->shipgate_port != b->shipgate_port ||
+       a->shipgate_flags != b->shipgate_flags ||
+       a->local_flags != b->local_flags || a->base_port != b->base_port ||
+       a->menu_code != b->menu_code || a->blocks != b->blocks ||
+       a->info_file_count != b->info_file_count ||
+       a->event_count != b->event_count ||
+       a->limits_count != b->limits_count ||
+       a->limits_default != b->limits_default ||
+       a->privileges != b->privileges)
+        return -1;
+
+    for(i = 0; i < a->info_file_count; ++i) {
+        if(str_diff(a->info_files[i].desc, b->info_files[i].desc) ||
+           str_diff(a->info_files[i].filename, b->info_files[i].filename) ||
+           a->info_files[i].versions != b->info_files[i].versions ||
+           a->info_files[i].languages != b->info_files[i].languages)
+            return -1;
+    }
+
+    for(i = 0; i < a->limits_count; ++i) {
+        if(str_diff(a->limits[i].name, b->limits[i].name) ||
+           str_diff(a->limits[i].filename, b->limits[i].filename) ||
+           a->limits[i].id != b->limits[i].id ||
+           a->limits[i].enforce != b->limits[i].enforce)
+            return -1;
+    }
+
+    if(a->event_count &&
+       memcmp(a->events, b->events, a->event_count * sizeof(sylverant_event_t)))
+        return -1;
+
+    return 0;
+}
+
+static int quest_diff(const sylverant_quest_t *a, const sylverant_quest_t *b) {
+    if(a->qid != b->qid || a->versions != b->versions ||
+       a->flags != b->flags || a->privileges != b->privileges ||
+       memcmp(a->name, b->name, sizeof(a->name)) ||
+       memcmp(a->desc, b->desc, sizeof(a->desc)) ||
+       str_diff(a->long_desc, b->long_desc) ||
+       str_diff(a->prefix, b->prefix) ||
+       str_diff(a->onload_script_file, b->onload_script_file) ||
+       str_diff(a->beforeload_script_file, b->beforeload_script_file) ||
+       a->start_time != b->start_time || a->end_time != b->end_time ||
+       a->episode != b->episode || a->event != b->event ||
+       a->format != b->format || a->max_players != b->max_players ||
+       a->min_players != b->min_players || a->sync != b->sync ||
+       a->num_monster_types != b->num_monster_types ||
+       a->num_monster_ids != b->num_monster_ids ||
+       a->num_sync != b->num_sync ||
+       a->server_flag16_reg != b->server_flag16_reg ||
+       a->server_flag32_ctl != b->server_flag32_ctl ||
+       a->server_flag32_dat != b->server_flag32_dat ||
+       a->server_data_reg != b->server_data_reg ||
+       a->server_ctl_reg != b->server_ctl_reg)
+        return -1;
+
+    if((a->num_monster_types &&
+        memcmp(a->monster_types, b->monster_types, a->num_monster_types *
+               sizeof(struct sylverant_quest_enemy))) ||
+       (a->num_monster_ids &&
+        memcmp(a->monster_ids, b->monster_ids, a->num_monster_ids *
+               sizeof(struct sylverant_quest_enemy))) ||
+       (a->num_sync && memcmp(a->synced_regs, b->synced_regs, a->num_sync)))
+        return -1;
+
+    return 0;
+}
+
+static int list_diff(const sylverant_quest_list_t *a,
+                     const sylverant_quest_list_t *b) {
+    const sylverant_quest_category_t *ca, *cb;
+    int i, j;
+
+    if(a->cat_count != b->cat_count)
+        return -1;
+
+    for(i = 0; i < a->cat_count; ++i) {
+        ca = &a->cats[i];
+        cb = &b->cats[i];
+
+        if(memcmp(ca->name, cb->name, sizeof(ca->name)) ||
+           memcmp(ca->desc, cb->desc, sizeof(ca->desc)) ||
+           ca->type != cb->type || ca->episodes != cb->episodes ||
+           ca->privileges != cb->privileges ||
+           ca->quest_count != cb->quest_count)
+            return -1;
+
+        for(j = 0; j < ca->quest_count; ++j) {
+            if(quest_diff(ca->quests[j], cb->quests[j]))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Read each file with and without arenas, and make sure that what comes back
+   is the same either way (and that arena mode really did use an arena). */
+static int check(void) {
+    sylverant_ship_t *plain, *arena;
+    sylverant_quest_list_t qplain, qarena;
+    int rv = 0;
+
+    sylverant_config_arenas(0);
+
+    if(sylverant_read_ship_config(ship_fn, &plain)) {
+        fprintf(stderr, "Couldn't read ship config\n");
+        return -1;
+    }
+
+    sylverant_config_arenas(1);
+
+    if(sylverant_read_ship_config(ship_fn, &arena)) {
+        fprintf(stderr, "Couldn't read ship config in an arena\n");
+        sylverant_free_ship_config(plain);
+        return -1;
+    }
+
+    if(plain->arena || !arena->arena || plain->info_file_count != SHIP_INFOS ||
+       plain->limits_count != SHIP_LIMITS || ship_diff(plain, arena)) {
+        fprintf(stderr, "Ship config mismatch in arena mode\n");
+        rv = -1;
+    }
+
+    sylverant_free_ship_config(plain);
+    sylverant_free_ship_config(arena);
+
+    if(rv)
+        return rv;
+
+    sylverant_config_arenas(0);
+
+    if(sylverant_quests_read(quest_fn, &qplain)) {
+        fprintf(stderr, "Couldn't read quest list\n");
+        return -1;
+    }
+
+    sylverant_config_arenas(1);
+
+    if(sylverant_quests_read(quest_fn, &qarena)) {
+        fprintf(stderr, "Couldn't read quest list in an arena\n");
+        sylverant_quests_destroy(&qplain);
+        return -1;
+    }
+
+    if(qplain.arena || !qarena.arena || qplain.cat_count != QUEST_CATS ||
+       list_diff(&qplain, &qarena)) {
+        fprintf(stderr, "Quest list mismatch in arena mode\n");
+        rv = -1;
+    }
+
+    sylverant_quests_destroy(&qplain);
+    sylverant_quests_destroy(&qarena);
+    sylverant_config_arenas(0);
+
+    return rv;
+}
+
+static void load_ship(void) {
+    sylverant_ship_t *cfg;
+
+    if(!sylverant_read_ship_config(ship_fn, &cfg))
+        sylverant_free_ship_config(cfg);
+}
+
+static void load_quests(void) {
+    sylverant_quest_list_t list;
+
+    if(!sylverant_quests_read(quest_fn, &list))
+        sylverant_quests_destroy(&list);
+}
+
+/* Reading and freeing each file, in microseconds per load. */
+static double run(void (*fn)(void), int arenas) {
+    double start, end;
+    unsigned long iters = 0;
+
+    sylverant_config_arenas(arenas);
+    start = now();
+
+    do {
+        fn();
+        ++iters;
+    } while((end = now()) - start < bench_time);
+
+    sylverant_config_arenas(0);
+    return (end - start) * 1000000.0 / iters;
+}
+
+int main(int argc, char *argv[]) {
+    double old, cur;
+    int opt, rv = 1;
+
+    while((opt = getopt(argc, argv, "ct:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    xmlSetGenericErrorFunc(NULL, &xml_quiet);
+
+    if(write_ship())
+        return 1;
+
+    if(write_quests())
+        goto out_ship;
+
+    if(check())
+        goto out;
+
+    if(csv)
+        printf("test,plain_us,arena_us\n");
+    else
+        printf("%-8s %12s %12s %8s\n", "test", "plain us", "arena us",
+               "speedup");
+
+    old = run(&load_ship, 0);
+    cur = run(&load_ship, 1);
+
+    if(csv)
+        printf("ship,%.2f,%.2f\n", old, cur);
+    else
+        printf("%-8s %12.1f %12.1f %7.2fx\n", "ship", old, cur, old / cur);
+
+    old = run(&load_quests, 0);
+    cur = run(&load_quests, 1);
+
+    if(csv)
+        printf("quests,%.2f,%.2f\n", old, cur);
+    else
+        printf("%-8s %12.1f %12.1f %7.2fx\n", "quests", old, cur, old / cur);
+
+    rv = 0;
+
+out:
+    unlink(quest_fn);
+out_ship:
+    unlink(ship_fn);
+    return rv;
+}
@@ -0,0 +1,223 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sylverant/checksum.h"
+
+#define MAX_SIZE    (1 << 22)
+
+/* From small packets up to the size of a large quest file. */
+static const int sizes[] = { 16, 64, 256, 1024, 4096, 65536, MAX_SIZE };
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* The CRC32 function as it was before, one bit at a time. */
+static uint32_t crc32_bitwise(const uint8_t *data, int size) {
+    int i, j;
+    uint32_t rv = 0xFFFFFFFF;
+
+    for(i = 0; i < size; ++i) {
+        rv ^= data[i];
+
+        for(j = 0; j < 8; ++j) {
+            rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+        }
+    }
+
+    return ~rv;
+}
+
+/* Check every length up to a bit past the point where the folding code kicks
+   in, at every alignment, plus a few big ones. */
+static int check(const uint8_t *buf) {
+    int len, off;
+
+    for(off = 0; off < 16; ++off) {
+        for(len = 0; len < 600; ++len) {
+            if(sylverant_crc32(buf + off, len) !=
+               crc32_bitwise(buf + off, len)) {
+                fprintf(stderr, "Mismatch at offset %d, length %d\n", off,
+                        len);
+                return -1;
+            }
+        }
+    }
+
+    for(len = 4096; len <= MAX_SIZE - 16; len = len * 3 + 7) {
+        if(sylverant_crc32(buf + 3, len) != crc32_bitwise(buf + 3, len)) {
+            fprintf(stderr, "Mismatch at length %d\n", len);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Split a buffer in two at every point (and into uneven runs of pieces), and
+   make sure that both the running and the combined CRCs come out the same as
+   doing it all at once. */
+static int check_split(const uint8_t *buf) {
+    static const int lens[] = { 0, 1, 15, 16, 17, 63, 64, 65, 300, 1000 };
+    int i, len, split, off;
+    uint32_t want, crc1, crc2, step;
+    sylverant_crc32_t ctx;
+
+    for(i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); ++i) {
+        len = lens[i];
+        want = crc32_bitwise(buf, len);
+
+        for(split = 0; split <= len; ++split) {
+            sylverant_crc32_init(&ctx);
+            sylverant_crc32_update(&ctx, buf, split);
+            sylverant_crc32_update(&ctx, buf + split, len - split);
+
+            if(sylverant_crc32_final(&ctx) != want) {
+                fprintf(stderr, "Update mismatch at length %d, split %d\n",
+                        len, split);
+                return -1;
+            }
+
+            crc1 = sylverant_crc32(buf, split);
+            crc2 = sylverant_crc32(buf + split, len - split);
+
+            if(sylverant_crc32_combine(crc1, crc2, len - split) != want) {
+                fprintf(stderr, "Combine mismatch at length %d, split %d\n",
+                        len, split);
+                return -1;
+            }
+        }
+    }
+
+    /* A big buffer in pieces of varying sizes, some of them odd. */
+    len = MAX_SIZE - 16;
+    want = crc32_bitwise(buf, len);
+    sylverant_crc32_init(&ctx);
+    crc1 = sylverant_crc32(buf, 0);
+
+    for(off = 0, step = 1; off < len; off += split, step = step * 7 + 3) {
+        split = step % 70000;
+
+        if(split > len - off)
+            split = len - off;
+
+        sylverant_crc32_update(&ctx, buf + off, split);
+        crc2 = sylverant_crc32(buf + off, split);
+        crc1 = sylverant_crc32_combine(crc1, crc2, split);
+    }
+
+    if(sylverant_crc32_final(&ctx) != want) {
+        fprintf(stderr, "Update mismatch in pieces, length %d\n", len);
+        return -1;
+    }
+
+    if(crc1 != want) {
+        fprintf(stderr, "Combine mismatch in pieces, length %d\n", len);
+        return -1;
+    }
+
+    return 0;
+}
+
+static double run(uint32_t (*fn)(const uint8_t *, int), const uint8_t *buf,
+                  int size) {
+    double start, end;
+    unsigned long iters = 0;
+    volatile uint32_t sink;
+
+    start = now();
+
+    do {
+        sink = fn(buf, size);
+        ++iters;
+    } while((end = now()) - start < bench_time);
+
+    (void)sink;
+    return (iters * (double)size) / (end - start) / 1048576.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *buf;
+    unsigned long i;
+    double old, cur;
+    int opt;
+
+    while((opt = getopt(argc, argv, "ct:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(!(buf = (uint8_t *)malloc(MAX_SIZE))) {
+        perror("malloc");
+        return 1;
+    }
+
+    srand(1);
+
+    for(i = 0; i < MAX_SIZE; ++i) {
+        buf[i] = (uint8_t)rand();
+    }
+
+    if(check(buf) || check_split(buf))
+        return 1;
+
+    if(csv)
+        printf("test,size,bitwise_mb_per_sec,mb_per_sec\n");
+    else
+        printf("%-8s %8s %14s %12s %8s\n", "test", "size", "bitwise MB/s",
+               "MB/s", "speedup");
+
+    for(i = 0; i < NUM_SIZES; ++i) {
+        old = run(&crc32_bitwise, buf, sizes[i]);
+        cur = run(&sylverant_crc32, buf, sizes[i]);
+
+        if(csv)
+            printf("crc32,%d,%.2f,%.2f\n", sizes[i], old, cur);
+        else
+            printf("%-8s %8d %14.1f %12.1f %7.2fx\n", "crc32", sizes[i], old,
+                   cur, cur / old);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,1008 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "sylverant/encryption.h"
+
+#if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
+#define LE32(x) (((x >> 24) & 0x00FF) | \
+                 ((x >>  8) & 0xFF00) | \
+                 ((x & 0xFF00) <<  8) | \
+                 ((x & 0x00FF) << 24))
+#else
+#define LE32(x) x
+#endif
+
+/* Not in the public header, but exported from the library. */
+void CRYPT_PC_MixKeys(CRYPT_SETUP *cs);
+
+#define MAX_SIZE    0x7C00
+#define MAX_THREADS 64
+
+/* Packet sizes to measure. Small ones are what most of the traffic looks like
+   (headers, movement), the big one is the largest packet the server sends. */
+static const unsigned long sizes[] = { 4, 8, 16, 64, 256, 1024, 4096, MAX_SIZE };
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+static const struct {
+    const char *name;
+    unsigned char type;
+} ciphers[] = {
+    { "pc", CRYPT_PC },
+    { "gc", CRYPT_GAMECUBE },
+    { "bb", CRYPT_BLUEBURST }
+};
+#define NUM_CIPHERS (sizeof(ciphers) / sizeof(ciphers[0]))
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+static int max_threads = 0;
+
+static const uint32_t bench_seed[12] = {
+    0x12345678, 0x9ABCDEF0, 0x0F1E2D3C, 0x4B5A6978, 0x8796A5B4, 0xC3D2E1F0,
+    0x01234567, 0x89ABCDEF, 0xFEDCBA98, 0x76543210, 0xA5A5A5A5, 0x5A5A5A5A
+};
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Prints one result. ns is the time per operation (packet or key setup). */
+static void report(const char *test, const char *cipher, unsigned long size,
+                   int threads, double mbps, double ns) {
+    if(csv)
+        printf("%s,%s,%lu,%d,%.2f,%.1f\n", test, cipher, size, threads, mbps,
+               ns);
+    else if(mbps > 0.0)
+        printf("%-8s %-4s %8lu %4d %12.1f %12.1f\n", test, cipher, size,
+               threads, mbps, ns);
+    else
+        printf("%-8s %-4s %8s %4d %12s %12.1f\n", test, cipher, "-", threads,
+               "-", ns);
+}
+
+/* The PC cipher as it was before the bulk path, one key at a time. */
+static void pc_crypt_word(CRYPT_SETUP *cs, void *data, unsigned long size) {
+    uint8_t *ptr = (uint8_t *)data;
+    uint32_t tmp;
+    unsigned long x;
+
+    for(x = 0; x < size; x += 4) {
+        if(cs->pc_posn == 56) {
+            CRYPT_PC_MixKeys(cs);
+            cs->pc_posn = 1;
+        }
+
+        memcpy(&tmp, ptr + x, 4);
+        tmp = LE32(tmp) ^ cs->keys[cs->pc_posn++];
+        tmp = LE32(tmp);
+        memcpy(ptr + x, &tmp, 4);
+    }
+}
+
+static int check_pc(void) {
+    CRYPT_SETUP c1, c2;
+    uint8_t *a, *b;
+    unsigned long i;
+    int rv;
+
+    a = (uint8_t *)malloc(MAX_SIZE);
+    b = (uint8_t *)malloc(MAX_SIZE);
+    if(!a || !b) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for(i = 0; i < MAX_SIZE; ++i) {
+        a[i] = b[i] = (uint8_t)(i * 7);
+    }
+
+    CRYPT_CreateKeys(&c1, (void *)bench_seed, CRYPT_PC);
+    CRYPT_CreateKeys(&c2, (void *)bench_seed, CRYPT_PC);
+
+    for(i = 0; i < 4; ++i) {
+        pc_crypt_word(&c1, a, MAX_SIZE);
+        CRYPT_CryptData(&c2, b, MAX_SIZE, 1);
+    }
+
+    rv = memcmp(a, b, MAX_SIZE);
+    free(b);
+    free(a);
+    return rv;
+}
+
+/* Everything below is checked against plain CRYPT_CryptData on a second
+   cipher made from the same key. The sizes are mostly odd, and are run over
+   enough times for the PC and GameCube key tables to be remixed (every 224
+   and 2084 bytes) several times over. */
+static const unsigned long check_sizes[] = {
+    1, 3, 4, 5, 7, 8, 9, 13, 31, 64, 222, 225, 1001, 2083, 4097
+};
+#define NUM_CHECK_SIZES (sizeof(check_sizes) / sizeof(check_sizes[0]))
+#define CHECK_ROUNDS    3
+#define CHECK_IOVS      64
+#define CHECK_PACKETS   60
+
+static uint8_t *chk_src, *chk_ref, *chk_out, *chk_tmp;
+static uint32_t chk_rng = 0x2545F491;
+
+static uint32_t rnd(void) {
+    chk_rng ^= chk_rng << 13;
+    chk_rng ^= chk_rng >> 17;
+    chk_rng ^= chk_rng << 5;
+    return chk_rng;
+}
+
+static void fill(uint8_t *buf, unsigned long size) {
+    unsigned long i;
+
+    for(i = 0; i < size; ++i) {
+        buf[i] = (uint8_t)rnd();
+    }
+}
+
+static void make_pair(CRYPT_SETUP *ref, CRYPT_SETUP *cs, unsigned char type) {
+    CRYPT_CreateKeys(ref, (void *)bench_seed, type);
+    CRYPT_CreateKeys(cs, (void *)bench_seed, type);
+}
+
+/* CRYPT_CryptDataTo, both out of place and in place, touching nothing past the
+   end of the output. */
+static int check_to(unsigned char type, int enc) {
+    CRYPT_SETUP ref, cs;
+    unsigned long r, s, size;
+
+    make_pair(&ref, &cs, type);
+
+    for(r = 0; r < CHECK_ROUNDS; ++r) {
+        for(s = 0; s < NUM_CHECK_SIZES; ++s) {
+            size = check_sizes[s];
+            fill(chk_src, size);
+            memcpy(chk_ref, chk_src, size);
+            CRYPT_CryptData(&ref, chk_ref, size, enc);
+
+            memset(chk_out, 0xEE, size + 8);
+
+            if(r == CHECK_ROUNDS - 1) {
+                memcpy(chk_out, chk_src, size);
+                CRYPT_CryptDataTo(&cs, chk_out, chk_out, size, enc);
+            }
+            else {
+                CRYPT_CryptDataTo(&cs, chk_out, chk_src, size, enc);
+            }
+
+            if(memcmp(chk_ref, chk_out, size) || chk_out[size] != 0xEE)
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* CRYPT_CryptDataV, with the data split into random pieces (some empty), and
+   as a region that wraps around the end of a ring buffer. */
+static int check_v(unsigned char type, int enc) {
+    CRYPT_SETUP ref, cs;
+    struct iovec iov[CHECK_IOVS];
+    unsigned long r, s, size, off, len;
+    int n;
+
+    make_pair(&ref, &cs, type);
+
+    for(r = 0; r < CHECK_ROUNDS; ++r) {
+        for(s = 0; s < NUM_CHECK_SIZES; ++s) {
+            size = check_sizes[s];
+            fill(chk_src, size);
+            memcpy(chk_ref, chk_src, size);
+            CRYPT_CryptData(&ref, chk_ref, size, enc);
+
+            if(r & 1) {
+                /* Put the data at the end of a MAX_SIZE ring, wrapping around
+                   to the start part of the way through. */
+                len = size / 2 + 1;
+                off = MAX_SIZE - len;
+                memcpy(chk_out + off, chk_src, len);
+                memcpy(chk_out, chk_src + len, size - len);
+
+                iov[0].iov_base = chk_out + off;
+                iov[0].iov_len = len;
+                iov[1].iov_base = chk_out;
+                iov[1].iov_len = size - len;
+                CRYPT_CryptDataV(&cs, iov, 2, enc);
+
+                memcpy(chk_tmp, chk_out + off, len);
+                memcpy(chk_tmp + len, chk_out, size - len);
+            }
+            else {
+                memcpy(chk_tmp, chk_src, size);
+
+                for(n = 0, off = 0; n < CHECK_IOVS - 1 && off < size; ++n) {
+                    len = rnd() % 20;
+                    if(len > size - off)
+                        len = size - off;
+
+                    iov[n].iov_base = chk_tmp + off;
+                    iov[n].iov_len = len;
+                    off += len;
+                }
+
+                iov[n].iov_base = chk_tmp + off;
+                iov[n++].iov_len = size - off;
+                CRYPT_CryptDataV(&cs, iov, n, enc);
+            }
+
+            if(memcmp(chk_ref, chk_tmp, size))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* CRYPT_SaveState/CRYPT_RestoreState rolling back a crypt, then CRYPT_PeekData
+   giving the same output without moving the cipher along, then the real
+   crypt. */
+static int check_state(unsigned char type, int enc) {
+    CRYPT_SETUP ref, cs;
+    CRYPT_SNAPSHOT snap;
+    unsigned long r, s, size;
+
+    make_pair(&ref, &cs, type);
+
+    for(r = 0; r < CHECK_ROUNDS; ++r) {
+        for(s = 0; s < NUM_CHECK_SIZES; ++s) {
+            size = check_sizes[s];
+            fill(chk_src, size);
+            memcpy(chk_ref, chk_src, size);
+            CRYPT_CryptData(&ref, chk_ref, size, enc);
+
+            CRYPT_SaveState(&cs, &snap);
+            memcpy(chk_out, chk_src, size);
+            CRYPT_CryptData(&cs, chk_out, size, enc);
+
+            if(!CRYPT_RestoreState(&cs, &snap) ||
+               memcmp(chk_ref, chk_out, size))
+                return -1;
+
+            if(!CRYPT_PeekData(&cs, chk_out, chk_src, size, enc) ||
+               memcmp(chk_ref, chk_out, size))
+                return -1;
+
+            memcpy(chk_out, chk_src, size);
+            CRYPT_CryptData(&cs, chk_out, size, enc);
+
+            if(memcmp(chk_ref, chk_out, size))
+                return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* CRYPT_CryptBatch over all three ciphers at once, with each cipher showing up
+   more than once in the same batch. */
+static int check_batch(int enc) {
+    CRYPT_SETUP ref[NUM_CIPHERS * 2], cs[NUM_CIPHERS * 2];
+    CRYPT_BATCH batch[NUM_CHECK_SIZES];
+    unsigned long r, i, off;
+
+    for(i = 0; i < NUM_CIPHERS * 2; ++i) {
+        make_pair(&ref[i], &cs[i], ciphers[i % NUM_CIPHERS].type);
+    }
+
+    for(r = 0; r < CHECK_ROUNDS * 2; ++r) {
+        fill(chk_src, MAX_SIZE);
+        memcpy(chk_ref, chk_src, MAX_SIZE);
+        memcpy(chk_out, chk_src, MAX_SIZE);
+
+        for(i = 0, off = 0; i < NUM_CHECK_SIZES; ++i) {
+            batch[i].cs = &cs[(i + r) % (NUM_CIPHERS * 2)];
+            batch[i].data = chk_out + off;
+            batch[i].size = check_sizes[i];
+            CRYPT_CryptData(&ref[(i + r) % (NUM_CIPHERS * 2)], chk_ref + off,
+                            check_sizes[i], enc);
+            off += check_sizes[i];
+        }
+
+        if(!CRYPT_CryptBatch(batch, NUM_CHECK_SIZES, enc) ||
+           memcmp(chk_ref, chk_out, MAX_SIZE))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* CRYPT_ReceivePackets on a stream of packets that arrives in random sized
+   pieces, a few packets at most per call. Each packet has to come out the same
+   as decrypting it on its own with CRYPT_CryptData. */
+static int check_recv(unsigned char type, int hdr) {
+    CRYPT_SETUP tx, rx, ref;
+    CRYPT_PACKET pkts[4];
+    unsigned long hsize = hdr == CRYPT_HDR_BB ? 8 : 4;
+    unsigned long lens[CHECK_PACKETS];
+    unsigned long i, total = 0, len, padded, pos = 0, have = 0, used, out = 0;
+    long n, p = 0, j;
+
+    make_pair(&tx, &rx, type);
+    CRYPT_CreateKeys(&ref, (void *)bench_seed, type);
+
+    /* Make the packets, keeping a copy decrypted with plain CRYPT_CryptData. */
+    for(i = 0; i < CHECK_PACKETS; ++i) {
+        len = lens[i] = hsize + rnd() % 300;
+        padded = (len + hsize - 1) & ~(hsize - 1);
+        fill(chk_src + total, padded);
+
+        if(hdr == CRYPT_HDR_DC) {
+            chk_src[total + 2] = (uint8_t)len;
+            chk_src[total + 3] = (uint8_t)(len >> 8);
+        }
+        else {
+            chk_src[total] = (uint8_t)len;
+            chk_src[total + 1] = (uint8_t)(len >> 8);
+        }
+
+        CRYPT_CryptData(&tx, chk_src + total, padded, 1);
+        memcpy(chk_ref + total, chk_src + total, padded);
+        CRYPT_CryptData(&ref, chk_ref + total, padded, 0);
+        total += padded;
+    }
+
+    while(pos < total || have) {
+        len = rnd() % 200;
+        if(len > total - pos)
+            len = total - pos;
+
+        memcpy(chk_out + have, chk_src + pos, len);
+        have += len;
+        pos += len;
+
+        n = CRYPT_ReceivePackets(&rx, chk_out, have, hdr, pkts, 4, &used);
+        if(n < 0)
+            return -1;
+
+        for(j = 0; j < n; ++j, ++p) {
+            padded = (lens[p] + hsize - 1) & ~(hsize - 1);
+
+            if(pkts[j].size != lens[p] ||
+               memcmp(pkts[j].data, chk_ref + out, padded))
+                return -1;
+
+            out += padded;
+        }
+
+        memmove(chk_out, chk_out + used, have - used);
+        have -= used;
+
+        if(pos == total && !n)
+            break;
+    }
+
+    return out == total && p == CHECK_PACKETS ? 0 : -1;
+}
+
+/* The per-type states, against a CRYPT_SETUP made from the same key, over
+   enough random sized pieces that the GameCube keys get remixed a few times. */
+static int check_states(unsigned char type, int enc) {
+    CRYPT_SETUP ref;
+    CRYPT_PC_STATE pc;
+    CRYPT_GC_STATE gc;
+    CRYPT_BB_STATE bb;
+    unsigned long r, size;
+
+    CRYPT_CreateKeys(&ref, (void *)bench_seed, type);
+    CRYPT_PC_CreateState(&pc, bench_seed[0]);
+    CRYPT_GC_CreateState(&gc, bench_seed[0]);
+    CRYPT_BB_CreateState(&bb, bench_seed);
+
+    for(r = 0; r < 20; ++r) {
+        size = rnd() % 1500;
+        fill(chk_src, size);
+        memcpy(chk_ref, chk_src, size);
+        memcpy(chk_out, chk_src, size);
+        CRYPT_CryptData(&ref, chk_ref, size, enc);
+
+        switch(type) {
+            case CRYPT_PC:
+                CRYPT_PC_CryptState(&pc, chk_out, size);
+                break;
+
+            case CRYPT_GAMECUBE:
+                CRYPT_GC_CryptState(&gc, chk_out, size);
+                break;
+
+            case CRYPT_BLUEBURST:
+                CRYPT_BB_CryptState(&bb, chk_out, size, enc);
+                break;
+        }
+
+        if(memcmp(chk_ref, chk_out, size))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* The Blue Burst key cache: schedules that come out of it have to be the same
+   as ones built from scratch, and going around more keys than it holds has to
+   miss every time (since the one needed next is always the oldest). */
+#define CACHE_CHECK_SIZE    4
+#define CACHE_CHECK_KEYS    (CACHE_CHECK_SIZE + 2)
+#define CACHE_CHECK_ROUNDS  3
+
+static int check_cache(void) {
+    static CRYPT_SETUP cold[CACHE_CHECK_KEYS], cs;
+    uint32_t seeds[CACHE_CHECK_KEYS][12];
+    CRYPT_CACHE_STATS st;
+    int r, i, rv = -1;
+
+    for(i = 0; i < CACHE_CHECK_KEYS; ++i) {
+        memcpy(seeds[i], bench_seed, sizeof(bench_seed));
+        seeds[i][11] += i;
+        CRYPT_CreateKeys(&cold[i], seeds[i], CRYPT_BLUEBURST);
+    }
+
+    if(!CRYPT_SetKeyCache(CACHE_CHECK_SIZE))
+        return -1;
+
+    for(r = 0; r < CACHE_CHECK_ROUNDS; ++r) {
+        for(i = 0; i < CACHE_CHECK_KEYS; ++i) {
+            CRYPT_CreateKeys(&cs, seeds[i], CRYPT_BLUEBURST);
+
+            if(memcmp(cs.keys, cold[i].keys, sizeof(cs.keys)))
+                goto out;
+        }
+    }
+
+    /* The last few keys used are still there, newest first. */
+    for(i = CACHE_CHECK_KEYS - 1; i >= CACHE_CHECK_KEYS - CACHE_CHECK_SIZE;
+        --i) {
+        CRYPT_CreateKeys(&cs, seeds[i], CRYPT_BLUEBURST);
+
+        if(memcmp(cs.keys, cold[i].keys, sizeof(cs.keys)))
+            goto out;
+    }
+
+    CRYPT_GetKeyCacheStats(&st);
+
+    if(st.hits == CACHE_CHECK_SIZE &&
+       st.misses == CACHE_CHECK_KEYS * CACHE_CHECK_ROUNDS &&
+       st.entries == CACHE_CHECK_SIZE && st.capacity == CACHE_CHECK_SIZE)
+        rv = 0;
+
+out:
+    CRYPT_SetKeyCache(0);
+    return rv;
+}
+
+/* A GameCube cipher has to point into its own key table, not the one it was
+   copied from. */
+static int own_keys(const CRYPT_SETUP *cs) {
+    if(cs->type != CRYPT_GAMECUBE)
+        return 1;
+
+    return cs->gc_block_ptr >= cs->keys && cs->gc_block_ptr < cs->keys + 1042 &&
+        cs->gc_block_end_ptr > cs->keys &&
+        cs->gc_block_end_ptr <= cs->keys + 1042;
+}
+
+/* Runs a cipher and one made fresh from the same seed over the same data, and
+   returns nonzero if they don't match. Part way through, the cipher is copied
+   with CRYPT_CopySetup and the original wiped, and the copy carries on. */
+static int same_stream(CRYPT_SETUP *cs, unsigned char type, uint32_t *seed) {
+    static CRYPT_SETUP ref, copy;
+
+    CRYPT_CreateKeys(&ref, seed, type);
+    fill(chk_src, 3000);
+    memcpy(chk_ref, chk_src, 3000);
+    memcpy(chk_out, chk_src, 3000);
+    CRYPT_CryptData(&ref, chk_ref, 3000, 1);
+
+    if(!own_keys(cs))
+        return -1;
+
+    CRYPT_CryptData(cs, chk_out, 1000, 1);
+    CRYPT_CopySetup(&copy, cs);
+    memset(cs, 0, sizeof(CRYPT_SETUP));
+
+    if(!own_keys(&copy))
+        return -1;
+
+    CRYPT_CryptData(&copy, chk_out + 1000, 3000 - 1000, 1);
+    return memcmp(chk_ref, chk_out, 3000);
+}
+
+/* Pairs from the key pool have to match ones made from their seeds, whether
+   they came out of the pool or were built once it ran dry. Taking twice as
+   many as it holds takes it below the low-water mark, and after that they're
+   taken as fast as possible until one has to be built on the spot. */
+#define POOL_CHECK_SIZE     8
+#define POOL_CHECK_LOW      2
+
+static int check_pool(unsigned char type) {
+    static CRYPT_KEYPAIR pair;
+    CRYPT_KEYPOOL *pool;
+    struct timespec ts = { 0, 1000000 };
+    int i, rv = -1;
+
+    if(!(pool = CRYPT_KeyPoolCreate(type, POOL_CHECK_SIZE, POOL_CHECK_LOW,
+                                    0x5EED)))
+        return -1;
+
+    while(CRYPT_KeyPoolCount(pool) < POOL_CHECK_SIZE) {
+        nanosleep(&ts, NULL);
+    }
+
+    for(i = 0; i < POOL_CHECK_SIZE * 2; ++i) {
+        CRYPT_KeyPoolGet(pool, &pair);
+
+        if(same_stream(&pair.server, type, pair.server_key) ||
+           same_stream(&pair.client, type, pair.client_key))
+            goto out;
+    }
+
+    /* Make sure to get at least one that had to be built on the spot, if the
+       pool can be emptied at all. */
+    for(i = 0; i < 100000; ++i) {
+        if(!CRYPT_KeyPoolGet(pool, &pair))
+            break;
+    }
+
+    if(same_stream(&pair.server, type, pair.server_key) ||
+       same_stream(&pair.client, type, pair.client_key))
+        goto out;
+
+    rv = 0;
+
+out:
+    CRYPT_KeyPoolDestroy(pool);
+    return rv;
+}
+
+/* A Blue Burst cipher has to be refused with the 4 byte header layouts. */
+static int check_recv_type(void) {
+    CRYPT_SETUP cs;
+    CRYPT_PACKET pkts[4];
+    unsigned long used;
+
+    CRYPT_CreateKeys(&cs, (void *)bench_seed, CRYPT_BLUEBURST);
+    memset(chk_out, 0, 64);
+
+    if(CRYPT_ReceivePackets(&cs, chk_out, 64, CRYPT_HDR_DC, pkts, 4,
+                            &used) != -1 ||
+       CRYPT_ReceivePackets(&cs, chk_out, 64, CRYPT_HDR_PC, pkts, 4,
+                            &used) != -1)
+        return -1;
+
+    return 0;
+}
+
+static int check_apis(void) {
+    static const struct {
+        unsigned char type;
+        int hdr;
+    } recv[] = {
+        { CRYPT_PC, CRYPT_HDR_DC },
+        { CRYPT_PC, CRYPT_HDR_PC },
+        { CRYPT_GAMECUBE, CRYPT_HDR_DC },
+        { CRYPT_BLUEBURST, CRYPT_HDR_BB }
+    };
+    unsigned long c;
+    int enc, rv = -1;
+
+    chk_src = (uint8_t *)malloc(MAX_SIZE + 8);
+    chk_ref = (uint8_t *)malloc(MAX_SIZE + 8);
+    chk_out = (uint8_t *)malloc(MAX_SIZE + 8);
+    chk_tmp = (uint8_t *)malloc(MAX_SIZE + 8);
+    if(!chk_src || !chk_ref || !chk_out || !chk_tmp) {
+        perror("malloc");
+        exit(1);
+    }
+
+    for(enc = 0; enc < 2; ++enc) {
+        for(c = 0; c < NUM_CIPHERS; ++c) {
+            if(check_to(ciphers[c].type, enc)) {
+                fprintf(stderr, "CRYPT_CryptDataTo mismatch (%s)\n",
+                        ciphers[c].name);
+                goto out;
+            }
+
+            if(check_v(ciphers[c].type, enc)) {
+                fprintf(stderr, "CRYPT_CryptDataV mismatch (%s)\n",
+                        ciphers[c].name);
+                goto out;
+            }
+
+            if(check_state(ciphers[c].type, enc)) {
+                fprintf(stderr, "CRYPT_SaveState/RestoreState/PeekData "
+                        "mismatch (%s)\n", ciphers[c].name);
+                goto out;
+            }
+
+            if(check_states(ciphers[c].type, enc)) {
+                fprintf(stderr, "Type-specific state mismatch (%s)\n",
+                        ciphers[c].name);
+                goto out;
+            }
+        }
+
+        if(check_batch(enc)) {
+            fprintf(stderr, "CRYPT_CryptBatch mismatch\n");
+            goto out;
+        }
+    }
+
+    for(c = 0; c < sizeof(recv) / sizeof(recv[0]); ++c) {
+        if(check_recv(recv[c].type, recv[c].hdr)) {
+            fprintf(stderr, "CRYPT_ReceivePackets mismatch (type %d, header "
+                    "%d)\n", recv[c].type, recv[c].hdr);
+            goto out;
+        }
+    }
+
+    for(c = 0; c < NUM_CIPHERS; ++c) {
+        if(check_pool(ciphers[c].type)) {
+            fprintf(stderr, "Key pool pair mismatch (%s)\n", ciphers[c].name);
+            goto out;
+        }
+    }
+
+    if(check_cache()) {
+        fprintf(stderr, "Blue Burst key cache mismatch\n");
+        goto out;
+    }
+
+    if(check_recv_type()) {
+        fprintf(stderr, "CRYPT_ReceivePackets accepted a Blue Burst cipher "
+                "with a 4 byte header\n");
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    free(chk_tmp);
+    free(chk_out);
+    free(chk_ref);
+    free(chk_src);
+    return rv;
+}
+
+/* Runs the cipher over the buffer until the time is up, and returns the
+   number of packets processed in *iters. */
+static double run_crypt(unsigned char type, int fast, uint8_t *buf,
+                        unsigned long size, unsigned long *iters) {
+    CRYPT_SETUP cs;
+    double start, end;
+    unsigned long i, n = 0;
+
+    CRYPT_CreateKeys(&cs, (void *)bench_seed, type);
+    start = now();
+
+    /* Check the clock every so often, rather than once per 4 byte packet. */
+    do {
+        if(fast) {
+            for(i = 0; i < 64; ++i) {
+                CRYPT_CryptFast(&cs, buf, size, 1);
+            }
+        }
+        else {
+            for(i = 0; i < 64; ++i) {
+                CRYPT_CryptData(&cs, buf, size, 1);
+            }
+        }
+
+        n += 64;
+    } while((end = now()) - start < bench_time);
+
+    *iters = n;
+    return end - start;
+}
+
+static void bench_throughput(uint8_t *buf) {
+    unsigned long c, s, iters;
+    double t;
+
+    for(c = 0; c < NUM_CIPHERS; ++c) {
+        for(s = 0; s < NUM_SIZES; ++s) {
+            t = run_crypt(ciphers[c].type, 0, buf, sizes[s], &iters);
+            report("crypt", ciphers[c].name, sizes[s], 1,
+                   iters * (double)sizes[s] / t / 1048576.0,
+                   t * 1000000000.0 / iters);
+        }
+
+        /* The per-call overhead only matters for small packets. */
+        for(s = 0; s < NUM_SIZES && sizes[s] <= 64; ++s) {
+            t = run_crypt(ciphers[c].type, 1, buf, sizes[s], &iters);
+            report("fast", ciphers[c].name, sizes[s], 1,
+                   iters * (double)sizes[s] / t / 1048576.0,
+                   t * 1000000000.0 / iters);
+        }
+    }
+
+    /* Keep the old per-word PC loop around as a baseline for the bulk path. */
+    for(s = 0; s < NUM_SIZES; ++s) {
+        CRYPT_SETUP cs;
+        double start, end;
+
+        CRYPT_CreateKeys(&cs, (void *)bench_seed, CRYPT_PC);
+        iters = 0;
+        start = now();
+
+        do {
+            pc_crypt_word(&cs, buf, sizes[s]);
+            ++iters;
+        } while((end = now()) - start < bench_time);
+
+        t = end - start;
+        report("pc-word", "pc", sizes[s], 1,
+               iters * (double)sizes[s] / t / 1048576.0,
+               t * 1000000000.0 / iters);
+    }
+}
+
+/* A batch of Blue Burst sessions, one buffer each, done with one call to
+   CRYPT_CryptBatch and then with CRYPT_CryptData on each buffer in turn. The
+   time is per buffer. */
+#define BATCH_SESSIONS  16
+
+static void bench_batch(uint8_t *buf) {
+    static const unsigned long bsizes[] = { 64, 1024 };
+    static CRYPT_SETUP cs[BATCH_SESSIONS];
+    CRYPT_BATCH batch[BATCH_SESSIONS];
+    uint32_t seed[12];
+    unsigned long s, i, size, iters;
+    double start, end, t;
+    int loop;
+
+    for(i = 0; i < BATCH_SESSIONS; ++i) {
+        memcpy(seed, bench_seed, sizeof(seed));
+        seed[0] += i;
+        CRYPT_CreateKeys(&cs[i], seed, CRYPT_BLUEBURST);
+    }
+
+    for(s = 0; s < sizeof(bsizes) / sizeof(bsizes[0]); ++s) {
+        size = bsizes[s];
+
+        for(i = 0; i < BATCH_SESSIONS; ++i) {
+            batch[i].cs = &cs[i];
+            batch[i].data = buf + i * size;
+            batch[i].size = size;
+        }
+
+        for(loop = 0; loop < 2; ++loop) {
+            iters = 0;
+            start = now();
+
+            do {
+                if(loop) {
+                    for(i = 0; i < BATCH_SESSIONS; ++i) {
+                        CRYPT_CryptData(batch[i].cs, batch[i].data, size, 1);
+                    }
+                }
+                else {
+                    CRYPT_CryptBatch(batch, BATCH_SESSIONS, 1);
+                }
+
+                iters += BATCH_SESSIONS;
+            } while((end = now()) - start < bench_time);
+
+            t = end - start;
+            report(loop ? "batch-1" : "batch", "bb", size, 1,
+                   iters * (double)size / t / 1048576.0,
+                   t * 1000000000.0 / iters);
+        }
+    }
+}
+
+static void bench_keys(void) {
+    CRYPT_SETUP cs;
+    uint32_t seed[12];
+    unsigned long c, iters;
+    double start, end;
+
+    for(c = 0; c < NUM_CIPHERS; ++c) {
+        memcpy(seed, bench_seed, sizeof(seed));
+        iters = 0;
+        start = now();
+
+        /* Change the seed each time so the key cache (if enabled) never
+           gets a hit and this measures building the schedule. */
+        do {
+            seed[0]++;
+            CRYPT_CreateKeys(&cs, seed, ciphers[c].type);
+            ++iters;
+        } while((end = now()) - start < bench_time);
+
+        report("keys", ciphers[c].name, 0, 1, 0.0,
+               (end - start) * 1000000000.0 / iters);
+    }
+
+    /* A client reconnecting with the same seed, with the key cache on. */
+    CRYPT_SetKeyCache(16);
+    iters = 0;
+    start = now();
+
+    do {
+        CRYPT_CreateKeys(&cs, (void *)bench_seed, CRYPT_BLUEBURST);
+        ++iters;
+    } while((end = now()) - start < bench_time);
+
+    CRYPT_SetKeyCache(0);
+    report("keys-hit", "bb", 0, 1, 0.0, (end - start) * 1000000000.0 / iters);
+}
+
+typedef struct {
+    pthread_t thread;
+    unsigned char type;
+    unsigned long size;
+    unsigned long iters;
+    double time;
+} thread_arg;
+
+static void *thread_run(void *d) {
+    thread_arg *a = (thread_arg *)d;
+    uint8_t *buf;
+
+    if(!(buf = (uint8_t *)malloc(a->size))) {
+        perror("malloc");
+        exit(1);
+    }
+
+    memset(buf, 0x5A, a->size);
+    a->time = run_crypt(a->type, 0, buf, a->size, &a->iters);
+    free(buf);
+    return NULL;
+}
+
+/* Each thread has its own session, like the ship's per-client threads. The
+   MB/s is the total over all threads and the time is per packet within one
+   thread, so perfect scaling shows up as MB/s growing and ns/op staying put.
+   Thread counts go up in powers of two, and the last step is always max. */
+static void bench_threads(int max) {
+    static const unsigned long tsizes[] = { 64, 1024 };
+    thread_arg args[MAX_THREADS];
+    unsigned long c, s, iters;
+    double t;
+    int n, i;
+
+    for(c = 0; c < NUM_CIPHERS; ++c) {
+        for(s = 0; s < sizeof(tsizes) / sizeof(tsizes[0]); ++s) {
+            for(n = 1; ; n = (n << 1) > max ? max : n << 1) {
+                for(i = 0; i < n; ++i) {
+                    args[i].type = ciphers[c].type;
+                    args[i].size = tsizes[s];
+
+                    if(pthread_create(&args[i].thread, NULL, &thread_run,
+                                      &args[i])) {
+                        perror("pthread_create");
+                        exit(1);
+                    }
+                }
+
+                iters = 0;
+                t = 0.0;
+
+                for(i = 0; i < n; ++i) {
+                    pthread_join(args[i].thread, NULL);
+                    iters += args[i].iters;
+                    if(args[i].time > t)
+                        t = args[i].time;
+                }
+
+                report("threads", ciphers[c].name, tsizes[s], n,
+                       iters * (double)tsizes[s] / t / 1048576.0,
+                       t * n * 1000000000.0 / iters);
+
+                if(n == max)
+                    break;
+            }
+        }
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-c] [-t seconds] [-j threads]\n"
+            "  -c          Print results as CSV\n"
+            "  -t seconds  Time to spend on each measurement (default 0.5)\n"
+            "  -j threads  Highest thread count to scale to (default: number "
+            "of CPUs)\n", prog);
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *buf;
+    unsigned long i;
+    int opt;
+
+    while((opt = getopt(argc, argv, "ct:j:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            case 'j':
+                max_threads = atoi(optarg);
+                break;
+
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(bench_time <= 0.0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if(max_threads <= 0) {
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        /* Always show some scaling, even on a single CPU machine. */
+        if(max_threads < 2)
+            max_threads = 2;
+    }
+
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    if(check_pc()) {
+        fprintf(stderr, "PC bulk output does not match the per-word loop!\n");
+        return 1;
+    }
+
+    if(check_apis())
+        return 1;
+
+    if(!(buf = (uint8_t *)malloc(MAX_SIZE))) {
+        perror("malloc");
+        return 1;
+    }
+
+    for(i = 0; i < MAX_SIZE; ++i) {
+        buf[i] = (uint8_t)(i * 7);
+    }
+
+    if(csv)
+        printf("test,cipher,size,threads,mb_per_sec,ns_per_op\n");
+    else
+        printf("%-8s %-4s %8s %4s %12s %12s\n", "test", "ciph", "size",
+               "thr", "MB/s", "ns/op");
+
+    bench_throughput(buf);
+    bench_batch(buf);
+    bench_keys();
+    bench_threads(max_threads);
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,400 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "sylverant/digest.h"
+#include "sylverant/checksum.h"
+#include "sylverant/utils.h"
+
+#define MAX_SIZE    (1 << 20)
+#define NUM_FILES   32
+
+/* Sizes of the files the check works on. */
+static const size_t check_sizes[] = { 0, 1, 63, 64, 1000, 65536, 300007 };
+#define CHECK_FILES (sizeof(check_sizes) / sizeof(check_sizes[0]))
+
+/* Sizes of the files that get timed. */
+static const size_t sizes[] = { 4096, 65536, MAX_SIZE };
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+static char dir[] = "/tmp/digest_benchXXXXXX";
+static char index_fn[64];
+static uint8_t *buf;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void file_name(char *fn, size_t len, int i) {
+    snprintf(fn, len, "%s/file%d", dir, i);
+}
+
+/* Write out a file, starting at the given offset into the random data so that
+   files of the same size don't all look alike. */
+static int write_file(const char *fn, size_t off, size_t size) {
+    FILE *fp;
+
+    if(!(fp = fopen(fn, "wb"))) {
+        perror(fn);
+        return -1;
+    }
+
+    if((size && fwrite(buf + off, size, 1, fp) != 1) || fclose(fp)) {
+        perror(fn);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Check a digest against what md5_file and sylverant_crc32 make of the file,
+   and against what sylverant_digest_get said it did. */
+static int check_file(sylverant_digest_cache_t *c, const char *fn, int want,
+                      const char *what) {
+    sylverant_digest_t d;
+    uint8_t md5[16];
+    struct stat st;
+    uint8_t *data;
+    FILE *fp;
+    int rv;
+
+    if((rv = sylverant_digest_get(c, fn, &d)) != want) {
+        fprintf(stderr, "Digest %s: got %d, expected %d for %s\n", what, rv,
+                want, fn);
+        return -1;
+    }
+
+    if(stat(fn, &st) || md5_file(fn, md5) ||
+       !(data = (uint8_t *)malloc(st.st_size + 1))) {
+        perror(fn);
+        return -1;
+    }
+
+    if(!(fp = fopen(fn, "rb")) ||
+       (st.st_size && fread(data, st.st_size, 1, fp) != 1)) {
+        perror(fn);
+        free(data);
+
+        if(fp)
+            fclose(fp);
+
+        return -1;
+    }
+
+    fclose(fp);
+
+    if(d.size != (uint64_t)st.st_size || memcmp(d.md5, md5, 16) ||
+       d.crc32 != sylverant_crc32(data, (int)st.st_size)) {
+        fprintf(stderr, "Digest mismatch (%s) for %s\n", what, fn);
+        free(data);
+        return -1;
+    }
+
+    free(data);
+    return 0;
+}
+
+static int check_all(sylverant_digest_cache_t *c, int want, const char *what) {
+    char fn[64];
+    size_t i;
+
+    for(i = 0; i < CHECK_FILES; ++i) {
+        file_name(fn, sizeof(fn), (int)i);
+
+        if(check_file(c, fn, want, what))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Hash everything from scratch, then from the cache, then from the index
+   after saving it. Then change a file's time, another's size, delete one and
+   leave another alone, and make sure that each is picked up correctly before
+   and after saving again with pruning. */
+static int check(void) {
+    sylverant_digest_cache_t *c;
+    sylverant_digest_t d;
+    struct timespec times[2];
+    char fn[64], fn2[64], fn3[64], fn4[64];
+    size_t i;
+    int rv = -1;
+
+    for(i = 0; i < CHECK_FILES; ++i) {
+        file_name(fn, sizeof(fn), (int)i);
+
+        if(write_file(fn, i * 7, check_sizes[i]))
+            return -1;
+    }
+
+    if(!(c = sylverant_digest_open(index_fn))) {
+        fprintf(stderr, "Couldn't open digest cache\n");
+        return -1;
+    }
+
+    if(check_all(c, 0, "cold") || check_all(c, 1, "warm"))
+        goto out;
+
+    if(sylverant_digest_save(c, 0)) {
+        fprintf(stderr, "Couldn't save digest cache\n");
+        goto out;
+    }
+
+    sylverant_digest_close(c);
+
+    if(!(c = sylverant_digest_open(index_fn))) {
+        fprintf(stderr, "Couldn't reopen digest cache\n");
+        return -1;
+    }
+
+    if(check_all(c, 1, "reopened"))
+        goto out;
+
+    sylverant_digest_close(c);
+
+    /* Move one file's modification time, rewrite another at a new size, and
+       remove a third. */
+    file_name(fn, sizeof(fn), 2);
+    file_name(fn2, sizeof(fn2), 4);
+    file_name(fn3, sizeof(fn3), 5);
+    file_name(fn4, sizeof(fn4), 6);
+
+    times[0].tv_sec = times[1].tv_sec = time(NULL) + 100;
+    times[0].tv_nsec = times[1].tv_nsec = 0;
+
+    if(utimensat(AT_FDCWD, fn, times, 0) ||
+       write_file(fn2, 1, check_sizes[4] + 17) || unlink(fn3)) {
+        perror("Couldn't change files");
+        return -1;
+    }
+
+    if(!(c = sylverant_digest_open(index_fn))) {
+        fprintf(stderr, "Couldn't reopen digest cache\n");
+        return -1;
+    }
+
+    if(check_file(c, fn, 0, "new mtime") || check_file(c, fn, 1, "new mtime") ||
+       check_file(c, fn2, 0, "new size") || check_file(c, fn2, 1, "new size"))
+        goto out;
+
+    if(sylverant_digest_get(c, fn3, &d) != -1 ||
+       errno != ENOENT) {
+        fprintf(stderr, "Digest of deleted file %s\n", fn3);
+        goto out;
+    }
+
+    /* Everything but the last file has been asked for now. */
+    for(i = 0; i < CHECK_FILES - 1; ++i) {
+        file_name(fn3, sizeof(fn3), (int)i);
+
+        if(i != 5 && check_file(c, fn3, 1, "after changes"))
+            goto out;
+    }
+
+    if(sylverant_digest_save(c, 1)) {
+        fprintf(stderr, "Couldn't save digest cache\n");
+        goto out;
+    }
+
+    sylverant_digest_close(c);
+
+    /* The file that wasn't asked for (and the deleted one, were it to come
+       back) should have been pruned, and the rest kept, changes and all. */
+    if(!(c = sylverant_digest_open(index_fn))) {
+        fprintf(stderr, "Couldn't reopen digest cache\n");
+        return -1;
+    }
+
+    if(check_file(c, fn, 1, "pruned reopen") ||
+       check_file(c, fn2, 1, "pruned reopen") ||
+       check_file(c, fn4, 0, "pruned reopen"))
+        goto out;
+
+    file_name(fn3, sizeof(fn3), 5);
+
+    if(write_file(fn3, 5 * 7, check_sizes[5]) ||
+       check_file(c, fn3, 0, "pruned reopen"))
+        goto out;
+
+    rv = 0;
+
+out:
+    sylverant_digest_close(c);
+    return rv;
+}
+
+static void cleanup(void) {
+    char fn[64];
+    int i;
+
+    for(i = 0; i < NUM_FILES; ++i) {
+        file_name(fn, sizeof(fn), i);
+        unlink(fn);
+    }
+
+    unlink(index_fn);
+    rmdir(dir);
+}
+
+/* Look up every file, with the cache either empty (so everything is hashed)
+   or just opened from a full index. Gives microseconds per file. */
+static double run(int warm) {
+    sylverant_digest_cache_t *c;
+    sylverant_digest_t d;
+    double start, end;
+    unsigned long iters = 0;
+    char fn[64];
+    int i;
+
+    if(!warm)
+        unlink(index_fn);
+
+    start = now();
+
+    do {
+        if(!(c = sylverant_digest_open(index_fn)))
+            return -1.0;
+
+        for(i = 0; i < NUM_FILES; ++i) {
+            file_name(fn, sizeof(fn), i);
+
+            if(sylverant_digest_get(c, fn, &d) != warm) {
+                sylverant_digest_close(c);
+                return -1.0;
+            }
+        }
+
+        sylverant_digest_close(c);
+        ++iters;
+    } while((end = now()) - start < bench_time);
+
+    return (end - start) * 1000000.0 / (iters * (double)NUM_FILES);
+}
+
+int main(int argc, char *argv[]) {
+    sylverant_digest_cache_t *c;
+    sylverant_digest_t d;
+    unsigned long i;
+    double old, cur;
+    char fn[64];
+    int opt, j, rv = 1;
+
+    while((opt = getopt(argc, argv, "ct:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(!(buf = (uint8_t *)malloc(MAX_SIZE + NUM_FILES * 7))) {
+        perror("malloc");
+        return 1;
+    }
+
+    srand(1);
+
+    for(i = 0; i < MAX_SIZE + NUM_FILES * 7; ++i) {
+        buf[i] = (uint8_t)rand();
+    }
+
+    if(!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    snprintf(index_fn, sizeof(index_fn), "%s/index", dir);
+
+    if(check())
+        goto out;
+
+    if(csv)
+        printf("test,size,cold_us_per_file,warm_us_per_file\n");
+    else
+        printf("%-8s %8s %12s %12s %8s\n", "test", "size", "cold us",
+               "warm us", "speedup");
+
+    for(i = 0; i < NUM_SIZES; ++i) {
+        for(j = 0; j < NUM_FILES; ++j) {
+            file_name(fn, sizeof(fn), j);
+
+            if(write_file(fn, j * 7, sizes[i]))
+                goto out;
+        }
+
+        old = run(0);
+
+        /* Fill in the index for the warm runs. */
+        if(!(c = sylverant_digest_open(index_fn)))
+            goto out;
+
+        for(j = 0; j < NUM_FILES; ++j) {
+            file_name(fn, sizeof(fn), j);
+            sylverant_digest_get(c, fn, &d);
+        }
+
+        if(sylverant_digest_save(c, 1)) {
+            sylverant_digest_close(c);
+            goto out;
+        }
+
+        sylverant_digest_close(c);
+        cur = run(1);
+
+        if(old < 0.0 || cur < 0.0) {
+            fprintf(stderr, "Digest lookup failed\n");
+            goto out;
+        }
+
+        if(csv)
+            printf("digest,%zu,%.2f,%.2f\n", sizes[i], old, cur);
+        else
+            printf("%-8s %8zu %12.2f %12.2f %7.2fx\n", "digest", sizes[i],
+                   old, cur, old / cur);
+    }
+
+    rv = 0;
+
+out:
+    cleanup();
+    free(buf);
+    return rv;
+}
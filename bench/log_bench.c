@@ -0,0 +1,433 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sylverant/log.h"
+
+#define MAX_THREADS 64
+#define BATCH       64
+
+#define CHECK_THREADS   4
+#define CHECK_LINES     5000
+#define PAD_MAX         800
+
+/* Enough for the writer to fall well behind, but still far fewer slots than
+   the lines need. */
+#define CHECK_RING      (1 << 18)
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+typedef struct {
+    pthread_t thread;
+    FILE *fp;
+    int id;
+    int first;
+    unsigned long lines;
+    double time;
+} thread_arg;
+
+static char pad[PAD_MAX + 1];
+static atomic_int flushed;
+static pthread_barrier_t start_barrier;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+/* Lines run from well under one slot of the ring up to several, so that they
+   wrap around its end at all sorts of points. */
+static int pad_len(int n) {
+    return (n % 9) * (PAD_MAX / 8);
+}
+
+/* Log a run of numbered lines from one thread. */
+static void *check_run(void *d) {
+    thread_arg *a = (thread_arg *)d;
+    int i;
+
+    for(i = a->first; i < a->first + CHECK_LINES; ++i) {
+        syl_flogf(a->fp, SYL_LOG_INFO, "log_bench", a->id, "T%d N%d %.*s\n",
+                  a->id, i, pad_len(i), pad);
+    }
+
+    return NULL;
+}
+
+static int run_producers(FILE *fp, int first) {
+    thread_arg args[CHECK_THREADS];
+    int i;
+
+    for(i = 0; i < CHECK_THREADS; ++i) {
+        args[i].fp = fp;
+        args[i].id = i;
+        args[i].first = first;
+
+        if(pthread_create(&args[i].thread, NULL, &check_run, &args[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < CHECK_THREADS; ++i) {
+        pthread_join(args[i].thread, NULL);
+    }
+
+    return 0;
+}
+
+/* Read what's been written so far, up to the given marker line. Each thread's
+   lines must come out in order, whole, and (unless some could have been
+   dropped) without any missing. */
+static int read_section(FILE *in, const char *end, int drop, int *next,
+                        unsigned long *seen) {
+    char line[PAD_MAX + 256], *msg;
+    int t, n, len, plen;
+
+    clearerr(in);
+
+    while(fgets(line, sizeof(line), in)) {
+        if(!(msg = strstr(line, "]: "))) {
+            fprintf(stderr, "Log line without a prefix: %s", line);
+            return -1;
+        }
+
+        msg += 3;
+
+        if(!strcmp(msg, end))
+            return 0;
+
+        len = -1;
+
+        if(sscanf(msg, "T%d N%d%n", &t, &n, &len) != 2 || len < 0 ||
+           msg[len++] != ' ' || t < 0 || t >= CHECK_THREADS) {
+            fprintf(stderr, "Garbled log line: %s", line);
+            return -1;
+        }
+
+        plen = pad_len(n);
+
+        if((int)strlen(msg + len) != plen + 1 ||
+           strspn(msg + len, "x") != (size_t)plen) {
+            fprintf(stderr, "Log line cut short: T%d N%d\n", t, n);
+            return -1;
+        }
+
+        if(drop ? n < next[t] : n != next[t]) {
+            fprintf(stderr, "Log line out of order: T%d N%d (expected %d)\n",
+                    t, n, next[t]);
+            return -1;
+        }
+
+        next[t] = n + 1;
+        ++*seen;
+    }
+
+    fprintf(stderr, "Log ended before %s", end);
+    return -1;
+}
+
+static void *flush_run(void *d) {
+    (void)d;
+    syl_log_flush();
+    atomic_store(&flushed, 1);
+    return NULL;
+}
+
+/* Log a marker and flush from another thread while holding the file's lock,
+   so that the writer can't get the marker out until the lock is let go. The
+   flush has to still be waiting by then. */
+static int flush_locked(FILE *fp, const char *marker) {
+    struct timespec ts = { 0, 50000000 };
+    pthread_t thd;
+    int early;
+
+    flockfile(fp);
+    syl_flogf(fp, SYL_LOG_INFO, "log_bench", 0, "%s", marker);
+    atomic_store(&flushed, 0);
+
+    if(pthread_create(&thd, NULL, &flush_run, NULL)) {
+        perror("pthread_create");
+        funlockfile(fp);
+        return -1;
+    }
+
+    nanosleep(&ts, NULL);
+    early = atomic_load(&flushed);
+    funlockfile(fp);
+    pthread_join(thd, NULL);
+
+    if(early) {
+        fprintf(stderr, "syl_log_flush returned before the log was written\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int check_counts(const int *next, int want) {
+    int i;
+
+    for(i = 0; i < CHECK_THREADS; ++i) {
+        if(next[i] != want) {
+            fprintf(stderr, "Lines from thread %d missing (%d of %d)\n", i,
+                    next[i], want);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Several threads logging through a ring with far fewer slots than they have
+   lines. Everything logged before syl_log_flush must be in the file when it
+   returns, and everything logged before syl_log_stop_async must be written
+   before it returns (and so before anything logged directly after it). With
+   lines being dropped, what does come out must still be in order, and add up
+   with the count of drops. */
+static int check(void) {
+    char fn[] = "/tmp/log_benchXXXXXX";
+    int next[CHECK_THREADS] = { 0 }, fd, rv = -1;
+    unsigned long seen = 0;
+    FILE *fp, *in = NULL;
+
+    if((fd = mkstemp(fn)) < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+
+    if(!(fp = fdopen(fd, "w")) || !(in = fopen(fn, "r"))) {
+        perror(fn);
+        goto out;
+    }
+
+    /* A ring that waits when it's full. */
+    if(syl_log_start_async(CHECK_RING, SYL_LOG_ASYNC_BLOCK)) {
+        fprintf(stderr, "Couldn't start async logging\n");
+        goto out;
+    }
+
+    if(run_producers(fp, 0))
+        goto out;
+
+    if(flush_locked(fp, "FLUSH\n") ||
+       read_section(in, "FLUSH\n", 0, next, &seen) ||
+       check_counts(next, CHECK_LINES))
+        goto out;
+
+    /* Now without the flush, so the writer is still going when it's told to
+       stop. */
+    if(run_producers(fp, CHECK_LINES))
+        goto out;
+
+    syl_flogf(fp, SYL_LOG_INFO, "log_bench", 0, "STOP\n");
+    syl_log_stop_async();
+    syl_flogf(fp, SYL_LOG_INFO, "log_bench", 0, "DIRECT\n");
+
+    if(read_section(in, "STOP\n", 0, next, &seen) ||
+       check_counts(next, CHECK_LINES * 2) ||
+       read_section(in, "DIRECT\n", 0, next, &seen))
+        goto out;
+
+    /* Last, a ring that throws lines away when it's full. */
+    if(syl_log_start_async(0, SYL_LOG_ASYNC_DROP)) {
+        fprintf(stderr, "Couldn't start async logging\n");
+        goto out;
+    }
+
+    seen = 0;
+
+    if(run_producers(fp, CHECK_LINES * 2))
+        goto out;
+
+    /* Make room for the marker first, so that it isn't dropped itself. */
+    syl_log_flush();
+
+    if(flush_locked(fp, "DROP\n") ||
+       read_section(in, "DROP\n", 1, next, &seen))
+        goto out;
+
+    if(seen + syl_log_dropped() != CHECK_THREADS * CHECK_LINES) {
+        fprintf(stderr, "Lines lost: %lu written, %lu dropped, %d logged\n",
+                seen, syl_log_dropped(), CHECK_THREADS * CHECK_LINES);
+        goto out;
+    }
+
+    rv = 0;
+
+out:
+    syl_log_stop_async();
+
+    if(in)
+        fclose(in);
+
+    if(fp)
+        fclose(fp);
+    else
+        close(fd);
+
+    unlink(fn);
+    return rv;
+}
+
+static void *thread_run(void *d) {
+    thread_arg *a = (thread_arg *)d;
+    double start, end;
+    unsigned long n = 0;
+    int i;
+
+    pthread_barrier_wait(&start_barrier);
+    start = now();
+
+    do {
+        for(i = 0; i < BATCH; ++i) {
+            syl_flogf(a->fp, SYL_LOG_INFO, "log_bench", a->id,
+                      "Thread %d logged line %lu\n", a->id, n + i);
+        }
+
+        n += BATCH;
+    } while((end = now()) - start < bench_time);
+
+    a->lines = n;
+    a->time = end - start;
+    return NULL;
+}
+
+/* Lines per second, logging to a file that throws everything away, either
+   directly or through a ring big enough not to fill up. */
+static int run(FILE *fp, int nthreads, int async) {
+    thread_arg args[MAX_THREADS];
+    unsigned long lines = 0;
+    double t = 0.0;
+    int i;
+
+    if(async && syl_log_start_async(1 << 20, SYL_LOG_ASYNC_BLOCK))
+        return -1;
+
+    pthread_barrier_init(&start_barrier, NULL, nthreads);
+
+    for(i = 0; i < nthreads; ++i) {
+        args[i].fp = fp;
+        args[i].id = i;
+
+        if(pthread_create(&args[i].thread, NULL, &thread_run, &args[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < nthreads; ++i) {
+        pthread_join(args[i].thread, NULL);
+        lines += args[i].lines;
+
+        if(args[i].time > t)
+            t = args[i].time;
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+
+    if(async)
+        syl_log_stop_async();
+
+    if(csv)
+        printf("%s,%d,%.2f,%.2f\n", async ? "async" : "sync", nthreads,
+               lines / t / 1000000.0, t * nthreads * 1000000000.0 / lines);
+    else
+        printf("%-8s %4d %14.2f %12.2f\n", async ? "async" : "sync",
+               nthreads, lines / t / 1000000.0,
+               t * nthreads * 1000000000.0 / lines);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt, n, max_threads = 0;
+    FILE *fp;
+
+    while((opt = getopt(argc, argv, "ct:j:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            case 'j':
+                max_threads = atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds] [-j threads]\n",
+                        argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(max_threads <= 0) {
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if(max_threads < 2)
+            max_threads = 2;
+    }
+
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    memset(pad, 'x', PAD_MAX);
+
+    if(check())
+        return 1;
+
+    if(!(fp = fopen("/dev/null", "w"))) {
+        perror("/dev/null");
+        return 1;
+    }
+
+    if(csv)
+        printf("test,threads,mlines_per_sec,ns_per_line\n");
+    else
+        printf("%-8s %4s %14s %12s\n", "test", "thr", "Mlines/s",
+               "ns/line");
+
+    /* Thread counts go up in powers of two, and the last step is always max. */
+    for(n = 1; ; n = (n << 1) > max_threads ? max_threads : n << 1) {
+        if(run(fp, n, 0) || run(fp, n, 1)) {
+            fclose(fp);
+            return 1;
+        }
+
+        if(n == max_threads)
+            break;
+    }
+
+    fclose(fp);
+    return 0;
+}
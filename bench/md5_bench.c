@@ -0,0 +1,262 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#include "sylverant/utils.h"
+
+#define NUM_INPUTS  1024
+#define MAX_SIZE    4096
+
+/* A bit over the window md5_file maps the file in with, so the hash has to be
+   carried over from one window to the next. */
+#define FILE_SIZE   ((1 << 26) + 100003)
+
+/* Password-sized inputs up to small files. */
+static const uint32_t sizes[] = { 16, 55, 64, 256, 1024, MAX_SIZE };
+#define NUM_SIZES   (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+static const uint8_t *inputs[NUM_INPUTS];
+static uint32_t lens[NUM_INPUTS];
+static uint8_t out1[NUM_INPUTS][16], out2[NUM_INPUTS][16];
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void hash_scalar(int count) {
+    int i;
+
+    for(i = 0; i < count; ++i) {
+        md5(inputs[i], lens[i], out1[i]);
+    }
+}
+
+static void hash_batch(int count) {
+    md5_batch(inputs, lens, count, out2);
+}
+
+/* Mixed lengths (so lanes finish at different times) and every batch size up
+   to a bit over the widest the code will use. */
+static int check(void) {
+    int count, i;
+
+    for(i = 0; i < NUM_INPUTS; ++i) {
+        lens[i] = (uint32_t)(i * 37) % 300;
+    }
+
+    for(count = 0; count <= 40; ++count) {
+        hash_scalar(count);
+        memset(out2, 0, sizeof(out2));
+        hash_batch(count);
+
+        if(memcmp(out1, out2, count * 16)) {
+            fprintf(stderr, "md5_batch mismatch with %d inputs\n", count);
+            return -1;
+        }
+    }
+
+    hash_scalar(NUM_INPUTS);
+    hash_batch(NUM_INPUTS);
+
+    if(memcmp(out1, out2, sizeof(out1))) {
+        fprintf(stderr, "md5_batch mismatch with %d inputs\n", NUM_INPUTS);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Feed md5_update pieces of odd sizes (including empty ones and ones that
+   straddle the 64 byte blocks) and check it against hashing it all at once. */
+static int check_stream(const uint8_t *buf, uint32_t size) {
+    static const uint32_t chunks[] = { 1, 0, 3, 63, 65, 7, 129, 0, 31, 1000 };
+    uint8_t want[16], got[16];
+    uint32_t off, len, total;
+    int i;
+    md5_ctx_t ctx;
+
+    for(total = 0; total <= size; total = total * 2 + 37) {
+        md5(buf, total, want);
+        md5_init(&ctx);
+
+        for(off = 0, i = 0; off < total; off += len, ++i) {
+            len = chunks[i % (sizeof(chunks) / sizeof(chunks[0]))];
+
+            if(len > total - off)
+                len = total - off;
+
+            md5_update(&ctx, buf + off, len);
+        }
+
+        md5_final(&ctx, got);
+
+        if(memcmp(want, got, 16)) {
+            fprintf(stderr, "md5_update mismatch at length %u\n", total);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Write out a file bigger than one md5_file window, then cut it down to sizes
+   on and around the window boundary, checking each against md5. */
+static int check_file(void) {
+    static const off_t fsizes[] = { FILE_SIZE, 1 << 26, (1 << 26) - 1, 4097,
+                                    0 };
+    char fn[] = "/tmp/md5_benchXXXXXX";
+    uint8_t *data, want[16], got[16];
+    uint32_t i, x = 1;
+    int fd, rv = -1;
+
+    if(!(data = (uint8_t *)malloc(FILE_SIZE))) {
+        perror("malloc");
+        return -1;
+    }
+
+    for(i = 0; i < FILE_SIZE; ++i) {
+        x = x * 1103515245 + 12345;
+        data[i] = (uint8_t)(x >> 16);
+    }
+
+    if((fd = mkstemp(fn)) < 0) {
+        perror("mkstemp");
+        free(data);
+        return -1;
+    }
+
+    if(write(fd, data, FILE_SIZE) != FILE_SIZE) {
+        perror("write");
+        goto out;
+    }
+
+    for(i = 0; i < sizeof(fsizes) / sizeof(fsizes[0]); ++i) {
+        if(ftruncate(fd, fsizes[i])) {
+            perror("ftruncate");
+            goto out;
+        }
+
+        md5(data, (uint32_t)fsizes[i], want);
+
+        if(md5_file(fn, got) || memcmp(want, got, 16)) {
+            fprintf(stderr, "md5_file mismatch at length %ld\n",
+                    (long)fsizes[i]);
+            goto out;
+        }
+    }
+
+    rv = 0;
+
+out:
+    close(fd);
+    unlink(fn);
+    free(data);
+    return rv;
+}
+
+static double run(void (*fn)(int), uint32_t size) {
+    double start, end;
+    unsigned long iters = 0;
+
+    start = now();
+
+    do {
+        fn(NUM_INPUTS);
+        ++iters;
+    } while((end = now()) - start < bench_time);
+
+    return (iters * (double)NUM_INPUTS * size) / (end - start) / 1048576.0;
+}
+
+int main(int argc, char *argv[]) {
+    uint8_t *buf;
+    unsigned long i, j;
+    double old, cur;
+    int opt;
+
+    while((opt = getopt(argc, argv, "ct:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds]\n", argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(!(buf = (uint8_t *)malloc(NUM_INPUTS * MAX_SIZE))) {
+        perror("malloc");
+        return 1;
+    }
+
+    srand(1);
+
+    for(i = 0; i < NUM_INPUTS * MAX_SIZE; ++i) {
+        buf[i] = (uint8_t)rand();
+    }
+
+    for(i = 0; i < NUM_INPUTS; ++i) {
+        inputs[i] = buf + i * MAX_SIZE;
+    }
+
+    if(check() || check_stream(buf, NUM_INPUTS * MAX_SIZE) || check_file())
+        return 1;
+
+    if(csv)
+        printf("test,size,scalar_mb_per_sec,mb_per_sec\n");
+    else
+        printf("%-8s %8s %13s %12s %8s\n", "test", "size", "scalar MB/s",
+               "batch MB/s", "speedup");
+
+    for(i = 0; i < NUM_SIZES; ++i) {
+        for(j = 0; j < NUM_INPUTS; ++j) {
+            lens[j] = sizes[i];
+        }
+
+        old = run(&hash_scalar, sizes[i]);
+        cur = run(&hash_batch, sizes[i]);
+
+        if(csv)
+            printf("md5,%u,%.2f,%.2f\n", sizes[i], old, cur);
+        else
+            printf("%-8s %8u %13.1f %12.1f %7.2fx\n", "md5", sizes[i], old,
+                   cur, cur / old);
+    }
+
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,408 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sylverant/memory.h"
+#include "sylverant/rcu.h"
+
+#define MAX_THREADS 64
+#define BATCH       256
+
+#define CHECK_THREADS   4
+#define CHECK_READS     4000
+
+#define OBJ_LIVE    0x0B1EC7ED
+#define OBJ_WORDS   16
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t gen;
+    uint64_t data[OBJ_WORDS];
+} obj_t;
+
+typedef struct {
+    pthread_t thread;
+    ref_rcu_t *r;
+    int get;
+    int err;
+    unsigned long reads;
+    double time;
+} reader_arg;
+
+static atomic_ulong objs_made, objs_freed;
+static atomic_int stop;
+static pthread_barrier_t start_barrier;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static uint64_t obj_word(uint32_t gen, int i) {
+    return ((uint64_t)gen << 32) ^ (uint64_t)(i * 0x9E3779B9U);
+}
+
+/* Poison the object on the way out, so that any reader that gets to it after
+   this can tell. */
+static void obj_dtor(void *o) {
+    obj_t *obj = (obj_t *)o;
+
+    obj->magic = 0;
+    memset(obj->data, 0xDD, sizeof(obj->data));
+    atomic_fetch_add(&objs_freed, 1);
+}
+
+static obj_t *obj_new(uint32_t gen) {
+    obj_t *obj;
+    int i;
+
+    if(!(obj = (obj_t *)ref_alloc(sizeof(obj_t), &obj_dtor)))
+        return NULL;
+
+    obj->magic = OBJ_LIVE;
+    obj->gen = gen;
+
+    for(i = 0; i < OBJ_WORDS; ++i) {
+        obj->data[i] = obj_word(gen, i);
+    }
+
+    atomic_fetch_add(&objs_made, 1);
+    return obj;
+}
+
+/* Read through the whole object, making sure it's still alive, is no older
+   than the last one this reader saw, and hasn't been changed. */
+static int obj_check(const obj_t *obj, uint32_t *last) {
+    int i;
+
+    if(!obj || obj->magic != OBJ_LIVE || obj->gen < *last)
+        return -1;
+
+    for(i = 0; i < OBJ_WORDS; ++i) {
+        if(obj->data[i] != obj_word(obj->gen, i))
+            return -1;
+    }
+
+    if(obj->magic != OBJ_LIVE)
+        return -1;
+
+    *last = obj->gen;
+    return 0;
+}
+
+/* Keep replacing the object until told to stop. */
+static void *writer_run(void *d) {
+    ref_rcu_t *r = (ref_rcu_t *)d;
+    uint32_t gen = 1;
+    obj_t *obj;
+
+    while(!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        if((obj = obj_new(gen)))
+            ref_rcu_publish(r, obj);
+
+        ++gen;
+    }
+
+    return NULL;
+}
+
+/* Read the object twice over, giving up the CPU in between every so often so
+   that the writer gets to run (and try to free it) while it's still being
+   looked at, even with only one CPU to go around. It has to be the very same
+   object both times, since a freed block could well have been reused for a
+   newer one in between. */
+static int obj_read(const obj_t *obj, uint32_t *last, int i) {
+    uint32_t first;
+
+    if(obj_check(obj, last))
+        return -1;
+
+    first = *last;
+
+    if(i % 8 < 2)
+        sched_yield();
+
+    if(obj_check(obj, last) || *last != first)
+        return -1;
+
+    return 0;
+}
+
+/* Alternate between holding a reference from ref_rcu_get and reading in a
+   read section. */
+static void *check_run(void *d) {
+    reader_arg *a = (reader_arg *)d;
+    uint32_t last = 0;
+    obj_t *obj;
+    int i;
+
+    for(i = 0; i < CHECK_READS && !a->err; ++i) {
+        if(i & 1) {
+            obj = (obj_t *)ref_rcu_get(a->r);
+
+            if(obj_read(obj, &last, i))
+                a->err = 1;
+
+            ref_release(obj);
+        }
+        else {
+            ref_rcu_read_lock();
+            obj = (obj_t *)ref_rcu_deref(a->r);
+
+            if(obj_read(obj, &last, i))
+                a->err = 1;
+
+            ref_rcu_read_unlock();
+        }
+    }
+
+    return NULL;
+}
+
+static int start_writer(ref_rcu_t **r, pthread_t *w) {
+    obj_t *obj;
+
+    atomic_store(&stop, 0);
+
+    if(!(obj = obj_new(0)) || !(*r = ref_rcu_create(obj))) {
+        fprintf(stderr, "Couldn't create published object\n");
+        return -1;
+    }
+
+    if(pthread_create(w, NULL, &writer_run, *r)) {
+        perror("pthread_create");
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Stop the writer, retire the last object, and make sure that everything that
+   was ever published gets freed, without having to wait on anything. */
+static int stop_writer(ref_rcu_t *r, pthread_t w) {
+    struct timespec ts = { 0, 1000000 };
+    int i, left;
+
+    atomic_store(&stop, 1);
+    pthread_join(w, NULL);
+    ref_rcu_destroy(r);
+
+    for(i = 0; i < 1000 && (left = ref_rcu_reclaim()); ++i) {
+        nanosleep(&ts, NULL);
+    }
+
+    if(left || atomic_load(&objs_freed) != atomic_load(&objs_made)) {
+        fprintf(stderr, "Retired objects not freed (%d left, %lu of %lu)\n",
+                left, atomic_load(&objs_freed), atomic_load(&objs_made));
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Several readers on one object, while a writer keeps replacing it. */
+static int check(void) {
+    reader_arg args[CHECK_THREADS];
+    ref_rcu_t *r;
+    pthread_t w;
+    int i, err = 0;
+
+    if(start_writer(&r, &w))
+        return -1;
+
+    for(i = 0; i < CHECK_THREADS; ++i) {
+        args[i].r = r;
+        args[i].err = 0;
+
+        if(pthread_create(&args[i].thread, NULL, &check_run, &args[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < CHECK_THREADS; ++i) {
+        pthread_join(args[i].thread, NULL);
+        err |= args[i].err;
+    }
+
+    if(err) {
+        fprintf(stderr, "Reader saw a retired or changed object!\n");
+        return -1;
+    }
+
+    return stop_writer(r, w);
+}
+
+static void *thread_run(void *d) {
+    reader_arg *a = (reader_arg *)d;
+    double start, end;
+    unsigned long n = 0;
+    volatile uint32_t sink;
+    obj_t *obj;
+    int i;
+
+    pthread_barrier_wait(&start_barrier);
+    start = now();
+
+    do {
+        for(i = 0; i < BATCH; ++i) {
+            if(a->get) {
+                obj = (obj_t *)ref_rcu_get(a->r);
+                sink = obj->gen;
+                ref_release(obj);
+            }
+            else {
+                ref_rcu_read_lock();
+                obj = (obj_t *)ref_rcu_deref(a->r);
+                sink = obj->gen;
+                ref_rcu_read_unlock();
+            }
+        }
+
+        n += BATCH;
+    } while((end = now()) - start < bench_time);
+
+    a->reads = n;
+    a->time = end - start;
+    (void)sink;
+    return NULL;
+}
+
+/* Reads per second with the given number of readers, while the writer keeps
+   publishing new objects. */
+static int run(int nthreads, int get) {
+    reader_arg args[MAX_THREADS];
+    unsigned long reads = 0;
+    double t = 0.0;
+    ref_rcu_t *r;
+    pthread_t w;
+    int i;
+
+    if(start_writer(&r, &w))
+        return -1;
+
+    pthread_barrier_init(&start_barrier, NULL, nthreads);
+
+    for(i = 0; i < nthreads; ++i) {
+        args[i].r = r;
+        args[i].get = get;
+
+        if(pthread_create(&args[i].thread, NULL, &thread_run, &args[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < nthreads; ++i) {
+        pthread_join(args[i].thread, NULL);
+        reads += args[i].reads;
+
+        if(args[i].time > t)
+            t = args[i].time;
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+
+    if(stop_writer(r, w))
+        return -1;
+
+    if(csv)
+        printf("%s,%d,%.2f,%.2f\n", get ? "get" : "deref", nthreads,
+               reads / t / 1000000.0, t * nthreads * 1000000000.0 / reads);
+    else
+        printf("%-8s %4d %14.2f %12.2f\n", get ? "get" : "deref", nthreads,
+               reads / t / 1000000.0, t * nthreads * 1000000000.0 / reads);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt, n, max_threads = 0;
+
+    while((opt = getopt(argc, argv, "ct:j:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            case 'j':
+                max_threads = atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds] [-j threads]\n",
+                        argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(max_threads <= 0) {
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if(max_threads < 2)
+            max_threads = 2;
+    }
+
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    /* Freed blocks get poisoned too, so a reader looking at one that was freed
+       and not yet reused still sees garbage. */
+    ref_pool_poison(1);
+
+    if(check())
+        return 1;
+
+    ref_pool_poison(0);
+
+    if(csv)
+        printf("test,threads,mreads_per_sec,ns_per_read\n");
+    else
+        printf("%-8s %4s %14s %12s\n", "test", "thr", "Mreads/s",
+               "ns/read");
+
+    /* Thread counts go up in powers of two, and the last step is always max. */
+    for(n = 1; ; n = (n << 1) > max_threads ? max_threads : n << 1) {
+        if(run(n, 0) || run(n, 1))
+            return 1;
+
+        if(n == max_threads)
+            break;
+    }
+
+    return 0;
+}
@@ -0,0 +1,386 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sylverant/memory.h"
+
+#define MAX_THREADS 64
+#define BATCH       1024
+
+/* Big enough to go past the largest size class. */
+#define SWEEP_SIZE  4200
+#define MAX_POOLS   32
+
+#define STORM_THREADS   4
+#define STORM_OBJS      256
+#define STORM_ROUNDS    50
+
+/* Time to spend on each measurement, in seconds. */
+static double bench_time = 0.5;
+static int csv = 0;
+
+static atomic_int dtor_calls;
+
+typedef struct {
+    pthread_t thread;
+    void *obj;
+    unsigned long iters;
+    double time;
+} thread_arg;
+
+static pthread_barrier_t start_barrier;
+
+typedef struct {
+    pthread_t thread;
+    int id;
+    int err;
+    void *objs[STORM_OBJS];
+} storm_arg;
+
+static storm_arg storm[STORM_THREADS];
+static pthread_barrier_t storm_barrier;
+
+static double now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+}
+
+static void obj_dtor(void *o) {
+    (void)o;
+    atomic_fetch_add(&dtor_calls, 1);
+}
+
+/* What a block thread does with a shared object: take a reference, look at
+   it, and let it go again. */
+static void *thread_run(void *d) {
+    thread_arg *a = (thread_arg *)d;
+    double start, end;
+    unsigned long n = 0;
+    int i;
+
+    pthread_barrier_wait(&start_barrier);
+    start = now();
+
+    do {
+        for(i = 0; i < BATCH; ++i) {
+            ref_retain(a->obj);
+            ref_release(a->obj);
+        }
+
+        n += BATCH;
+    } while((end = now()) - start < bench_time);
+
+    a->iters = n;
+    a->time = end - start;
+    return NULL;
+}
+
+/* Allocate one object of every size up to a bit past the largest size class,
+   all live at once, and make sure each lands in exactly one pool, that the
+   pools go up in size with the objects, that every pool (and the one for big
+   objects) gets used, and that the overhead is the same at every boundary.
+   Each object is filled in and checked afterwards to catch any overlap. */
+static int check_classes(void) {
+    static void *objs[SWEEP_SIZE + 1];
+    ref_pool_stats_t prev[MAX_POOLS], cur[MAX_POOLS];
+    size_t sz, i, j, hit, last = 0, overhead = 0;
+    int n, used[MAX_POOLS] = { 0 };
+    uint8_t *p;
+
+    n = ref_pool_stats(prev, MAX_POOLS);
+
+    for(sz = 0; sz <= SWEEP_SIZE; ++sz) {
+        if(!(objs[sz] = ref_alloc(sz, NULL))) {
+            fprintf(stderr, "ref_alloc failed at size %zu\n", sz);
+            return -1;
+        }
+
+        memset(objs[sz], (int)(sz & 0xFF), sz);
+        ref_pool_stats(cur, MAX_POOLS);
+
+        for(i = 0, j = 0, hit = 0; i < (size_t)n; ++i) {
+            if(cur[i].in_use != prev[i].in_use) {
+                hit = i;
+                ++j;
+            }
+        }
+
+        if(j != 1 || cur[hit].in_use != prev[hit].in_use + 1) {
+            fprintf(stderr, "Pool stats mismatch at size %zu\n", sz);
+            return -1;
+        }
+
+        if(hit < last || (cur[hit].size && cur[hit].size <= sz)) {
+            fprintf(stderr, "Size %zu went to the wrong pool\n", sz);
+            return -1;
+        }
+
+        /* Crossing into the next pool: the last size that fit in the one
+           before should have been its block size less the same overhead as
+           every other pool. */
+        if(hit != last) {
+            if(overhead && cur[last].size - (sz - 1) != overhead) {
+                fprintf(stderr, "Pool boundary mismatch at size %zu\n", sz);
+                return -1;
+            }
+
+            overhead = cur[last].size - (sz - 1);
+            last = hit;
+        }
+
+        used[hit] = 1;
+        memcpy(prev, cur, sizeof(prev));
+    }
+
+    for(i = 0; i < (size_t)n; ++i) {
+        if(!used[i]) {
+            fprintf(stderr, "Pool %zu never used\n", i);
+            return -1;
+        }
+    }
+
+    for(sz = 0; sz <= SWEEP_SIZE; ++sz) {
+        for(i = 0, p = (uint8_t *)objs[sz]; i < sz; ++i) {
+            if(p[i] != (uint8_t)sz) {
+                fprintf(stderr, "Object of size %zu overwritten\n", sz);
+                return -1;
+            }
+        }
+
+        ref_release(objs[sz]);
+    }
+
+    return 0;
+}
+
+static uint8_t storm_byte(int id, int i, int round) {
+    return (uint8_t)(id * 31 + i + round * 7);
+}
+
+/* Allocate a batch of objects, then free the batch the next thread over
+   allocated, so that blocks keep moving from one thread's cache to another's
+   through the shared pools. */
+static void *storm_run(void *d) {
+    storm_arg *a = (storm_arg *)d, *o = &storm[(a->id + 1) % STORM_THREADS];
+    size_t sz, j;
+    int i, round;
+    uint8_t *p;
+
+    for(round = 0; round < STORM_ROUNDS; ++round) {
+        for(i = 0; i < STORM_OBJS; ++i) {
+            sz = (size_t)(a->id * 7 + i * 37 + round * 13) % SWEEP_SIZE;
+
+            if(!(a->objs[i] = ref_alloc(sz, NULL)))
+                a->err = 1;
+            else
+                memset(a->objs[i], storm_byte(a->id, i, round), sz);
+        }
+
+        pthread_barrier_wait(&storm_barrier);
+
+        for(i = 0; i < STORM_OBJS; ++i) {
+            sz = (size_t)(o->id * 7 + i * 37 + round * 13) % SWEEP_SIZE;
+
+            for(j = 0, p = (uint8_t *)o->objs[i]; p && j < sz; ++j) {
+                if(p[j] != storm_byte(o->id, i, round)) {
+                    a->err = 1;
+                    break;
+                }
+            }
+
+            ref_release(o->objs[i]);
+        }
+
+        pthread_barrier_wait(&storm_barrier);
+    }
+
+    return NULL;
+}
+
+/* After the threads are gone, everything they had cached should be back in
+   the shared pools, and nothing should be left in use. */
+static int check_storm(void) {
+    ref_pool_stats_t before[MAX_POOLS], after[MAX_POOLS];
+    int i, n;
+
+    n = ref_pool_stats(before, MAX_POOLS);
+    pthread_barrier_init(&storm_barrier, NULL, STORM_THREADS);
+
+    for(i = 0; i < STORM_THREADS; ++i) {
+        storm[i].id = i;
+        storm[i].err = 0;
+
+        if(pthread_create(&storm[i].thread, NULL, &storm_run, &storm[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < STORM_THREADS; ++i) {
+        pthread_join(storm[i].thread, NULL);
+
+        if(storm[i].err) {
+            fprintf(stderr, "Object lost or overwritten between threads\n");
+            return -1;
+        }
+    }
+
+    pthread_barrier_destroy(&storm_barrier);
+    ref_pool_stats(after, MAX_POOLS);
+
+    for(i = 0; i < n; ++i) {
+        if(after[i].in_use || after[i].cached != before[i].cached ||
+           after[i].free + after[i].cached != after[i].blocks) {
+            fprintf(stderr, "Pool stats mismatch after threads (pool %d)\n",
+                    i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* With shared set, every thread hammers on the same object (and so the same
+   cache line). Otherwise each has its own, which shows the cost of the atomic
+   operations without any contention. */
+static int run(int nthreads, int shared) {
+    thread_arg args[MAX_THREADS];
+    void *obj = NULL;
+    unsigned long iters = 0;
+    double t = 0.0;
+    int i;
+
+    atomic_store(&dtor_calls, 0);
+    pthread_barrier_init(&start_barrier, NULL, nthreads);
+
+    if(shared && !(obj = ref_alloc(64, &obj_dtor)))
+        return -1;
+
+    for(i = 0; i < nthreads; ++i) {
+        if(!(args[i].obj = shared ? ref_retain(obj) : ref_alloc(64, &obj_dtor)))
+            return -1;
+
+        if(pthread_create(&args[i].thread, NULL, &thread_run, &args[i])) {
+            perror("pthread_create");
+            return -1;
+        }
+    }
+
+    for(i = 0; i < nthreads; ++i) {
+        pthread_join(args[i].thread, NULL);
+        iters += args[i].iters;
+
+        if(args[i].time > t)
+            t = args[i].time;
+
+        ref_release(args[i].obj);
+    }
+
+    pthread_barrier_destroy(&start_barrier);
+
+    if(shared) {
+        /* Nothing should have been freed until now. */
+        if(atomic_load(&dtor_calls) != 0) {
+            fprintf(stderr, "Shared object freed while still referenced!\n");
+            return -1;
+        }
+
+        ref_release(obj);
+    }
+
+    if(atomic_load(&dtor_calls) != (shared ? 1 : nthreads)) {
+        fprintf(stderr, "Wrong number of destructor calls!\n");
+        return -1;
+    }
+
+    /* Each iteration is a retain and a release. */
+    if(csv)
+        printf("%s,%d,%.2f,%.2f\n", shared ? "shared" : "private", nthreads,
+               iters / t / 1000000.0, t * nthreads * 1000000000.0 / iters);
+    else
+        printf("%-8s %4d %14.2f %12.2f\n", shared ? "shared" : "private",
+               nthreads, iters / t / 1000000.0,
+               t * nthreads * 1000000000.0 / iters);
+
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt, n, max_threads = 0;
+
+    while((opt = getopt(argc, argv, "ct:j:h")) != -1) {
+        switch(opt) {
+            case 'c':
+                csv = 1;
+                break;
+
+            case 't':
+                bench_time = atof(optarg);
+                break;
+
+            case 'j':
+                max_threads = atoi(optarg);
+                break;
+
+            default:
+                fprintf(stderr, "Usage: %s [-c] [-t seconds] [-j threads]\n",
+                        argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if(max_threads <= 0) {
+        max_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+        if(max_threads < 2)
+            max_threads = 2;
+    }
+
+    if(max_threads > MAX_THREADS)
+        max_threads = MAX_THREADS;
+
+    if(check_classes() || check_storm())
+        return 1;
+
+    if(csv)
+        printf("test,threads,mpairs_per_sec,ns_per_pair\n");
+    else
+        printf("%-8s %4s %14s %12s\n", "test", "thr", "Mpairs/s",
+               "ns/pair");
+
+    /* Thread counts go up in powers of two, and the last step is always max. */
+    for(n = 1; ; n = (n << 1) > max_threads ? max_threads : n << 1) {
+        if(run(n, 0) || run(n, 1))
+            return 1;
+
+        if(n == max_threads)
+            break;
+    }
+
+    return 0;
+}
@@ -19,9 +19,31 @@
 #ifndef CHECKSUM_H
 #define CHECKSUM_H
 
+#include <stddef.h>
 #include <inttypes.h>
 
-/* Calculate a CRC32 checksum over a given block of data. */
+/* Running state of a CRC32 computed a piece at a time. */
+typedef struct sylverant_crc32 {
+    uint32_t crc;
+} sylverant_crc32_t;
+
+/* Calculate a CRC32 checksum over a given block of data. This is the usual
+   (zlib/PNG) CRC32, done with PCLMULQDQ where the CPU supports it. */
 uint32_t sylverant_crc32(const uint8_t *data, int size);
 
+/* Calculate a CRC32 checksum over data that comes in pieces (for instance, a
+   file too big to read in all at once). Call init once, then update with each
+   piece in order, then final to get the same result sylverant_crc32 would have
+   given on all of the data together. */
+void sylverant_crc32_init(sylverant_crc32_t *ctx);
+void sylverant_crc32_update(sylverant_crc32_t *ctx, const void *data,
+                            size_t size);
+uint32_t sylverant_crc32_final(sylverant_crc32_t *ctx);
+
+/* Given the CRC32 of two blocks of data, and the length of the second one,
+   return the CRC32 of the two blocks one after the other. This lets the pieces
+   of a big file be checksummed separately (say, on different threads) and the
+   results put together afterwards. */
+uint32_t sylverant_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
 #endif /* !CHECKSUM_H */
@@ -176,6 +176,8 @@ typedef struct sylverant_shipcfg {
     int limits_count;
     int limits_default;
     uint32_t privileges;
+
+    void *arena;                        /* Set if built in an arena */
 } sylverant_ship_t;
 
 /* Read the configuration for the login server, shipgate, and patch server. */
@@ -191,4 +193,14 @@ extern int sylverant_read_ship_config(const char *f, sylverant_ship_t **cfg);
 /* Clean up a ship configuration structure. */
 extern void sylverant_free_ship_config(sylverant_ship_t *cfg);
 
+/* Turn arena mode on or off for the ship config, limits and quest list
+   readers. In arena mode, each of those results is kept in an arena (see
+   memory.h), so it sits together in memory and is freed all at once, rather
+   than a piece at a time. The results look exactly the
+   same either way, but in arena mode nothing in them may be freed or
+   reallocated on its own. This should only be changed before anything is
+   read. Off by default. */
+extern void sylverant_config_arenas(int enable);
+extern int sylverant_config_arenas_enabled(void);
+
 #endif /* !SYLVERANT__CONFIG_H */
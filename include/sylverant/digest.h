@@ -0,0 +1,65 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__DIGEST_H
+#define SYLVERANT__DIGEST_H
+
+#include <stdint.h>
+
+/* Checksums of one file, along with what was used to tell if it has changed
+   since they were computed. */
+typedef struct sylverant_digest {
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t crc32;
+    uint64_t inode;
+    uint8_t md5[16];
+} sylverant_digest_t;
+
+/* A cache of file digests, kept in an index file on disk between runs so that
+   only files that have changed since the last run have to be hashed again.
+   The index is memory-mapped and searched in place, so opening it costs next
+   to nothing no matter how many files it holds. A cache must not be used from
+   more than one thread at a time. */
+typedef struct sylverant_digest_cache sylverant_digest_cache_t;
+
+/* Open the cache stored in the given index file. If the file doesn't exist or
+   isn't a valid index, this gives an empty cache (which will be written to
+   the file by sylverant_digest_save). Returns NULL on memory allocation
+   failure. */
+sylverant_digest_cache_t *sylverant_digest_open(const char *fn);
+
+/* Get the digest of a file. If the cache holds one for the path, and the size,
+   modification time and inode number of the file still match, that is used.
+   Otherwise the file is hashed and the cache updated. Returns 0 on success, 1
+   if the digest was taken from the cache, or -1 on error (with errno set). */
+int sylverant_digest_get(sylverant_digest_cache_t *c, const char *path,
+                         sylverant_digest_t *rv);
+
+/* Write the cache back out to its index file, if it has changed. The file is
+   replaced atomically. If prune is non-zero, entries for paths that weren't
+   asked for with sylverant_digest_get since the cache was opened are left out
+   (so files that have been deleted don't hang around forever). Returns 0 on
+   success or -1 on error. */
+int sylverant_digest_save(sylverant_digest_cache_t *c, int prune);
+
+/* Close the cache, without saving it. */
+void sylverant_digest_close(sylverant_digest_cache_t *c);
+
+#endif /* !SYLVERANT__DIGEST_H */
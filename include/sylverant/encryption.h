@@ -9,14 +9,25 @@
 #define SYLVERANT__ENCRYPTION_H
 
 #include <inttypes.h>
+#include <sys/uio.h>
 
 // Supported encryption types 
 #define CRYPT_GAMECUBE   0 // 521-key encryption used in PSOGC and PSOX 
 #define CRYPT_BLUEBURST  1 // 1042-key encryption used in PSOBB 
 #define CRYPT_PC         2 // 56-key encryption used in PSODC and PSOPC 
 
+struct CRYPT_SETUP;
+
+// Routines for one encryption type, bound to a CRYPT_SETUP by CRYPT_CreateKeys
+typedef struct CRYPT_OPS {
+    // [0] decrypts, [1] encrypts (the same routine for PSOPC/PSOGC)
+    void (*crypt[2])(struct CRYPT_SETUP* cs, void* data, unsigned long size);
+    void (*crypt_to[2])(struct CRYPT_SETUP* cs, void* dst, const void* src,
+                        unsigned long size);
+} CRYPT_OPS;
+
 // Encryption data struct 
-typedef struct {
+typedef struct CRYPT_SETUP {
     uint32_t type; // what kind of encryption is this? 
     uint32_t keys[1042]; // encryption stream 
     uint32_t pc_posn; // PSOPC crypt position 
@@ -25,7 +36,84 @@ typedef struct {
     uint32_t gc_seed; // PSOGC seed used 
     uint32_t bb_posn; // BB position (not used) 
     uint32_t bb_seed[12]; // BB seed used 
+    // Fields added since go at the end, so the ones above keep their offsets.
+    // The struct is larger than it used to be, though, so anything that
+    // allocates or embeds one has to be rebuilt against this header.
+    uint32_t mix_count; // PSOPC/PSOGC times the keys have been mixed 
+    const CRYPT_OPS* ops; // routines for this type (NULL = look up by type) 
 } CRYPT_SETUP;
+
+// Saved stream position of a CRYPT_SETUP (see CRYPT_SaveState)
+typedef struct {
+    uint32_t type; // type of the CRYPT_SETUP this was taken from
+    uint32_t posn; // position in the key stream
+    uint32_t mix_count; // times the keys had been mixed
+} CRYPT_SNAPSHOT;
+
+// The per-type states below are aligned to the size of a cache line
+#if defined(__GNUC__)
+#define CRYPT_ALIGNED __attribute__((aligned(64)))
+#else
+#define CRYPT_ALIGNED
+#endif
+
+// Compact state for CRYPT_PC only (see CRYPT_PC_CreateState)
+typedef struct CRYPT_ALIGNED {
+    uint32_t keys[57]; // encryption stream
+    uint32_t posn; // crypt position
+} CRYPT_PC_STATE;
+
+// Compact state for CRYPT_GAMECUBE only (see CRYPT_GC_CreateState)
+typedef struct CRYPT_ALIGNED {
+    uint32_t keys[521]; // encryption stream
+    uint32_t posn; // index of the last key used
+    uint32_t seed; // seed used
+} CRYPT_GC_STATE;
+
+// Compact state for CRYPT_BLUEBURST only (see CRYPT_BB_CreateState)
+typedef struct CRYPT_ALIGNED {
+    uint32_t keys[1042]; // encryption stream
+    uint32_t seed[12]; // seed used
+} CRYPT_BB_STATE;
+
+// One buffer of a batch passed to CRYPT_CryptBatch
+typedef struct {
+    CRYPT_SETUP* cs; // encryption data to use for this buffer
+    void* data; // data to be processed (in place)
+    unsigned long size; // size of the data
+} CRYPT_BATCH;
+
+// Blue Burst key schedule cache statistics, filled in by CRYPT_GetKeyCacheStats
+typedef struct {
+    unsigned long hits; // CRYPT_CreateKeys calls answered from the cache
+    unsigned long misses; // CRYPT_CreateKeys calls that built the schedule
+    unsigned long entries; // schedules currently held
+    unsigned long capacity; // maximum schedules held (0 = cache disabled)
+} CRYPT_CACHE_STATS;
+
+// Server/client cipher pair for one connection, handed out by CRYPT_KeyPoolGet.
+// Like any CRYPT_SETUP, the ciphers must be copied with CRYPT_CopySetup rather
+// than memcpy or assignment (see there).
+typedef struct {
+    CRYPT_SETUP server; // created from server_key
+    CRYPT_SETUP client; // created from client_key
+    uint32_t server_key[12]; // seed; only [0] is used for CRYPT_PC/GAMECUBE
+    uint32_t client_key[12]; // seed; only [0] is used for CRYPT_PC/GAMECUBE
+} CRYPT_KEYPAIR;
+
+// Packet header layouts understood by CRYPT_ReceivePackets 
+#define CRYPT_HDR_DC     0 // type, flags, 16-bit length (PSODC, PSOGC, PSOX) 
+#define CRYPT_HDR_PC     1 // 16-bit length, type, flags (PSOPC) 
+#define CRYPT_HDR_BB     2 // 16-bit length, 16-bit type, 32-bit flags (PSOBB) 
+
+// One complete packet found by CRYPT_ReceivePackets
+typedef struct {
+    void* data; // decrypted packet, header included (points into the buffer)
+    unsigned long size; // size given in the packet header
+} CRYPT_PACKET;
+
+// Pool of pre-generated CRYPT_KEYPAIRs (see CRYPT_KeyPoolCreate)
+typedef struct CRYPT_KEYPOOL CRYPT_KEYPOOL;
  
 /* int CRYPT_CreateKeys(CRYPT_SETUP* cs,void* key,unsigned char type)
  * 
@@ -79,6 +167,418 @@ int CRYPT_CreateKeys(CRYPT_SETUP* cs, void* key, unsigned char type);
 int CRYPT_CryptData(CRYPT_SETUP* cs, void* data, unsigned long size,
                     int encrypting);
 
+/* void CRYPT_CryptFast(CRYPT_SETUP* cs,void* data,unsigned long size,
+ *                      int encrypting)
+ * 
+ *   Encrypts or decrypts data, calling straight into the routine that was
+ *   bound to the CRYPT_SETUP when its keys were created. This skips checking
+ *   the type of encryption on every call, which adds up when there are lots
+ *   of small packets to process. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to use. CRYPT_CreateKeys must
+ *         have been called on it successfully. 
+ * 
+ *     void* data 
+ *         Pointer to the data to be processed. 
+ * 
+ *     unsigned long size 
+ *         Size of the data to be processed. 
+ * 
+ *     int encrypting 
+ *         1 if the data is to be encrypted, 0 if it is to be decrypted. 
+ *         Ignored unless the type of the given CRYPT_SETUP is CRYPT_BLUEBURST. 
+ */
+static inline void CRYPT_CryptFast(CRYPT_SETUP* cs, void* data,
+                                   unsigned long size, int encrypting)
+{
+    cs->ops->crypt[encrypting != 0](cs, data, size);
+}
+
+/* int CRYPT_CryptDataTo(CRYPT_SETUP* cs,void* dst,const void* src,
+ *                       unsigned long size,int encrypting)
+ * 
+ *   Encrypts or decrypts data from one buffer into another, for instance
+ *   straight from a packet into an outgoing send buffer, rather than copying
+ *   it there first and working in place. The result is the same as copying
+ *   the data to dst and calling CRYPT_CryptData on it. Nothing past size
+ *   bytes is read from src or written to dst. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to use. 
+ * 
+ *     void* dst 
+ *         Where to store the processed data. May be the same as src, but the
+ *         two must not otherwise overlap. 
+ * 
+ *     const void* src 
+ *         Pointer to the data to be processed. 
+ * 
+ *     unsigned long size 
+ *         Size of the data to be processed. 
+ * 
+ *     int encrypting 
+ *         1 if the data is to be encrypted, 0 if it is to be decrypted. 
+ *         Ignored unless the type of the given CRYPT_SETUP is CRYPT_BLUEBURST. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the operation succeeded, or 0 if an
+ *     invalid encryption type was given. 
+ */
+int CRYPT_CryptDataTo(CRYPT_SETUP* cs, void* dst, const void* src,
+                      unsigned long size, int encrypting);
+
+/* Type-specific states
+ * 
+ *   A CRYPT_SETUP has room for the largest (Blue Burst) key table and the
+ *   fields of every type, no matter which one it is used for. Servers that
+ *   keep two ciphers for each of a large number of clients can use these
+ *   instead, which only hold what their own type needs. They produce exactly
+ *   the same output as a CRYPT_SETUP created with the same key. Unlike a
+ *   CRYPT_SETUP of type CRYPT_GAMECUBE, they hold no pointers into
+ *   themselves, so they may be copied freely. When allocating them with
+ *   malloc, use aligned_alloc or posix_memalign to keep the alignment. See
+ *   CRYPT_PrintFootprint for how much each one takes. 
+ * 
+ *   void CRYPT_PC_CreateState(CRYPT_PC_STATE* st,uint32_t seed)
+ *   void CRYPT_GC_CreateState(CRYPT_GC_STATE* st,uint32_t seed)
+ *   void CRYPT_BB_CreateState(CRYPT_BB_STATE* st,const void* seed)
+ *         Initialize a state from a 32-bit key (PC/GameCube) or a 48-byte key
+ *         (Blue Burst), as CRYPT_CreateKeys does. 
+ * 
+ *   void CRYPT_PC_CryptState(CRYPT_PC_STATE* st,void* data,unsigned long size)
+ *   void CRYPT_GC_CryptState(CRYPT_GC_STATE* st,void* data,unsigned long size)
+ *   void CRYPT_BB_CryptState(CRYPT_BB_STATE* st,void* data,unsigned long size,
+ *                            int encrypting)
+ *         Encrypt or decrypt data in place, as CRYPT_CryptData does. 
+ */
+void CRYPT_PC_CreateState(CRYPT_PC_STATE* st, uint32_t seed);
+void CRYPT_PC_CryptState(CRYPT_PC_STATE* st, void* data, unsigned long size);
+void CRYPT_GC_CreateState(CRYPT_GC_STATE* st, uint32_t seed);
+void CRYPT_GC_CryptState(CRYPT_GC_STATE* st, void* data, unsigned long size);
+void CRYPT_BB_CreateState(CRYPT_BB_STATE* st, const void* seed);
+void CRYPT_BB_CryptState(CRYPT_BB_STATE* st, void* data, unsigned long size,
+                         int encrypting);
+
+/* unsigned long CRYPT_StateSize(unsigned char type)
+ * 
+ *   Returns the size in bytes of the type-specific state for the given type
+ *   of encryption (CRYPT_PC_STATE, CRYPT_GC_STATE or CRYPT_BB_STATE), or 0 if
+ *   the type is invalid. 
+ */
+unsigned long CRYPT_StateSize(unsigned char type);
+
+/* void CRYPT_PrintFootprint(void)
+ * 
+ *   Prints the memory taken by a CRYPT_SETUP and by each type-specific
+ *   state to the console using printf, per cipher and per client (which
+ *   needs two of them). 
+ * 
+ *   Arguments: none 
+ * 
+ *   Return value: none 
+ */
+void CRYPT_PrintFootprint(void);
+
+/* void CRYPT_CopySetup(CRYPT_SETUP* dst,const CRYPT_SETUP* src)
+ * 
+ *   Copies a CRYPT_SETUP, so that the copy carries on from the same point in
+ *   the key stream. A CRYPT_SETUP of type CRYPT_GAMECUBE holds pointers into
+ *   its own key table, so one that was copied with memcpy (or by assigning
+ *   the struct) would go on using the original's table. Use this instead for
+ *   any CRYPT_SETUP, including the ones in a CRYPT_KEYPAIR. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* dst 
+ *         Where to put the copy. Must not be the same as src. 
+ * 
+ *     const CRYPT_SETUP* src 
+ *         The CRYPT_SETUP to copy. 
+ * 
+ *   Return value: none 
+ */
+void CRYPT_CopySetup(CRYPT_SETUP* dst, const CRYPT_SETUP* src);
+
+/* void CRYPT_SaveState(CRYPT_SETUP* cs,CRYPT_SNAPSHOT* snap)
+ * int CRYPT_RestoreState(CRYPT_SETUP* cs,const CRYPT_SNAPSHOT* snap)
+ * 
+ *   Saves and restores the position of the key stream, so that data can be
+ *   processed and then the cipher rolled back as if it never had been. This
+ *   is cheap: saving copies a few words, and restoring only has to undo the
+ *   key mixing (if any) done in between, rather than keeping a copy of the
+ *   key table. CRYPT_BLUEBURST has no stream position, so there is nothing
+ *   to save or restore for it. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to save or restore. 
+ * 
+ *     CRYPT_SNAPSHOT* snap 
+ *         Where to save the position, or the position to restore. It must
+ *         have been saved from the same CRYPT_SETUP, and the cipher must not
+ *         have been rolled back past it since. 
+ * 
+ *   Return value:
+ *     CRYPT_RestoreState returns 1 if the operation succeeded, or 0 if the
+ *     snapshot does not belong to the CRYPT_SETUP. 
+ */
+void CRYPT_SaveState(CRYPT_SETUP* cs, CRYPT_SNAPSHOT* snap);
+int CRYPT_RestoreState(CRYPT_SETUP* cs, const CRYPT_SNAPSHOT* snap);
+
+/* int CRYPT_PeekData(CRYPT_SETUP* cs,void* dst,const void* src,
+ *                    unsigned long size,int encrypting)
+ * 
+ *   Works like CRYPT_CryptDataTo, except that the cipher is left where it
+ *   was afterwards. This is meant for decrypting a packet header to find the
+ *   length of the packet, straight out of the receive buffer, without having
+ *   to copy the header aside or decrypt it twice when the rest of the packet
+ *   hasn't arrived yet. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to use. 
+ * 
+ *     void* dst 
+ *         Where to store the processed data. 
+ * 
+ *     const void* src 
+ *         Pointer to the data to be processed. It is not modified (unless it
+ *         is the same as dst). 
+ * 
+ *     unsigned long size 
+ *         Size of the data to be processed. 
+ * 
+ *     int encrypting 
+ *         1 if the data is to be encrypted, 0 if it is to be decrypted. 
+ *         Ignored unless the type of the given CRYPT_SETUP is CRYPT_BLUEBURST. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the operation succeeded, or 0 if an
+ *     invalid encryption type was given. 
+ */
+int CRYPT_PeekData(CRYPT_SETUP* cs, void* dst, const void* src,
+                   unsigned long size, int encrypting);
+
+/* long CRYPT_ReceivePackets(CRYPT_SETUP* cs,void* buf,unsigned long size,
+ *                           int hdr,CRYPT_PACKET* pkts,unsigned long max,
+ *                           unsigned long* used)
+ * 
+ *   Decrypts as many complete packets as there are at the start of a buffer
+ *   of received data, in place, and hands back where each one is. Only the
+ *   header of each packet is looked at before the packet is decrypted, so
+ *   the data is only gone over once. Anything left over at the end (part of
+ *   a packet that hasn't all arrived yet) is left encrypted, and the cipher
+ *   is left ready to decrypt it once the rest of it is there. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to decrypt with. 
+ * 
+ *     void* buf 
+ *         Pointer to the received (encrypted) data. 
+ * 
+ *     unsigned long size 
+ *         Size of the received data. 
+ * 
+ *     int hdr 
+ *         Layout of the packet headers: CRYPT_HDR_DC, CRYPT_HDR_PC, or
+ *         CRYPT_HDR_BB. Packets take up their header's size rounded up to a
+ *         multiple of 4 bytes (8 for CRYPT_HDR_BB) in the buffer. A
+ *         CRYPT_BLUEBURST cipher only works with CRYPT_HDR_BB. 
+ * 
+ *     CRYPT_PACKET* pkts 
+ *         Where to store the packets found. They point into buf. 
+ * 
+ *     unsigned long max 
+ *         Most packets to store to pkts. Any more are left encrypted. 
+ * 
+ *     unsigned long* used 
+ *         Where to store the number of bytes taken up by the packets found.
+ *         Anything in the buffer after that is still encrypted. 
+ * 
+ *   Return value:
+ *     The function returns the number of packets found, or -1 if a packet
+ *     header was invalid (in which case the data at *used is the decrypted
+ *     bad header) or an invalid encryption type or header layout (or one
+ *     that doesn't go with the type) was given. 
+ */
+long CRYPT_ReceivePackets(CRYPT_SETUP* cs, void* buf, unsigned long size,
+                          int hdr, CRYPT_PACKET* pkts, unsigned long max,
+                          unsigned long* used);
+
+/* int CRYPT_CryptDataV(CRYPT_SETUP* cs,const struct iovec* iov,int iovcnt,
+ *                      int encrypting)
+ * 
+ *   Encrypts or decrypts, in place, data that is split over several
+ *   buffers, such as a header and payload pieces or a region that wraps
+ *   around the end of a ring buffer. The pieces are treated as one
+ *   contiguous stream: words (PC/GameCube) and blocks (Blue Burst) that
+ *   straddle a boundary between pieces are handled correctly, so the result
+ *   is the same as calling CRYPT_CryptData on the joined data. Pieces may be
+ *   of any length, including zero. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_SETUP* cs 
+ *         Pointer to the CRYPT_SETUP structure to use. 
+ * 
+ *     const struct iovec* iov 
+ *         The pieces of data to be processed, in order. 
+ * 
+ *     int iovcnt 
+ *         Number of entries in iov. 
+ * 
+ *     int encrypting 
+ *         1 if the data is to be encrypted, 0 if it is to be decrypted. 
+ *         Ignored unless the type of the given CRYPT_SETUP is CRYPT_BLUEBURST. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the operation succeeded, or 0 if an
+ *     invalid encryption type was given. 
+ */
+int CRYPT_CryptDataV(CRYPT_SETUP* cs, const struct iovec* iov, int iovcnt,
+                     int encrypting);
+
+/* int CRYPT_CryptBatch(CRYPT_BATCH* batch,unsigned long count,int encrypting)
+ * 
+ *   Encrypts or decrypts a set of buffers, each with its own CRYPT_SETUP, in
+ *   one call. Blocks of CRYPT_BLUEBURST buffers are processed several at a
+ *   time across sessions (using AVX2 where the CPU supports it). Buffers of
+ *   the other types are processed in order as by CRYPT_CryptData. The output
+ *   is identical to calling CRYPT_CryptData on each buffer in turn. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_BATCH* batch 
+ *         Array of buffers to process. The same CRYPT_SETUP may appear in more
+ *         than one entry. 
+ * 
+ *     unsigned long count 
+ *         Number of entries in the batch array. 
+ * 
+ *     int encrypting 
+ *         1 if the data is to be encrypted, 0 if it is to be decrypted. 
+ *         Ignored for entries that are not of type CRYPT_BLUEBURST. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the operation succeeded, or 0 if any entry
+ *     had an invalid encryption type. 
+ */
+int CRYPT_CryptBatch(CRYPT_BATCH* batch, unsigned long count, int encrypting);
+
+/* int CRYPT_SetKeyCache(unsigned long entries)
+ * 
+ *   Enables, resizes or disables the Blue Burst key schedule cache. While
+ *   enabled, CRYPT_CreateKeys looks up the 48-byte CRYPT_BLUEBURST key in the
+ *   cache and copies out the finished schedule instead of building it again,
+ *   evicting the least recently used schedule when full. Each entry takes a
+ *   little over 4 KB. The cache is disabled by default. Any call to this
+ *   function empties the cache and resets its statistics. 
+ * 
+ *   Arguments: 
+ * 
+ *     unsigned long entries 
+ *         Maximum number of schedules to keep, or 0 to disable the cache. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the operation succeeded, or 0 if memory for
+ *     the cache could not be allocated (the old cache is left in place). 
+ */
+int CRYPT_SetKeyCache(unsigned long entries);
+
+/* void CRYPT_GetKeyCacheStats(CRYPT_CACHE_STATS* stats)
+ * 
+ *   Reads the hit/miss counters and occupancy of the Blue Burst key schedule
+ *   cache. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_CACHE_STATS* stats 
+ *         Structure to fill in. 
+ * 
+ *   Return value: none 
+ */
+void CRYPT_GetKeyCacheStats(CRYPT_CACHE_STATS* stats);
+
+/* CRYPT_KEYPOOL* CRYPT_KeyPoolCreate(unsigned char type,unsigned long size,
+ *                                    unsigned long low_water,uint32_t seed)
+ * 
+ *   Creates a pool of ready-to-use server/client cipher pairs for new
+ *   connections and starts the background thread that fills it. The seeds
+ *   for each pair are drawn from a MT19937 generator owned by the pool.
+ *   Whenever the number of ready pairs drops to low_water or below, the
+ *   thread refills the pool back up to size. 
+ * 
+ *   Arguments: 
+ * 
+ *     unsigned char type 
+ *         Type of encryption for the pairs: CRYPT_GAMECUBE, CRYPT_BLUEBURST or
+ *         CRYPT_PC. 
+ * 
+ *     unsigned long size 
+ *         Number of pairs to keep ready. 
+ * 
+ *     unsigned long low_water 
+ *         Refill when this many pairs or fewer are left. Must be less than
+ *         size. 
+ * 
+ *     uint32_t seed 
+ *         Seed for the pool's random number generator. 
+ * 
+ *   Return value:
+ *     The function returns the new pool, or NULL if the arguments are invalid
+ *     or the pool or its thread could not be created. 
+ */
+CRYPT_KEYPOOL* CRYPT_KeyPoolCreate(unsigned char type, unsigned long size,
+                                   unsigned long low_water, uint32_t seed);
+
+/* int CRYPT_KeyPoolGet(CRYPT_KEYPOOL* pool,CRYPT_KEYPAIR* pair)
+ * 
+ *   Takes a pair of ciphers out of the pool. If the pool is empty, a pair is
+ *   built on the calling thread instead, so this always produces a usable
+ *   pair. Safe to call from any number of threads. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_KEYPOOL* pool 
+ *         The pool to take the pair from. 
+ * 
+ *     CRYPT_KEYPAIR* pair 
+ *         Receives the ciphers and the seeds to send to the client. 
+ * 
+ *   Return value:
+ *     The function returns 1 if the pair came from the pool, or 0 if it had
+ *     to be built on the spot. 
+ */
+int CRYPT_KeyPoolGet(CRYPT_KEYPOOL* pool, CRYPT_KEYPAIR* pair);
+
+/* unsigned long CRYPT_KeyPoolCount(CRYPT_KEYPOOL* pool)
+ * 
+ *   Returns the number of pairs currently ready in the pool. 
+ */
+unsigned long CRYPT_KeyPoolCount(CRYPT_KEYPOOL* pool);
+
+/* void CRYPT_KeyPoolDestroy(CRYPT_KEYPOOL* pool)
+ * 
+ *   Stops the pool's refill thread, waiting for it to exit, and frees the
+ *   pool. No other thread may be using the pool when this is called. 
+ * 
+ *   Arguments: 
+ * 
+ *     CRYPT_KEYPOOL* pool 
+ *         The pool to destroy. May be NULL. 
+ * 
+ *   Return value: none 
+ */
+void CRYPT_KeyPoolDestroy(CRYPT_KEYPOOL* pool);
 
 /* void CRYPT_PrintData(void* ds,unsigned long data_size)
  * 
@@ -175,6 +175,7 @@ typedef struct sylverant_limits {
     int check_j_sword;
 
     char *name;
+    void *arena;                        /* Set if built in an arena */
 } sylverant_limits_t;
 
 /* Weapon Attributes -- Stored in byte #4 of weapons. */
@@ -1,7 +1,7 @@
 /*
     This file is part of Sylverant PSO Server.
 
-    Copyright (C) 2025 Lawrence Sebald
+    Copyright (C) 2025, 2026 Lawrence Sebald
 
     This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU Affero General Public License version 3
@@ -31,12 +31,30 @@
 #define SYL_LOG_ERROR   40
 #define SYL_LOG_CRIT    50
 
-#define TLOG(...)   syl_logf(SYL_LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define DLOG(...)   syl_logf(SYL_LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define ILOG(...)   syl_logf(SYL_LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define WLOG(...)   syl_logf(SYL_LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define ELOG(...)   syl_logf(SYL_LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define CLOG(...)   syl_logf(SYL_LOG_CRIT, __FILE__, __LINE__, __VA_ARGS__)
+/* Lines below this level are compiled out of the logging macros entirely, so
+   they cost nothing at all (their arguments aren't even evaluated). Define it
+   before including this file (or on the command line) to raise it. */
+#ifndef SYL_LOG_COMPILED_MIN
+#define SYL_LOG_COMPILED_MIN    SYL_LOG_TRACE
+#endif
+
+/* The level set with syl_log_set_level(). The macros check this themselves, so
+   a line that won't be logged doesn't evaluate its arguments or make a call.
+   Don't set it directly. */
+extern int syl_log_min_level;
+
+#define SYL_LOG(level, ...) \
+    do { \
+        if((level) >= SYL_LOG_COMPILED_MIN && (level) >= syl_log_min_level) \
+            syl_logf(level, __FILE__, __LINE__, __VA_ARGS__); \
+    } while(0)
+
+#define TLOG(...)   SYL_LOG(SYL_LOG_TRACE, __VA_ARGS__)
+#define DLOG(...)   SYL_LOG(SYL_LOG_DEBUG, __VA_ARGS__)
+#define ILOG(...)   SYL_LOG(SYL_LOG_INFO, __VA_ARGS__)
+#define WLOG(...)   SYL_LOG(SYL_LOG_WARN, __VA_ARGS__)
+#define ELOG(...)   SYL_LOG(SYL_LOG_ERROR, __VA_ARGS__)
+#define CLOG(...)   SYL_LOG(SYL_LOG_CRIT, __VA_ARGS__)
 
 void syl_log_set_level(int level);
 FILE *syl_log_set_file(FILE *fp);
@@ -46,4 +64,32 @@ int syl_flogf(FILE *fp, int level, const char *fn, int line,
 int syl_vflogf(FILE *fp, int level, const char *fn, int line, const char *fmt,
                va_list args);
 
+/* Values for the policy parameter of syl_log_start_async(), saying what to do
+   with a line when the buffer is full. */
+#define SYL_LOG_ASYNC_DROP  0       /* Throw it away (and count it) */
+#define SYL_LOG_ASYNC_BLOCK 1       /* Wait for there to be room */
+
+/* Asynchronous logging. Once started, the logging functions format each line
+   and copy it into a buffer of about the given size (in bytes), and a
+   background thread writes them out. Putting a line in the buffer doesn't
+   take any locks, so threads that log a lot don't hold each other up on the
+   file's lock or wait for the writes to finish. Lines from each thread still
+   come out in order. Lines too long for half of the buffer are cut short.
+
+   Since lines are written later, a file that's been logged to must not be
+   closed until syl_log_flush() (or syl_log_stop_async()) has returned. Lines
+   to a file are only flushed once the writer has emptied the buffer, so
+   anything else written to the same file directly may come out of order. */
+int syl_log_start_async(size_t size, int policy);
+
+/* Wait for every line logged before this was called to be written out. */
+int syl_log_flush(void);
+
+/* Write out everything still in the buffer and go back to writing lines out
+   directly. */
+void syl_log_stop_async(void);
+
+/* Number of lines thrown away because the buffer was full. */
+unsigned long syl_log_dropped(void);
+
 #endif /* !DEBUG_H */
@@ -19,13 +19,94 @@
 #ifndef SYLVERANT__MEMORY_H
 #define SYLVERANT__MEMORY_H
 
+#include <stdio.h>
 #include <stddef.h>
 
+/* Reference counted allocations. Retaining and releasing are atomic, so an
+   object can be shared between threads without a lock as long as it isn't
+   modified. The destructor runs on whichever thread drops the last reference,
+   and sees everything done to the object by the threads that let go of it. */
 extern void *ref_alloc(size_t sz, void (*dtor)(void *));
 extern void *ref_retain(void *r);
 extern void *ref_release(void *r);
 extern void *ref_free(void *r, int skip_dtor);
 
+/* Allocate an object, saying where it was allocated from and what type of
+   object it is. The tag must be a string that sticks around forever (usually
+   a literal). Unless the library was configured with --enable-ref-debug, the
+   tag and location are ignored. ref_alloc_tagged and ref_alloc fill the
+   location in on their own; objects allocated with plain ref_alloc are
+   counted under the name of the file they were allocated in. */
+extern void *ref_alloc_at(size_t sz, void (*dtor)(void *), const char *tag,
+                          const char *file, int line);
+
+#define ref_alloc(sz, dtor) ref_alloc_at(sz, dtor, NULL, __FILE__, __LINE__)
+#define ref_alloc_tagged(sz, dtor, tag) \
+    ref_alloc_at(sz, dtor, tag, __FILE__, __LINE__)
+
+/* Live objects of one type, when the library was configured with
+   --enable-ref-debug. */
+typedef struct ref_tag_stats {
+    const char *tag;                    /* Tag, or file for untagged objects */
+    size_t live;                        /* Objects allocated and not freed */
+    size_t bytes;                       /* Bytes in those objects */
+    size_t total;                       /* Objects ever allocated */
+} ref_tag_stats_t;
+
+/* Fill in stats for up to max tags, returning how many were filled in. This is
+   always 0 without --enable-ref-debug. */
+extern int ref_tag_stats(ref_tag_stats_t *st, int max);
+
+/* Print the live objects and bytes for each tag, and for each place objects
+   were allocated from, to the given file. */
+extern void ref_debug_dump(FILE *fp);
+
+/* Occupancy of one of the pools that small objects are allocated from. */
+typedef struct ref_pool_stats {
+    size_t size;                        /* Block size (0 = too big for pools) */
+    size_t slabs;                       /* Slabs carved into blocks */
+    size_t blocks;                      /* Blocks in those slabs */
+    size_t free;                        /* Blocks in the shared pool */
+    size_t cached;                      /* Blocks in per-thread caches */
+    size_t in_use;                      /* Live objects */
+} ref_pool_stats_t;
+
+/* Fill in stats for up to max pools, returning how many were filled in. The
+   last entry is for objects too big for any of the pools. */
+extern int ref_pool_stats(ref_pool_stats_t *st, int max);
+
+/* Turn poisoning of freed objects on or off. While it's on, freed objects are
+   filled with 0xDD and new ones with 0xCD, and allocating an object that was
+   written to after being freed aborts with an error. This is slow, so it's
+   only meant for debugging. */
+extern void ref_pool_poison(int enable);
+
+/* Arenas hand out memory from a few big chunks, with no per-allocation
+   overhead and no way to free anything on its own -- everything in an arena
+   goes away at once, when the arena does. An arena is itself a reference
+   counted object, so it is freed with ref_release, and anything that points
+   into one can keep it alive with ref_retain. The size given to arena_create
+   is how much the first chunk holds (0 for a sensible default); if it's big
+   enough for everything, the whole arena is a single allocation. The dup
+   functions copy into the arena, and give back NULL for a NULL. Allocating
+   from an arena is not thread-safe, but retaining and releasing it is. */
+typedef struct sylverant_arena sylverant_arena_t;
+
+extern sylverant_arena_t *arena_create(size_t size);
+extern void *arena_alloc(sylverant_arena_t *a, size_t sz);
+extern char *arena_strdup(sylverant_arena_t *a, const char *s);
+extern void *arena_memdup(sylverant_arena_t *a, const void *p, size_t sz);
+extern size_t arena_used(sylverant_arena_t *a);
+
+/* Number of chunks the arena has had to add past the first one. This is 0 as
+   long as the size given to arena_create was big enough. */
+extern size_t arena_chunks(sylverant_arena_t *a);
+
+/* Space arena_alloc uses for an object of the given size, for working out
+   how big to make an arena up front. */
+#define ARENA_ALIGN     16
+#define ARENA_SIZE(sz)  (((sz) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
 #define retain(x) ref_retain(x)
 #define release(x) ref_release(x)
 
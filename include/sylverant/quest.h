@@ -110,6 +110,8 @@ typedef struct sylverant_quest {
 
     char *onload_script_file;
     char *beforeload_script_file;
+
+    void *arena;                        /* Set if built in an arena */
 } sylverant_quest_t;
 
 typedef struct sylverant_qcat {
@@ -126,6 +128,7 @@ typedef struct sylverant_qcat {
 typedef struct sylverant_qlist {
     sylverant_quest_category_t *cats;
     int cat_count;
+    void *arena;                        /* Set if built in an arena */
 } sylverant_quest_list_t;
 
 extern int sylverant_quests_read(const char *filename,
@@ -133,4 +136,10 @@ extern int sylverant_quests_read(const char *filename,
 
 extern void sylverant_quests_destroy(sylverant_quest_list_t *list);
 
+/* Read a quest list into a reference counted list (see memory.h), so that it
+   can be shared between threads and swapped out on reload like the limits
+   (see rcu.h). The list is cleaned up when the last reference is released. */
+extern int sylverant_quests_read_shared(const char *filename,
+                                        sylverant_quest_list_t **rv);
+
 #endif /* !QUEST_H */
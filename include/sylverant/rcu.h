@@ -0,0 +1,78 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SYLVERANT__RCU_H
+#define SYLVERANT__RCU_H
+
+/* A published pointer to a reference counted object (from ref_alloc), that can
+   be replaced with a new version while other threads are still reading the old
+   one -- for instance, reloading the limits or quest list while the ships'
+   block threads are using them.
+
+   Readers bracket their use of the object with ref_rcu_read_lock and
+   ref_rcu_read_unlock. Neither takes a lock or touches anything shared with
+   other readers. Anything that needs to keep the object past the unlock (a
+   game holding on to its quest list, say) takes a reference of its own with
+   ref_rcu_get.
+
+   Publishing a new version doesn't wait for readers. The old version is
+   retired, and its reference is only released once every thread that was
+   reading when it was replaced has unlocked. This is tracked with a global
+   epoch, which moves forward whenever every thread that is reading has seen
+   the current one. Retired versions are freed by later calls to
+   ref_rcu_publish, ref_rcu_reclaim or ref_rcu_synchronize. Readers never free
+   anything themselves. */
+typedef struct ref_rcu ref_rcu_t;
+
+/* Make a new published pointer. This takes over the caller's reference to the
+   object, which may be NULL. Returns NULL on memory allocation failure. */
+extern ref_rcu_t *ref_rcu_create(void *obj);
+
+/* Free a published pointer, retiring the object it points to. Nothing may be
+   reading from it (or about to) when this is called. */
+extern void ref_rcu_destroy(ref_rcu_t *r);
+
+/* Start and end a read-side section. These may be nested, and the section
+   lasts until the outermost unlock. A thread must not block for long in a read
+   section, since nothing retired while it's in one can be freed until it
+   leaves. */
+extern void ref_rcu_read_lock(void);
+extern void ref_rcu_read_unlock(void);
+
+/* Get the current object. Must be called in a read section, and the pointer is
+   only good until the end of it. */
+extern void *ref_rcu_deref(ref_rcu_t *r);
+
+/* Get the current object with a new reference, which the caller has to
+   ref_release when done with it. This doesn't need to be in a read section. */
+extern void *ref_rcu_get(ref_rcu_t *r);
+
+/* Replace the current object, taking over the caller's reference to the new
+   one and retiring the old one. Must not be called in a read section. */
+extern void ref_rcu_publish(ref_rcu_t *r, void *obj);
+
+/* Free whatever retired objects no thread can still be reading, without
+   waiting. Returns the number still waiting to be freed. Must not be called
+   in a read section. */
+extern int ref_rcu_reclaim(void);
+
+/* Wait until everything retired before this was called has been freed. Must
+   not be called in a read section, or it would be waiting on itself. */
+extern void ref_rcu_synchronize(void);
+
+#endif /* !SYLVERANT__RCU_H */
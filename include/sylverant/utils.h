@@ -19,11 +19,36 @@
 #ifndef SYLVERANT__UTILS_H
 #define SYLVERANT__UTILS_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 
+/* State of an MD5 computed a piece at a time. */
+typedef struct md5_ctx {
+    uint64_t size;                      /* Bits hashed so far */
+    uint32_t hash[4];
+    uint8_t  buf[64];                   /* Partial block left over */
+} md5_ctx_t;
+
 void md5(const uint8_t *input, uint32_t size, uint8_t output[16]);
+
+/* Compute an MD5 over data that comes in pieces. Call md5_init once, then
+   md5_update with each piece in order, then md5_final to get the hash. */
+void md5_init(md5_ctx_t *ctx);
+void md5_update(md5_ctx_t *ctx, const void *input, size_t size);
+void md5_final(md5_ctx_t *ctx, uint8_t output[16]);
+
+/* Compute the MD5 of a whole file, mapping it into memory instead of reading it
+   into a buffer. Returns 0 on success, or -1 on error (with errno set). */
+int md5_file(const char *fn, uint8_t output[16]);
+
+/* Compute the MD5 of count independent inputs, storing each to outputs. This
+   gives the same results as calling md5() on each one, but hashes several of
+   them at once with SIMD instructions where the CPU has them. */
+void md5_batch(const uint8_t *const inputs[], const uint32_t sizes[],
+               int count, uint8_t outputs[][16]);
+
 const void *syl_ntop(struct sockaddr *addr, char str[INET6_ADDRSTRLEN]);
 
 #endif /* !SYLVERANT__UTILS_H */
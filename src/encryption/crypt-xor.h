@@ -0,0 +1,112 @@
+/* PSO Encryption Library
+ *
+ * Shared helper for the PC and GameCube stream ciphers. This is not part of
+ * the public interface.
+ */
+
+#ifndef SYLVERANT__CRYPT_XOR_H
+#define SYLVERANT__CRYPT_XOR_H
+
+#include <string.h>
+#include <inttypes.h>
+
+#if defined(__SSE2__) && !defined(__BIG_ENDIAN__) && !defined(WORDS_BIGENDIAN)
+#include <emmintrin.h>
+#define CRYPT_XOR_HAVE_SSE2
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#include <pthread.h>
+#define CRYPT_XOR_HAVE_AVX2
+#endif
+#endif
+
+#if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
+#define CRYPT_XOR_LE32(x) (((x >> 24) & 0x00FF) | \
+                           ((x >>  8) & 0xFF00) | \
+                           ((x & 0xFF00) <<  8) | \
+                           ((x & 0x00FF) << 24))
+#else
+#define CRYPT_XOR_LE32(x) x
+#endif
+
+#ifdef CRYPT_XOR_HAVE_AVX2
+static pthread_once_t crypt_xor_once = PTHREAD_ONCE_INIT;
+static int crypt_xor_avx2;
+
+static void CRYPT_XorCheckCPU(void)
+{
+    __builtin_cpu_init();
+    crypt_xor_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+static int CRYPT_XorHaveAVX2(void)
+{
+    pthread_once(&crypt_xor_once, &CRYPT_XorCheckCPU);
+    return crypt_xor_avx2;
+}
+
+// Handles the whole multiple-of-8 part of the run, returning how many words
+// were done.
+__attribute__((target("avx2")))
+static unsigned long CRYPT_XorKeysAVX2(uint8_t* dst, const uint8_t* src,
+                                       const uint32_t* keys,
+                                       unsigned long count)
+{
+    unsigned long x;
+
+    for (x = 0; x + 8 <= count; x += 8)
+    {
+        __m256i d = _mm256_loadu_si256((const __m256i*)(src + (x << 2)));
+        __m256i k = _mm256_loadu_si256((const __m256i*)(keys + x));
+        _mm256_storeu_si256((__m256i*)(dst + (x << 2)),
+                            _mm256_xor_si256(d, k));
+    }
+    return x;
+}
+#endif
+
+// XOR count little-endian words of src with a run of the key stream, storing
+// the result to dst (which may be the same as src).
+static inline void CRYPT_XorKeys(uint8_t* dst, const uint8_t* src,
+                                 const uint32_t* keys, unsigned long count)
+{
+    unsigned long x = 0;
+    uint32_t tmp;
+
+#ifdef CRYPT_XOR_HAVE_AVX2
+    if (count >= 16 && CRYPT_XorHaveAVX2())
+        x = CRYPT_XorKeysAVX2(dst, src, keys, count);
+#endif
+
+#ifdef CRYPT_XOR_HAVE_SSE2
+    for (; x + 4 <= count; x += 4)
+    {
+        __m128i d = _mm_loadu_si128((const __m128i*)(src + (x << 2)));
+        __m128i k = _mm_loadu_si128((const __m128i*)(keys + x));
+        _mm_storeu_si128((__m128i*)(dst + (x << 2)), _mm_xor_si128(d, k));
+    }
+#endif
+
+    for (; x < count; x++)
+    {
+        memcpy(&tmp, src + (x << 2), 4);
+        tmp = CRYPT_XOR_LE32(tmp) ^ keys[x];
+        tmp = CRYPT_XOR_LE32(tmp);
+        memcpy(dst + (x << 2), &tmp, 4);
+    }
+}
+
+// XOR the last few (less than four) bytes of the data with one key, without
+// touching anything past the end of either buffer.
+static inline void CRYPT_XorPartial(uint8_t* dst, const uint8_t* src,
+                                    uint32_t key, unsigned long bytes)
+{
+    uint8_t last[4] = { 0, 0, 0, 0 };
+
+    memcpy(last, src, bytes);
+    CRYPT_XorKeys(last, last, &key, 1);
+    memcpy(dst, last, bytes);
+}
+
+#endif /* !SYLVERANT__CRYPT_XOR_H */
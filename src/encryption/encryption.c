@@ -10,22 +10,27 @@
 #include "sylverant/encryption.h"
 
 // Internal functions (don't call these)
-unsigned long CRYPT_PC_GetNextKey(CRYPT_SETUP*);
 void CRYPT_PC_MixKeys(CRYPT_SETUP*);
 void CRYPT_PC_CreateKeys(CRYPT_SETUP*,uint32_t);
 void CRYPT_PC_CryptData(CRYPT_SETUP*,void*,unsigned long);
+void CRYPT_PC_CryptDataTo(CRYPT_SETUP*,void*,const void*,unsigned long);
+void CRYPT_PC_UnmixKeys(CRYPT_SETUP*);
 void CRYPT_PC_DEBUG_PrintKeys(CRYPT_SETUP*,char*);
+extern const CRYPT_OPS CRYPT_PC_Ops;
 
 unsigned long CRYPT_GC_GetNextKey(CRYPT_SETUP*);
 void CRYPT_GC_MixKeys(CRYPT_SETUP*);
 void CRYPT_GC_CreateKeys(CRYPT_SETUP*,uint32_t);
 void CRYPT_GC_CryptData(CRYPT_SETUP*,void*,unsigned long);
+void CRYPT_GC_CryptDataTo(CRYPT_SETUP*,void*,const void*,unsigned long);
+void CRYPT_GC_UnmixKeys(CRYPT_SETUP*);
 void CRYPT_GC_DEBUG_PrintKeys(CRYPT_SETUP*,char*);
+extern const CRYPT_OPS CRYPT_GC_Ops;
 
-void CRYPT_BB_Decrypt(CRYPT_SETUP*,void*,unsigned long);
-void CRYPT_BB_Encrypt(CRYPT_SETUP*,void*,unsigned long);
 void CRYPT_BB_CreateKeys(CRYPT_SETUP*,void*);
+void CRYPT_BB_CryptBatch(CRYPT_BATCH*,unsigned long,int);
 void CRYPT_BB_DEBUG_PrintKeys(CRYPT_SETUP *,char *);
+extern const CRYPT_OPS CRYPT_BB_Ops;
 
 int CRYPT_CreateKeys(CRYPT_SETUP* cs,void* key,unsigned char type)
 {
@@ -35,12 +40,15 @@ int CRYPT_CreateKeys(CRYPT_SETUP* cs,void* key,unsigned char type)
     {
       case CRYPT_PC:
         CRYPT_PC_CreateKeys(cs,*(uint32_t*)key);
+        cs->ops = &CRYPT_PC_Ops;
         break;
       case CRYPT_GAMECUBE:
         CRYPT_GC_CreateKeys(cs,*(uint32_t*)key);
+        cs->ops = &CRYPT_GC_Ops;
         break;
       case CRYPT_BLUEBURST:
         CRYPT_BB_CreateKeys(cs,key);
+        cs->ops = &CRYPT_BB_Ops;
         break;
       default:
         return 0;
@@ -48,26 +56,252 @@ int CRYPT_CreateKeys(CRYPT_SETUP* cs,void* key,unsigned char type)
     return 1;
 }
 
+// A CRYPT_SETUP that didn't come from CRYPT_CreateKeys (or was set up by a
+// caller built against an older header) has no ops, so go by its type.
+static const CRYPT_OPS* CRYPT_GetOps(CRYPT_SETUP* cs)
+{
+    if (cs->ops) return cs->ops;
+    switch (cs->type)
+    {
+      case CRYPT_PC:
+        return &CRYPT_PC_Ops;
+      case CRYPT_GAMECUBE:
+        return &CRYPT_GC_Ops;
+      case CRYPT_BLUEBURST:
+        return &CRYPT_BB_Ops;
+    }
+    return NULL;
+}
+
 int CRYPT_CryptData(CRYPT_SETUP* cs,void* data,unsigned long size,int encrypting)
 {
+    const CRYPT_OPS* ops = CRYPT_GetOps(cs);
+
+    if (!ops) return 0;
+    ops->crypt[encrypting != 0](cs,data,size);
+    return 1;
+}
+
+int CRYPT_CryptDataTo(CRYPT_SETUP* cs,void* dst,const void* src,
+                      unsigned long size,int encrypting)
+{
+    const CRYPT_OPS* ops = CRYPT_GetOps(cs);
+
+    if (!ops) return 0;
+    ops->crypt_to[encrypting != 0](cs,dst,src,size);
+    return 1;
+}
+
+void CRYPT_CopySetup(CRYPT_SETUP* dst,const CRYPT_SETUP* src)
+{
+    memcpy(dst,src,sizeof(CRYPT_SETUP));
+
+    // The GameCube cipher keeps pointers into its own key table, so they have
+    // to be pointed at the copy's table.
+    if (src->type == CRYPT_GAMECUBE)
+    {
+        dst->gc_block_ptr = dst->keys + (src->gc_block_ptr - src->keys);
+        dst->gc_block_end_ptr = dst->keys + (src->gc_block_end_ptr - src->keys);
+    }
+}
+
+void CRYPT_SaveState(CRYPT_SETUP* cs,CRYPT_SNAPSHOT* snap)
+{
+    snap->type = cs->type;
+    snap->mix_count = cs->mix_count;
     switch (cs->type)
     {
       case CRYPT_PC:
-        CRYPT_PC_CryptData(cs, data, size);
+        snap->posn = cs->pc_posn;
+        break;
+      case CRYPT_GAMECUBE:
+        snap->posn = cs->gc_block_ptr - cs->keys;
+        break;
+      default:
+        snap->posn = 0;
+        break;
+    }
+}
+
+int CRYPT_RestoreState(CRYPT_SETUP* cs,const CRYPT_SNAPSHOT* snap)
+{
+    if (snap->type != cs->type || snap->mix_count > cs->mix_count)
+        return 0;
+
+    switch (cs->type)
+    {
+      case CRYPT_PC:
+        while (cs->mix_count != snap->mix_count) CRYPT_PC_UnmixKeys(cs);
+        cs->pc_posn = snap->posn;
+        break;
+      case CRYPT_GAMECUBE:
+        while (cs->mix_count != snap->mix_count) CRYPT_GC_UnmixKeys(cs);
+        cs->gc_block_ptr = &cs->keys[snap->posn];
+        break;
+      case CRYPT_BLUEBURST:
+        break;
+      default:
+        return 0;
+    }
+    return 1;
+}
+
+int CRYPT_PeekData(CRYPT_SETUP* cs,void* dst,const void* src,
+                   unsigned long size,int encrypting)
+{
+    CRYPT_SNAPSHOT snap;
+
+    CRYPT_SaveState(cs,&snap);
+    if (!CRYPT_CryptDataTo(cs,dst,src,size,encrypting))
+        return 0;
+    return CRYPT_RestoreState(cs,&snap);
+}
+
+long CRYPT_ReceivePackets(CRYPT_SETUP* cs,void* buf,unsigned long size,
+                          int hdr,CRYPT_PACKET* pkts,unsigned long max,
+                          unsigned long* used)
+{
+    uint8_t* data = (uint8_t*)buf;
+    uint8_t head[8];
+    unsigned long hsize, len, padded, posn = 0;
+    long count = 0;
+    const CRYPT_OPS* ops = CRYPT_GetOps(cs);
+    CRYPT_SNAPSHOT snap;
+
+    *used = 0;
+    if (!ops) return -1;
+    switch (hdr)
+    {
+      case CRYPT_HDR_DC:
+      case CRYPT_HDR_PC:
+        // Blue Burst works in 8 byte blocks, so a 4 byte header would leave
+        // it out of step with the sender.
+        if (cs->type == CRYPT_BLUEBURST) return -1;
+        hsize = 4;
+        break;
+      case CRYPT_HDR_BB:
+        hsize = 8;
         break;
+      default:
+        return -1;
+    }
+
+    while ((unsigned long)count < max && size - posn >= hsize)
+    {
+        // Decrypt the header on its own first. If the whole packet isn't
+        // there yet, the cipher is rolled back to before it.
+        CRYPT_SaveState(cs,&snap);
+        ops->crypt_to[0](cs,head,data + posn,hsize);
+        if (hdr == CRYPT_HDR_DC) len = head[2] | (head[3] << 8);
+        else len = head[0] | (head[1] << 8);
+
+        if (len < hsize)
+        {
+            // Leave the bad header decrypted where the caller can see it.
+            memcpy(data + posn,head,hsize);
+            *used = posn;
+            return -1;
+        }
+
+        padded = (len + hsize - 1) & ~(hsize - 1);
+        if (padded > size - posn)
+        {
+            CRYPT_RestoreState(cs,&snap);
+            break;
+        }
+
+        // Only the body is left to decrypt.
+        memcpy(data + posn,head,hsize);
+        ops->crypt[0](cs,data + posn + hsize,padded - hsize);
+        pkts[count].data = data + posn;
+        pkts[count].size = len;
+        count++;
+        posn += padded;
+    }
+
+    *used = posn;
+    return count;
+}
+
+int CRYPT_CryptDataV(CRYPT_SETUP* cs,const struct iovec* iov,int iovcnt,
+                     int encrypting)
+{
+    uint8_t unit_buf[8], *unit_ptr[8], *ptr;
+    unsigned long unit, pending = 0, len, bulk, y;
+    int x;
+
+    switch (cs->type)
+    {
+      case CRYPT_PC:
       case CRYPT_GAMECUBE:
-        CRYPT_GC_CryptData(cs,data,size);
+        unit = 4;
         break;
       case CRYPT_BLUEBURST:
-        if (encrypting) CRYPT_BB_Encrypt(cs,data,size);
-        else CRYPT_BB_Decrypt(cs,data,size);
+        unit = 8;
         break;
       default:
         return 0;
     }
+
+    // Whole words/blocks are done where they lie. One that is split between
+    // pieces is gathered into unit_buf, processed, then scattered back.
+    for (x = 0; x < iovcnt; x++)
+    {
+        ptr = (uint8_t*)iov[x].iov_base;
+        len = iov[x].iov_len;
+
+        while (pending && len)
+        {
+            unit_ptr[pending] = ptr;
+            unit_buf[pending++] = *ptr++;
+            len--;
+
+            if (pending == unit)
+            {
+                CRYPT_CryptData(cs,unit_buf,unit,encrypting);
+                for (y = 0; y < unit; y++) *unit_ptr[y] = unit_buf[y];
+                pending = 0;
+            }
+        }
+
+        bulk = len - (len % unit);
+        if (bulk) CRYPT_CryptData(cs,ptr,bulk,encrypting);
+        ptr += bulk;
+        len -= bulk;
+
+        while (len)
+        {
+            unit_ptr[pending] = ptr;
+            unit_buf[pending++] = *ptr++;
+            len--;
+        }
+    }
+
+    if (pending)
+    {
+        CRYPT_CryptData(cs,unit_buf,pending,encrypting);
+        for (y = 0; y < pending; y++) *unit_ptr[y] = unit_buf[y];
+    }
+
     return 1;
 }
 
+int CRYPT_CryptBatch(CRYPT_BATCH* batch,unsigned long count,int encrypting)
+{
+    unsigned long x;
+    int rv = 1;
+
+    // Blue Burst buffers all go through together, the rest one at a time.
+    CRYPT_BB_CryptBatch(batch,count,encrypting);
+    for (x = 0; x < count; x++)
+    {
+        if (batch[x].cs->type == CRYPT_BLUEBURST) continue;
+        if (!CRYPT_CryptData(batch[x].cs,batch[x].data,batch[x].size,encrypting))
+            rv = 0;
+    }
+    return rv;
+}
+
 void CRYPT_DEBUG_PrintKeys(CRYPT_SETUP* cs,char* title)
 {
     switch (cs->type)
@@ -84,6 +318,42 @@ void CRYPT_DEBUG_PrintKeys(CRYPT_SETUP* cs,char* title)
     }
 }
 
+unsigned long CRYPT_StateSize(unsigned char type)
+{
+    switch (type)
+    {
+      case CRYPT_PC:
+        return sizeof(CRYPT_PC_STATE);
+      case CRYPT_GAMECUBE:
+        return sizeof(CRYPT_GC_STATE);
+      case CRYPT_BLUEBURST:
+        return sizeof(CRYPT_BB_STATE);
+    }
+    return 0;
+}
+
+void CRYPT_PrintFootprint(void)
+{
+    static const struct {
+        const char* name;
+        unsigned char type;
+    } types[3] = {
+        { "PC", CRYPT_PC },
+        { "GameCube", CRYPT_GAMECUBE },
+        { "Blue Burst", CRYPT_BLUEBURST }
+    };
+    unsigned long x,size;
+
+    printf("Type       | CRYPT_SETUP | State | Per client (SETUP/State)\n");
+    for (x = 0; x < 3; x++)
+    {
+        size = CRYPT_StateSize(types[x].type);
+        printf("%-10s | %11lu | %5lu | %lu/%lu\n",types[x].name,
+               (unsigned long)sizeof(CRYPT_SETUP),size,
+               (unsigned long)sizeof(CRYPT_SETUP) * 2,size * 2);
+    }
+}
+
 void CRYPT_PrintData(void* ds,unsigned long data_size)
 {
     unsigned char* data_source = (unsigned char*)ds;
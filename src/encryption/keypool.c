@@ -0,0 +1,180 @@
+/* PSO Encryption Library
+ *
+ * Pre-generated key pool, written by Lawrence Sebald (2026).
+ *
+ * Keeps a ring of ready-to-use server/client CRYPT_SETUP pairs, along with the
+ * seeds they were made from, so that accepting a connection only has to take
+ * one out and send the seeds. A background thread tops the ring back up to
+ * full whenever it drops to the low-water mark.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "sylverant/encryption.h"
+#include "sylverant/mtwist.h"
+
+struct CRYPT_KEYPOOL {
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled when a refill is needed or on shutdown
+    pthread_t thread;
+    struct mt19937_state rng;
+    CRYPT_KEYPAIR* pairs;
+    unsigned long size;
+    unsigned long low_water;
+    unsigned long head; // index of the next pair to hand out
+    unsigned long count; // pairs ready to hand out
+    unsigned char type;
+    int running;
+};
+
+// Fills in the seeds of a pair. Must be called with the pool locked, since the
+// random number generator is shared.
+static void CRYPT_KeyPoolSeed(CRYPT_KEYPOOL* pool, CRYPT_KEYPAIR* pair)
+{
+    int x, words = pool->type == CRYPT_BLUEBURST ? 12 : 1;
+
+    memset(pair->server_key, 0, sizeof(pair->server_key));
+    memset(pair->client_key, 0, sizeof(pair->client_key));
+    for (x = 0; x < words; x++)
+    {
+        pair->server_key[x] = mt19937_genrand_int32(&pool->rng);
+        pair->client_key[x] = mt19937_genrand_int32(&pool->rng);
+    }
+}
+
+static void CRYPT_KeyPoolBuild(CRYPT_KEYPOOL* pool, CRYPT_KEYPAIR* pair)
+{
+    CRYPT_CreateKeys(&pair->server, pair->server_key, pool->type);
+    CRYPT_CreateKeys(&pair->client, pair->client_key, pool->type);
+}
+
+static void* CRYPT_KeyPoolThread(void* arg)
+{
+    CRYPT_KEYPOOL* pool = (CRYPT_KEYPOOL*)arg;
+    CRYPT_KEYPAIR* pair;
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running)
+    {
+        if (pool->count > pool->low_water)
+        {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+
+        // Only this thread adds to the ring, so the slot past the last ready
+        // pair can be filled in without holding the lock.
+        while (pool->running && pool->count < pool->size)
+        {
+            pair = &pool->pairs[(pool->head + pool->count) % pool->size];
+            CRYPT_KeyPoolSeed(pool, pair);
+            pthread_mutex_unlock(&pool->lock);
+
+            CRYPT_KeyPoolBuild(pool, pair);
+
+            pthread_mutex_lock(&pool->lock);
+            pool->count++;
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+CRYPT_KEYPOOL* CRYPT_KeyPoolCreate(unsigned char type, unsigned long size,
+                                   unsigned long low_water, uint32_t seed)
+{
+    CRYPT_KEYPOOL* pool;
+
+    if (type != CRYPT_PC && type != CRYPT_GAMECUBE && type != CRYPT_BLUEBURST)
+        return NULL;
+    if (!size || low_water >= size || size > SIZE_MAX / sizeof(CRYPT_KEYPAIR))
+        return NULL;
+
+    if (!(pool = (CRYPT_KEYPOOL*)calloc(1, sizeof(CRYPT_KEYPOOL))))
+        return NULL;
+
+    if (!(pool->pairs = (CRYPT_KEYPAIR*)malloc(sizeof(CRYPT_KEYPAIR) * size)))
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pool->type = type;
+    pool->size = size;
+    pool->low_water = low_water;
+    pool->running = 1;
+    mt19937_init(&pool->rng, seed);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    if (pthread_create(&pool->thread, NULL, &CRYPT_KeyPoolThread, pool))
+    {
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->lock);
+        free(pool->pairs);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int CRYPT_KeyPoolGet(CRYPT_KEYPOOL* pool, CRYPT_KEYPAIR* pair)
+{
+    CRYPT_KEYPAIR* src;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->count)
+    {
+        src = &pool->pairs[pool->head];
+        CRYPT_CopySetup(&pair->server, &src->server);
+        CRYPT_CopySetup(&pair->client, &src->client);
+        memcpy(pair->server_key, src->server_key, sizeof(pair->server_key));
+        memcpy(pair->client_key, src->client_key, sizeof(pair->client_key));
+
+        pool->head = (pool->head + 1) % pool->size;
+        if (--pool->count <= pool->low_water)
+            pthread_cond_signal(&pool->cond);
+        pthread_mutex_unlock(&pool->lock);
+        return 1;
+    }
+
+    // Ran dry, so build one here rather than make the caller wait.
+    CRYPT_KeyPoolSeed(pool, pair);
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    CRYPT_KeyPoolBuild(pool, pair);
+    return 0;
+}
+
+unsigned long CRYPT_KeyPoolCount(CRYPT_KEYPOOL* pool)
+{
+    unsigned long rv;
+
+    pthread_mutex_lock(&pool->lock);
+    rv = pool->count;
+    pthread_mutex_unlock(&pool->lock);
+
+    return rv;
+}
+
+void CRYPT_KeyPoolDestroy(CRYPT_KEYPOOL* pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = 0;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_join(pool->thread, NULL);
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->pairs);
+    free(pool);
+}
@@ -0,0 +1,191 @@
+/* PSO Encryption Library
+ *
+ * Blue Burst key schedule cache, written by Lawrence Sebald (2026).
+ *
+ * Building a Blue Burst key schedule means copying the 4 KB table and then
+ * running 521 encryptions over it. When the same seed is seen again (for
+ * instance, seeds that were generated ahead of time), the finished schedule
+ * can just be copied out of here instead. The cache is a fixed number of
+ * entries, kept in least-recently-used order, and is disabled by default.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "sylverant/encryption.h"
+
+#define BB_KEY_COUNT 1042
+
+typedef struct bb_cache_entry {
+    uint32_t seed[12];
+    uint32_t keys[BB_KEY_COUNT];
+    struct bb_cache_entry *hnext; // next entry in the same hash bucket
+    struct bb_cache_entry *prev; // LRU list, most recently used first
+    struct bb_cache_entry *next;
+} bb_cache_entry;
+
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static bb_cache_entry *cache_entries = NULL;
+static bb_cache_entry **cache_buckets = NULL;
+static bb_cache_entry cache_lru = { .prev = &cache_lru, .next = &cache_lru };
+// Checked without the lock first, so key builds don't all queue up on it
+// while the cache is disabled.
+static atomic_ulong cache_size = 0;
+static unsigned long cache_used = 0;
+static unsigned long cache_mask = 0;
+static unsigned long cache_hits = 0;
+static unsigned long cache_misses = 0;
+
+static unsigned long CRYPT_BB_CacheHash(const void *seed)
+{
+    const uint8_t *s = (const uint8_t *)seed;
+    uint32_t h = 0x811C9DC5;
+    int x;
+
+    for (x = 0; x < 48; x++)
+    {
+        h ^= s[x];
+        h *= 0x01000193;
+    }
+    return h & cache_mask;
+}
+
+static void CRYPT_BB_CacheUnlink(bb_cache_entry *e)
+{
+    e->prev->next = e->next;
+    e->next->prev = e->prev;
+}
+
+static void CRYPT_BB_CachePushFront(bb_cache_entry *e)
+{
+    e->prev = &cache_lru;
+    e->next = cache_lru.next;
+    cache_lru.next->prev = e;
+    cache_lru.next = e;
+}
+
+static bb_cache_entry *CRYPT_BB_CacheFind(const void *seed, unsigned long h)
+{
+    bb_cache_entry *e;
+
+    for (e = cache_buckets[h]; e; e = e->hnext)
+        if (!memcmp(e->seed, seed, 48)) return e;
+    return NULL;
+}
+
+int CRYPT_SetKeyCache(unsigned long entries)
+{
+    bb_cache_entry *ne = NULL, **nb = NULL;
+    unsigned long buckets = 1;
+
+    if (entries)
+    {
+        while (buckets < entries) buckets <<= 1;
+
+        ne = (bb_cache_entry *)malloc(sizeof(bb_cache_entry) * entries);
+        nb = (bb_cache_entry **)calloc(buckets, sizeof(bb_cache_entry *));
+        if (!ne || !nb)
+        {
+            free(ne);
+            free(nb);
+            return 0;
+        }
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    free(cache_entries);
+    free(cache_buckets);
+    cache_entries = ne;
+    cache_buckets = nb;
+    atomic_store_explicit(&cache_size, entries, memory_order_relaxed);
+    cache_mask = buckets - 1;
+    cache_used = 0;
+    cache_hits = cache_misses = 0;
+    cache_lru.prev = cache_lru.next = &cache_lru;
+    pthread_mutex_unlock(&cache_lock);
+
+    return 1;
+}
+
+void CRYPT_GetKeyCacheStats(CRYPT_CACHE_STATS *stats)
+{
+    pthread_mutex_lock(&cache_lock);
+    stats->hits = cache_hits;
+    stats->misses = cache_misses;
+    stats->entries = cache_used;
+    stats->capacity = atomic_load_explicit(&cache_size, memory_order_relaxed);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Copies the cached schedule for the seed into keys and returns 1 if there is
+// one, otherwise returns 0.
+int CRYPT_BB_CacheLookup(const void *seed, uint32_t *keys)
+{
+    bb_cache_entry *e;
+    int rv = 0;
+
+    if (!atomic_load_explicit(&cache_size, memory_order_relaxed)) return 0;
+
+    pthread_mutex_lock(&cache_lock);
+    if (atomic_load_explicit(&cache_size, memory_order_relaxed))
+    {
+        if ((e = CRYPT_BB_CacheFind(seed, CRYPT_BB_CacheHash(seed))))
+        {
+            memcpy(keys, e->keys, sizeof(e->keys));
+            CRYPT_BB_CacheUnlink(e);
+            CRYPT_BB_CachePushFront(e);
+            cache_hits++;
+            rv = 1;
+        }
+        else cache_misses++;
+    }
+    pthread_mutex_unlock(&cache_lock);
+
+    return rv;
+}
+
+// Stores a finished schedule, pushing out the least recently used one if the
+// cache is full.
+void CRYPT_BB_CacheStore(const void *seed, const uint32_t *keys)
+{
+    bb_cache_entry *e, **pp;
+    unsigned long h;
+
+    if (!atomic_load_explicit(&cache_size, memory_order_relaxed)) return;
+
+    pthread_mutex_lock(&cache_lock);
+    if (!atomic_load_explicit(&cache_size, memory_order_relaxed))
+    {
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    // Another thread may have built the same schedule in the meantime.
+    h = CRYPT_BB_CacheHash(seed);
+    if ((e = CRYPT_BB_CacheFind(seed, h)))
+    {
+        CRYPT_BB_CacheUnlink(e);
+        CRYPT_BB_CachePushFront(e);
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    if (cache_used < atomic_load_explicit(&cache_size, memory_order_relaxed))
+        e = &cache_entries[cache_used++];
+    else
+    {
+        e = cache_lru.prev;
+        CRYPT_BB_CacheUnlink(e);
+        for (pp = &cache_buckets[CRYPT_BB_CacheHash(e->seed)]; *pp != e;
+             pp = &(*pp)->hnext);
+        *pp = e->hnext;
+    }
+
+    memcpy(e->seed, seed, sizeof(e->seed));
+    memcpy(e->keys, keys, sizeof(e->keys));
+    e->hnext = cache_buckets[h];
+    cache_buckets[h] = e;
+    CRYPT_BB_CachePushFront(e);
+    pthread_mutex_unlock(&cache_lock);
+}
@@ -11,6 +11,12 @@
 #include <stdint.h>
 #include "sylverant/encryption.h"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#include <pthread.h>
+#define CRYPT_BB_HAVE_AVX2
+#endif
+
 #if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
 #define LE32(x) (((x >> 24) & 0x00FF) | \
                  ((x >>  8) & 0xFF00) | \
@@ -152,79 +158,295 @@ static const uint32_t bbtable[1024] = {
     0x90D4F869,0xA65CDEA0,0x3F09252D,0xC208E69F,0xB74E6132,0xCE77E25B,0x578FDFE3,0x3AC372E6
 };
 
-void CRYPT_BB_Decrypt(CRYPT_SETUP *pcry, void *vdata, uint32_t length)
+// The cipher itself only works on the key table, so that both CRYPT_SETUP and
+// the smaller CRYPT_BB_STATE can use it.
+
+static void CRYPT_BB_DecryptBlocks(const uint32_t *keys, void *vdst,
+                                   const void *vsrc, unsigned long length)
 {
-    unsigned char *data = (unsigned char *)vdata;
-    uint32_t eax, ecx, edx, ebx, ebp, esi, edi, tmp;
+    unsigned char *dst = (unsigned char *)vdst;
+    const unsigned char *src = (const unsigned char *)vsrc;
+    unsigned char last[8];
+    uint32_t ebx, ebp, esi, edi, tmp;
+    unsigned long edx;
 
     edx = 0;
-    ecx = 0;
-    eax = 0;
-    while (edx < length)
+    while (edx + 8 <= length)
     {
-        ebx = *(uint32_t *) &data[edx];
+        ebx = *(const uint32_t *) &src[edx];
         ebx = LE32(ebx);
-        ebx = ebx ^ pcry->keys[5];
-        ebp = ((pcry->keys[(ebx >> 0x18) + 0x12]+pcry->keys[((ebx >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebx >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebx & 0xff) + 0x312];
-        ebp = ebp ^ pcry->keys[4];
-        tmp = *(uint32_t *) &data[edx+4];
+        ebx = ebx ^ keys[5];
+        ebp = ((keys[(ebx >> 0x18) + 0x12]+keys[((ebx >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebx >> 0x8)& 0xff) + 0x212]) + keys[(ebx & 0xff) + 0x312];
+        ebp = ebp ^ keys[4];
+        tmp = *(const uint32_t *) &src[edx+4];
         ebp ^= LE32(tmp);
-        edi = ((pcry->keys[(ebp >> 0x18) + 0x12]+pcry->keys[((ebp >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebp >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebp & 0xff) + 0x312];
-        edi = edi ^ pcry->keys[3];
+        edi = ((keys[(ebp >> 0x18) + 0x12]+keys[((ebp >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebp >> 0x8)& 0xff) + 0x212]) + keys[(ebp & 0xff) + 0x312];
+        edi = edi ^ keys[3];
         ebx = ebx ^ edi;
-        esi = ((pcry->keys[(ebx >> 0x18) + 0x12]+pcry->keys[((ebx >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebx >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebx & 0xff) + 0x312];
-        ebp = ebp ^ esi ^ pcry->keys[2];
-        edi = ((pcry->keys[(ebp >> 0x18) + 0x12]+pcry->keys[((ebp >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebp >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebp & 0xff) + 0x312];
-        edi = edi ^ pcry->keys[1];
-        ebp = ebp ^ pcry->keys[0];
+        esi = ((keys[(ebx >> 0x18) + 0x12]+keys[((ebx >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebx >> 0x8)& 0xff) + 0x212]) + keys[(ebx & 0xff) + 0x312];
+        ebp = ebp ^ esi ^ keys[2];
+        edi = ((keys[(ebp >> 0x18) + 0x12]+keys[((ebp >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebp >> 0x8)& 0xff) + 0x212]) + keys[(ebp & 0xff) + 0x312];
+        edi = edi ^ keys[1];
+        ebp = ebp ^ keys[0];
         ebx = ebx ^ edi;
-        *(uint32_t *) &data[edx] = LE32(ebp);
-        *(uint32_t *) &data[edx+4] = LE32(ebx);
+        *(uint32_t *) &dst[edx] = LE32(ebp);
+        *(uint32_t *) &dst[edx+4] = LE32(ebx);
         edx = edx+8;
     }
+
+    // A partial block at the end is padded out with zeroes.
+    if (edx < length)
+    {
+        memset(last, 0, sizeof(last));
+        memcpy(last, &src[edx], length - edx);
+        CRYPT_BB_DecryptBlocks(keys, last, last, 8);
+        memcpy(&dst[edx], last, length - edx);
+    }
 }
 
 
-void CRYPT_BB_Encrypt(CRYPT_SETUP *pcry, void *vdata, uint32_t length)
+static void CRYPT_BB_EncryptBlocks(const uint32_t *keys, void *vdst,
+                                   const void *vsrc, unsigned long length)
 {
-    unsigned char *data = (unsigned char *)vdata;
-    uint32_t eax, ecx, edx, ebx, ebp, esi, edi, tmp;
+    unsigned char *dst = (unsigned char *)vdst;
+    const unsigned char *src = (const unsigned char *)vsrc;
+    unsigned char last[8];
+    uint32_t ebx, ebp, esi, edi, tmp;
+    unsigned long edx;
 
     edx = 0;
-    ecx = 0;
-    eax = 0;
-    while (edx < length)
+    while (edx + 8 <= length)
     {
-        ebx = *(uint32_t *) &data[edx];
+        ebx = *(const uint32_t *) &src[edx];
         ebx = LE32(ebx);
-        ebx = ebx ^ pcry->keys[0];
-        ebp = ((pcry->keys[(ebx >> 0x18) + 0x12]+pcry->keys[((ebx >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebx >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebx & 0xff) + 0x312];
-        ebp = ebp ^ pcry->keys[1];
-        tmp = *(uint32_t *) &data[edx+4];
+        ebx = ebx ^ keys[0];
+        ebp = ((keys[(ebx >> 0x18) + 0x12]+keys[((ebx >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebx >> 0x8)& 0xff) + 0x212]) + keys[(ebx & 0xff) + 0x312];
+        ebp = ebp ^ keys[1];
+        tmp = *(const uint32_t *) &src[edx+4];
         ebp ^= LE32(tmp);
-        edi = ((pcry->keys[(ebp >> 0x18) + 0x12]+pcry->keys[((ebp >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebp >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebp & 0xff) + 0x312];
-        edi = edi ^ pcry->keys[2];
+        edi = ((keys[(ebp >> 0x18) + 0x12]+keys[((ebp >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebp >> 0x8)& 0xff) + 0x212]) + keys[(ebp & 0xff) + 0x312];
+        edi = edi ^ keys[2];
         ebx = ebx ^ edi;
-        esi = ((pcry->keys[(ebx >> 0x18) + 0x12]+pcry->keys[((ebx >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebx >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebx & 0xff) + 0x312];
-        ebp = ebp ^ esi ^ pcry->keys[3];
-        edi = ((pcry->keys[(ebp >> 0x18) + 0x12]+pcry->keys[((ebp >> 0x10)& 0xff) + 0x112])
-               ^ pcry->keys[((ebp >> 0x8)& 0xff) + 0x212]) + pcry->keys[(ebp & 0xff) + 0x312];
-        edi = edi ^ pcry->keys[4];
-        ebp = ebp ^ pcry->keys[5];
+        esi = ((keys[(ebx >> 0x18) + 0x12]+keys[((ebx >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebx >> 0x8)& 0xff) + 0x212]) + keys[(ebx & 0xff) + 0x312];
+        ebp = ebp ^ esi ^ keys[3];
+        edi = ((keys[(ebp >> 0x18) + 0x12]+keys[((ebp >> 0x10)& 0xff) + 0x112])
+               ^ keys[((ebp >> 0x8)& 0xff) + 0x212]) + keys[(ebp & 0xff) + 0x312];
+        edi = edi ^ keys[4];
+        ebp = ebp ^ keys[5];
         ebx = ebx ^ edi;
-        *(uint32_t *) &data[edx] = LE32(ebp);
-        *(uint32_t *) &data[edx+4] = LE32(ebx);
+        *(uint32_t *) &dst[edx] = LE32(ebp);
+        *(uint32_t *) &dst[edx+4] = LE32(ebx);
         edx = edx+8;
     }
+
+    // A partial block at the end is padded out with zeroes.
+    if (edx < length)
+    {
+        memset(last, 0, sizeof(last));
+        memcpy(last, &src[edx], length - edx);
+        CRYPT_BB_EncryptBlocks(keys, last, last, 8);
+        memcpy(&dst[edx], last, length - edx);
+    }
+}
+
+void CRYPT_BB_Decrypt(CRYPT_SETUP *pcry, void *vdata, unsigned long length)
+{
+    CRYPT_BB_DecryptBlocks(pcry->keys, vdata, vdata, length);
+}
+
+void CRYPT_BB_Encrypt(CRYPT_SETUP *pcry, void *vdata, unsigned long length)
+{
+    CRYPT_BB_EncryptBlocks(pcry->keys, vdata, vdata, length);
+}
+
+void CRYPT_BB_DecryptTo(CRYPT_SETUP *pcry, void *dst, const void *src,
+                        unsigned long length)
+{
+    CRYPT_BB_DecryptBlocks(pcry->keys, dst, src, length);
+}
+
+void CRYPT_BB_EncryptTo(CRYPT_SETUP *pcry, void *dst, const void *src,
+                        unsigned long length)
+{
+    CRYPT_BB_EncryptBlocks(pcry->keys, dst, src, length);
+}
+
+const CRYPT_OPS CRYPT_BB_Ops = {
+    { CRYPT_BB_Decrypt, CRYPT_BB_Encrypt },
+    { CRYPT_BB_DecryptTo, CRYPT_BB_EncryptTo }
+};
+
+// Batched encryption. Every 8-byte block is independent of the others, so the
+// blocks of all Blue Burst buffers in a batch are spread out over a set of
+// lanes (one session/block pair per lane) and the rounds for the whole set are
+// done together. With AVX2, the S-box and P-array lookups for all eight lanes
+// are done with gathers relative to the first lane's key table. Lanes that
+// can't be reached that way and leftover blocks go through the normal code.
+
+#define BB_LANES 8
+
+#ifdef CRYPT_BB_HAVE_AVX2
+static pthread_once_t bb_avx2_once = PTHREAD_ONCE_INIT;
+static int bb_avx2;
+
+static void CRYPT_BB_CheckCPU(void)
+{
+    __builtin_cpu_init();
+    bb_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+}
+
+static int CRYPT_BB_HaveAVX2(void)
+{
+    pthread_once(&bb_avx2_once, &CRYPT_BB_CheckCPU);
+    return bb_avx2;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i CRYPT_BB_GatherAVX2(const int *base, __m256i offs,
+                                          __m256i v, int shift, int table)
+{
+    __m256i idx = _mm256_and_si256(_mm256_srli_epi32(v, shift),
+                                   _mm256_set1_epi32(0xFF));
+    idx = _mm256_slli_epi32(_mm256_add_epi32(idx, _mm256_set1_epi32(table)), 2);
+    return _mm256_i32gather_epi32(base, _mm256_add_epi32(offs, idx), 1);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i CRYPT_BB_RoundAVX2(const int *base, __m256i offs,
+                                         __m256i v)
+{
+    __m256i a, b, c, d;
+    a = CRYPT_BB_GatherAVX2(base, offs, v, 24, 0x12);
+    b = CRYPT_BB_GatherAVX2(base, offs, v, 16, 0x112);
+    c = CRYPT_BB_GatherAVX2(base, offs, v, 8, 0x212);
+    d = CRYPT_BB_GatherAVX2(base, offs, v, 0, 0x312);
+    return _mm256_add_epi32(_mm256_xor_si256(_mm256_add_epi32(a, b), c), d);
+}
+
+// Returns 0 without touching anything if any of the lanes' key tables are too
+// far away from the first one to be reached with a 32-bit gather offset.
+__attribute__((target("avx2")))
+static int CRYPT_BB_CryptLanesAVX2(CRYPT_SETUP **cs, uint8_t **blk,
+                                   int encrypting)
+{
+    const char *base = (const char *)cs[0]->keys;
+    int32_t off[BB_LANES];
+    uint32_t l[BB_LANES], r[BB_LANES];
+    __m256i offs, ebx, ebp, esi, edi, p[6];
+    intptr_t d;
+    int x;
+
+    for (x = 0; x < BB_LANES; x++)
+    {
+        d = (intptr_t)cs[x]->keys - (intptr_t)base;
+        if (d < INT32_MIN || d > INT32_MAX - (intptr_t)sizeof(cs[x]->keys))
+            return 0;
+        off[x] = (int32_t)d;
+        memcpy(&l[x], blk[x], 4);
+        memcpy(&r[x], blk[x] + 4, 4);
+    }
+
+    offs = _mm256_loadu_si256((const __m256i *)off);
+    for (x = 0; x < 6; x++)
+    {
+        p[x] = _mm256_i32gather_epi32((const int *)base,
+                                      _mm256_add_epi32(offs,
+                                      _mm256_set1_epi32((encrypting ? x : 5 - x) * 4)), 1);
+    }
+
+    ebx = _mm256_loadu_si256((const __m256i *)l);
+    ebx = _mm256_xor_si256(ebx, p[0]);
+    ebp = CRYPT_BB_RoundAVX2((const int *)base, offs, ebx);
+    ebp = _mm256_xor_si256(ebp, p[1]);
+    ebp = _mm256_xor_si256(ebp, _mm256_loadu_si256((const __m256i *)r));
+    edi = CRYPT_BB_RoundAVX2((const int *)base, offs, ebp);
+    edi = _mm256_xor_si256(edi, p[2]);
+    ebx = _mm256_xor_si256(ebx, edi);
+    esi = CRYPT_BB_RoundAVX2((const int *)base, offs, ebx);
+    ebp = _mm256_xor_si256(_mm256_xor_si256(ebp, esi), p[3]);
+    edi = CRYPT_BB_RoundAVX2((const int *)base, offs, ebp);
+    edi = _mm256_xor_si256(edi, p[4]);
+    ebp = _mm256_xor_si256(ebp, p[5]);
+    ebx = _mm256_xor_si256(ebx, edi);
+
+    _mm256_storeu_si256((__m256i *)l, ebp);
+    _mm256_storeu_si256((__m256i *)r, ebx);
+    for (x = 0; x < BB_LANES; x++)
+    {
+        memcpy(blk[x], &l[x], 4);
+        memcpy(blk[x] + 4, &r[x], 4);
+    }
+    return 1;
+}
+#endif
+
+static void CRYPT_BB_CryptLanes(CRYPT_SETUP **cs, uint8_t **blk, int count,
+                                int encrypting)
+{
+    int x;
+
+#ifdef CRYPT_BB_HAVE_AVX2
+    if (count == BB_LANES && CRYPT_BB_HaveAVX2() &&
+        CRYPT_BB_CryptLanesAVX2(cs, blk, encrypting))
+        return;
+#endif
+
+    for (x = 0; x < count; x++)
+    {
+        if (encrypting) CRYPT_BB_Encrypt(cs[x], blk[x], 8);
+        else CRYPT_BB_Decrypt(cs[x], blk[x], 8);
+    }
+}
+
+void CRYPT_BB_CryptBatch(CRYPT_BATCH *batch, unsigned long count,
+                         int encrypting)
+{
+    CRYPT_SETUP *cs[BB_LANES];
+    uint8_t *blk[BB_LANES];
+    unsigned long x, off;
+    int lanes = 0;
+
+    for (x = 0; x < count; x++)
+    {
+        if (batch[x].cs->type != CRYPT_BLUEBURST)
+            continue;
+
+        for (off = 0; off + 8 <= batch[x].size; off += 8)
+        {
+            cs[lanes] = batch[x].cs;
+            blk[lanes] = (uint8_t *)batch[x].data + off;
+            if (++lanes == BB_LANES)
+            {
+                CRYPT_BB_CryptLanes(cs, blk, lanes, encrypting);
+                lanes = 0;
+            }
+        }
+
+        if (off < batch[x].size)
+        {
+            if (encrypting)
+                CRYPT_BB_Encrypt(batch[x].cs, (uint8_t *)batch[x].data + off,
+                                 batch[x].size - off);
+            else
+                CRYPT_BB_Decrypt(batch[x].cs, (uint8_t *)batch[x].data + off,
+                                 batch[x].size - off);
+        }
+    }
+
+    if (lanes)
+        CRYPT_BB_CryptLanes(cs, blk, lanes, encrypting);
 }
 
+int CRYPT_BB_CacheLookup(const void *seed, uint32_t *keys);
+void CRYPT_BB_CacheStore(const void *seed, const uint32_t *keys);
+
 void L_CRYPT_BB_InitKey(unsigned char *data)
 {
     unsigned x;
@@ -236,36 +458,36 @@ void L_CRYPT_BB_InitKey(unsigned char *data)
     }
 }
 
-void CRYPT_BB_CreateKeys(CRYPT_SETUP *pcry, void *salt)
+static void CRYPT_BB_BuildTable(uint32_t *keys, const void *salt)
 {
     uint32_t eax, ecx, edx, ebx, ebp, esi, edi, ou, x;
     unsigned char s[48];
 
-    pcry->bb_posn = 0;
+    if (CRYPT_BB_CacheLookup(salt, keys))
+        return;
 
-    memcpy(pcry->bb_seed,salt,48);
     memcpy(s, salt, sizeof(s));
     L_CRYPT_BB_InitKey(s);
 
-    pcry->keys[0] = 0x243F6A88;
-    pcry->keys[1] = 0x85A308D3;
-    pcry->keys[2] = 0x13198A2E;
-    pcry->keys[3] = 0x03707344;
-    pcry->keys[4] = 0xA4093822;
-    pcry->keys[5] = 0x299F31D0;
-    pcry->keys[6] = 0x082EFA98;
-    pcry->keys[7] = 0xEC4E6C89;
-    pcry->keys[8] = 0x452821E6;
-    pcry->keys[9] = 0x38D01377;
-    pcry->keys[10] = 0xBE5466CF;
-    pcry->keys[11] = 0x34E90C6C;
-    pcry->keys[12] = 0xC0AC29B7;
-    pcry->keys[13] = 0xC97C50DD;
-    pcry->keys[14] = 0x3F84D5B5;
-    pcry->keys[15] = 0xB5470917;
-    pcry->keys[16] = 0x9216D5D9;
-    pcry->keys[17] = 0x8979FB1B;
-    memcpy(&pcry->keys[18], bbtable, sizeof(bbtable));
+    keys[0] = 0x243F6A88;
+    keys[1] = 0x85A308D3;
+    keys[2] = 0x13198A2E;
+    keys[3] = 0x03707344;
+    keys[4] = 0xA4093822;
+    keys[5] = 0x299F31D0;
+    keys[6] = 0x082EFA98;
+    keys[7] = 0xEC4E6C89;
+    keys[8] = 0x452821E6;
+    keys[9] = 0x38D01377;
+    keys[10] = 0xBE5466CF;
+    keys[11] = 0x34E90C6C;
+    keys[12] = 0xC0AC29B7;
+    keys[13] = 0xC97C50DD;
+    keys[14] = 0x3F84D5B5;
+    keys[15] = 0xB5470917;
+    keys[16] = 0x9216D5D9;
+    keys[17] = 0x8979FB1B;
+    memcpy(&keys[18], bbtable, sizeof(bbtable));
 
     ecx=0;
     ebx=0;
@@ -288,7 +510,7 @@ void CRYPT_BB_CreateKeys(CRYPT_SETUP *pcry, void *salt)
         ebp=ebp | eax;
         eax=ecx;
         edx=eax-((eax / 48)*48);
-        pcry->keys[ebx]=pcry->keys[ebx] ^ ebp;
+        keys[ebx]=keys[ebx] ^ ebp;
         ecx=edx;
         ebx++;
     }
@@ -302,74 +524,74 @@ void CRYPT_BB_CreateKeys(CRYPT_SETUP *pcry, void *salt)
 
     while (edi < edx)
     {
-        esi=esi ^ pcry->keys[0];
+        esi=esi ^ keys[0];
         eax=esi >> 0x18;
         ebx=(esi >> 0x10) & 0xff;
-        eax=pcry->keys[eax+0x12]+pcry->keys[ebx+0x112];
+        eax=keys[eax+0x12]+keys[ebx+0x112];
         ebx=(esi >> 8) & 0xFF;
-        eax=eax ^ pcry->keys[ebx+0x212];
+        eax=eax ^ keys[ebx+0x212];
         ebx=esi & 0xff;
-        eax=eax + pcry->keys[ebx+0x312];
+        eax=eax + keys[ebx+0x312];
         
-        eax=eax ^ pcry->keys[1];
+        eax=eax ^ keys[1];
         ecx= ecx ^ eax;
         ebx=ecx >> 0x18;
         eax=(ecx >> 0x10) & 0xFF;
-        ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+        ebx=keys[ebx+0x12]+keys[eax+0x112];
         eax=(ecx >> 8) & 0xff;
-        ebx=ebx ^ pcry->keys[eax+0x212];
+        ebx=ebx ^ keys[eax+0x212];
         eax=ecx & 0xff;
-        ebx=ebx + pcry->keys[eax+0x312];
+        ebx=ebx + keys[eax+0x312];
         
         for (x = 0; x <= 5; x++)
         {
-            ebx=ebx ^ pcry->keys[(x*2)+2];
+            ebx=ebx ^ keys[(x*2)+2];
             esi= esi ^ ebx;
             ebx=esi >> 0x18;
             eax=(esi >> 0x10) & 0xFF;
-            ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+            ebx=keys[ebx+0x12]+keys[eax+0x112];
             eax=(esi >> 8) & 0xff;
-            ebx=ebx ^ pcry->keys[eax+0x212];
+            ebx=ebx ^ keys[eax+0x212];
             eax=esi & 0xff;
-            ebx=ebx + pcry->keys[eax+0x312];
+            ebx=ebx + keys[eax+0x312];
             
-            ebx=ebx ^ pcry->keys[(x*2)+3];
+            ebx=ebx ^ keys[(x*2)+3];
             ecx= ecx ^ ebx;
             ebx=ecx >> 0x18;
             eax=(ecx >> 0x10) & 0xFF;
-            ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+            ebx=keys[ebx+0x12]+keys[eax+0x112];
             eax=(ecx >> 8) & 0xff;
-            ebx=ebx ^ pcry->keys[eax+0x212];
+            ebx=ebx ^ keys[eax+0x212];
             eax=ecx & 0xff;
-            ebx=ebx + pcry->keys[eax+0x312];
+            ebx=ebx + keys[eax+0x312];
         }
         
-        ebx=ebx ^ pcry->keys[14];
+        ebx=ebx ^ keys[14];
         esi= esi ^ ebx;
         eax=esi >> 0x18;
         ebx=(esi >> 0x10) & 0xFF;
-        eax=pcry->keys[eax+0x12]+pcry->keys[ebx+0x112];
+        eax=keys[eax+0x12]+keys[ebx+0x112];
         ebx=(esi >> 8) & 0xff;
-        eax=eax ^ pcry->keys[ebx+0x212];
+        eax=eax ^ keys[ebx+0x212];
         ebx=esi & 0xff;
-        eax=eax + pcry->keys[ebx+0x312];
+        eax=eax + keys[ebx+0x312];
         
-        eax=eax ^ pcry->keys[15];
+        eax=eax ^ keys[15];
         eax= ecx ^ eax;
         ecx=eax >> 0x18;
         ebx=(eax >> 0x10) & 0xFF;
-        ecx=pcry->keys[ecx+0x12]+pcry->keys[ebx+0x112];
+        ecx=keys[ecx+0x12]+keys[ebx+0x112];
         ebx=(eax >> 8) & 0xff;
-        ecx=ecx ^ pcry->keys[ebx+0x212];
+        ecx=ecx ^ keys[ebx+0x212];
         ebx=eax & 0xff;
-        ecx=ecx + pcry->keys[ebx+0x312];
+        ecx=ecx + keys[ebx+0x312];
         
-        ecx=ecx ^ pcry->keys[16];
+        ecx=ecx ^ keys[16];
         ecx=ecx ^ esi;
-        esi= pcry->keys[17];
+        esi= keys[17];
         esi=esi ^ eax;
-        pcry->keys[(edi / 4)]=esi;
-        pcry->keys[(edi / 4)+1]=ecx;
+        keys[(edi / 4)]=esi;
+        keys[(edi / 4)+1]=ecx;
         edi=edi+8;
     }
 
@@ -384,78 +606,100 @@ void CRYPT_BB_CreateKeys(CRYPT_SETUP *pcry, void *salt)
         
         while (edi < edx)
         {
-            esi=esi ^ pcry->keys[0];
+            esi=esi ^ keys[0];
             eax=esi >> 0x18;
             ebx=(esi >> 0x10) & 0xff;
-            eax=pcry->keys[eax+0x12]+pcry->keys[ebx+0x112];
+            eax=keys[eax+0x12]+keys[ebx+0x112];
             ebx=(esi >> 8) & 0xFF;
-            eax=eax ^ pcry->keys[ebx+0x212];
+            eax=eax ^ keys[ebx+0x212];
             ebx=esi & 0xff;
-            eax=eax + pcry->keys[ebx+0x312];
+            eax=eax + keys[ebx+0x312];
             
-            eax=eax ^ pcry->keys[1];
+            eax=eax ^ keys[1];
             ecx= ecx ^ eax;
             ebx=ecx >> 0x18;
             eax=(ecx >> 0x10) & 0xFF;
-            ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+            ebx=keys[ebx+0x12]+keys[eax+0x112];
             eax=(ecx >> 8) & 0xff;
-            ebx=ebx ^ pcry->keys[eax+0x212];
+            ebx=ebx ^ keys[eax+0x212];
             eax=ecx & 0xff;
-            ebx=ebx + pcry->keys[eax+0x312];
+            ebx=ebx + keys[eax+0x312];
             
             for (x = 0; x <= 5; x++)
             {
-                ebx=ebx ^ pcry->keys[(x*2)+2];
+                ebx=ebx ^ keys[(x*2)+2];
                 esi= esi ^ ebx;
                 ebx=esi >> 0x18;
                 eax=(esi >> 0x10) & 0xFF;
-                ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+                ebx=keys[ebx+0x12]+keys[eax+0x112];
                 eax=(esi >> 8) & 0xff;
-                ebx=ebx ^ pcry->keys[eax+0x212];
+                ebx=ebx ^ keys[eax+0x212];
                 eax=esi & 0xff;
-                ebx=ebx + pcry->keys[eax+0x312];
+                ebx=ebx + keys[eax+0x312];
                 
-                ebx=ebx ^ pcry->keys[(x*2)+3];
+                ebx=ebx ^ keys[(x*2)+3];
                 ecx= ecx ^ ebx;
                 ebx=ecx >> 0x18;
                 eax=(ecx >> 0x10) & 0xFF;
-                ebx=pcry->keys[ebx+0x12]+pcry->keys[eax+0x112];
+                ebx=keys[ebx+0x12]+keys[eax+0x112];
                 eax=(ecx >> 8) & 0xff;
-                ebx=ebx ^ pcry->keys[eax+0x212];
+                ebx=ebx ^ keys[eax+0x212];
                 eax=ecx & 0xff;
-                ebx=ebx + pcry->keys[eax+0x312];
+                ebx=ebx + keys[eax+0x312];
             }
             
-            ebx=ebx ^ pcry->keys[14];
+            ebx=ebx ^ keys[14];
             esi= esi ^ ebx;
             eax=esi >> 0x18;
             ebx=(esi >> 0x10) & 0xFF;
-            eax=pcry->keys[eax+0x12]+pcry->keys[ebx+0x112];
+            eax=keys[eax+0x12]+keys[ebx+0x112];
             ebx=(esi >> 8) & 0xff;
-            eax=eax ^ pcry->keys[ebx+0x212];
+            eax=eax ^ keys[ebx+0x212];
             ebx=esi & 0xff;
-            eax=eax + pcry->keys[ebx+0x312];
+            eax=eax + keys[ebx+0x312];
             
-            eax=eax ^ pcry->keys[15];
+            eax=eax ^ keys[15];
             eax= ecx ^ eax;
             ecx=eax >> 0x18;
             ebx=(eax >> 0x10) & 0xFF;
-            ecx=pcry->keys[ecx+0x12]+pcry->keys[ebx+0x112];
+            ecx=keys[ecx+0x12]+keys[ebx+0x112];
             ebx=(eax >> 8) & 0xff;
-            ecx=ecx ^ pcry->keys[ebx+0x212];
+            ecx=ecx ^ keys[ebx+0x212];
             ebx=eax & 0xff;
-            ecx=ecx + pcry->keys[ebx+0x312];
+            ecx=ecx + keys[ebx+0x312];
             
-            ecx=ecx ^ pcry->keys[16];
+            ecx=ecx ^ keys[16];
             ecx=ecx ^ esi;
-            esi= pcry->keys[17];
+            esi= keys[17];
             esi=esi ^ eax;
-            pcry->keys[(ou / 4)+(edi / 4)]=esi;
-            pcry->keys[(ou / 4)+(edi / 4)+1]=ecx;
+            keys[(ou / 4)+(edi / 4)]=esi;
+            keys[(ou / 4)+(edi / 4)+1]=ecx;
             edi=edi+8;
         }
         ou=ou+0x400;
     }
+
+    CRYPT_BB_CacheStore(salt, keys);
+}
+
+void CRYPT_BB_CreateKeys(CRYPT_SETUP *pcry, void *salt)
+{
+    pcry->bb_posn = 0;
+    memcpy(pcry->bb_seed,salt,48);
+    CRYPT_BB_BuildTable(pcry->keys, salt);
+}
+
+void CRYPT_BB_CreateState(CRYPT_BB_STATE *st, const void *seed)
+{
+    memcpy(st->seed, seed, sizeof(st->seed));
+    CRYPT_BB_BuildTable(st->keys, seed);
+}
+
+void CRYPT_BB_CryptState(CRYPT_BB_STATE *st, void *data, unsigned long size,
+                         int encrypting)
+{
+    if (encrypting) CRYPT_BB_EncryptBlocks(st->keys, data, data, size);
+    else CRYPT_BB_DecryptBlocks(st->keys, data, data, size);
 }
 
 void CRYPT_BB_DEBUG_PrintKeys(CRYPT_SETUP *cs,char *title)
@@ -4,65 +4,52 @@
 
 #include <stdio.h>
 #include "sylverant/encryption.h"
-
-#if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
-#define LE32(x) (((x >> 24) & 0x00FF) | \
-                 ((x >>  8) & 0xFF00) | \
-                 ((x & 0xFF00) <<  8) | \
-                 ((x & 0x00FF) << 24))
-#else
-#define LE32(x) x
-#endif
+#include "crypt-xor.h"
 
 ////////////////////////////////////////////////////////////////////////////////
 // GameCube Encryption Source 
 
-void CRYPT_GC_MixKeys(CRYPT_SETUP* cs)
+// The cipher itself only works on the key table and position (the index of
+// the last key used), so that both CRYPT_SETUP and the smaller CRYPT_GC_STATE
+// can use it.
+
+static void CRYPT_GC_MixTable(uint32_t* keys)
 {
-    uint32_t r0,r4,*r5,*r6,*r7;
+    uint32_t r0,r4,*r5,*r6,*r7,*end;
 
-    cs->gc_block_ptr = cs->keys;
-    r5 = cs->keys;
-    r6 = &(cs->keys[489]);
-    r7 = cs->keys;
+    end = &keys[521];
+    r5 = keys;
+    r6 = &keys[489];
+    r7 = keys;
 
-    while (r6 != cs->gc_block_end_ptr)
+    while (r6 != end)
     {
-        r0 = *(uint32_t*)r6;
+        r0 = *r6;
         r6++;
-        r4 = *(uint32_t*)r5;
+        r4 = *r5;
         r0 ^= r4;
-        *(uint32_t*)r5 = r0;
+        *r5 = r0;
         r5++;
     }
 
-    while (r5 != cs->gc_block_end_ptr)
+    while (r5 != end)
     {
-        r0 = *(uint32_t*)r7;
+        r0 = *r7;
         r7++;
-        r4 = *(uint32_t*)r5;
+        r4 = *r5;
         r0 ^= r4;
-        *(uint32_t*)r5 = r0;
+        *r5 = r0;
         r5++;
     }
 }
 
-unsigned long CRYPT_GC_GetNextKey(CRYPT_SETUP* cs)
+static void CRYPT_GC_BuildTable(uint32_t* keys, uint32_t seed)
 {
-    cs->gc_block_ptr++;
-    if (cs->gc_block_ptr == cs->gc_block_end_ptr) CRYPT_GC_MixKeys(cs);
-    return *cs->gc_block_ptr;
-}
-
-void CRYPT_GC_CreateKeys(CRYPT_SETUP* cs,uint32_t seed)
-{
-    uint32_t x,y,basekey,*source1,*source2,*source3;
+    uint32_t x,y,basekey,*ptr,*end,*source1,*source2,*source3;
     basekey = 0;
 
-    cs->gc_seed = seed;
-
-    cs->gc_block_end_ptr = &(cs->keys[521]);
-    cs->gc_block_ptr = (uint32_t*)cs->keys;
+    end = &keys[521];
+    ptr = keys;
 
     for  (x = 0; x <= 16; x++)
     {
@@ -74,43 +61,139 @@ void CRYPT_GC_CreateKeys(CRYPT_SETUP* cs,uint32_t seed)
             if (seed & 0x80000000) basekey = basekey | 0x80000000;
             else basekey = basekey & 0x7FFFFFFF;
         }
-        *cs->gc_block_ptr = basekey;
-        cs->gc_block_ptr = (uint32_t*)((uint8_t*)cs->gc_block_ptr + 4);
+        *ptr++ = basekey;
     }
-    source1 = &(cs->keys[0]);
-    source2 = &(cs->keys[1]);
-    cs->gc_block_ptr = (uint32_t*)((uint8_t*)cs->gc_block_ptr - 4);
-    (*cs->gc_block_ptr) = (((cs->keys[0] >> 9) ^ (*cs->gc_block_ptr << 23)) ^ cs->keys[15]);//cs->keys[15]);
-    source3 = cs->gc_block_ptr;
-    cs->gc_block_ptr = (uint32_t*)((uint8_t*)cs->gc_block_ptr + 4);
-    while (cs->gc_block_ptr != cs->gc_block_end_ptr)
+    source1 = &keys[0];
+    source2 = &keys[1];
+    ptr--;
+    *ptr = (((keys[0] >> 9) ^ (*ptr << 23)) ^ keys[15]);
+    source3 = ptr++;
+    while (ptr != end)
     {
-        *cs->gc_block_ptr = (*source3 ^ (((*source1 << 23) & 0xFF800000) ^ ((*source2 >> 9) & 0x007FFFFF)));
-        cs->gc_block_ptr = (uint32_t*)((uint8_t*)(cs->gc_block_ptr) + 4);
-        source1 = (uint32_t*)((uint8_t*)source1 + 4);
-        source2 = (uint32_t*)((uint8_t*)source2 + 4);
-        source3 = (uint32_t*)((uint8_t*)source3 + 4);
+        *ptr++ = (*source3++ ^ (((*source1++ << 23) & 0xFF800000) ^
+                                ((*source2++ >> 9) & 0x007FFFFF)));
     }
-    CRYPT_GC_MixKeys(cs);
-    CRYPT_GC_MixKeys(cs);
-    CRYPT_GC_MixKeys(cs);
-    cs->gc_block_ptr = &(cs->keys[520]);
+    CRYPT_GC_MixTable(keys);
+    CRYPT_GC_MixTable(keys);
+    CRYPT_GC_MixTable(keys);
 }
 
-void CRYPT_GC_CryptData(CRYPT_SETUP* c,void* data,unsigned long size)
+// The key stream is the 521-word table itself, freshly mixed each time it runs
+// out, so rather than fetching one key at a time, each pass XORs the data with
+// as much of the current table as is left and only then mixes a new one. A
+// trailing partial word still uses up a whole key.
+static void CRYPT_GC_CryptStream(uint32_t* keys, uint32_t* posn,
+                                 uint32_t* mixes, void* dst, const void* src,
+                                 unsigned long size)
 {
-    uint32_t *address_start,*address_end, tmp;
+    uint8_t *out = (uint8_t*)dst;
+    const uint8_t *in = (const uint8_t*)src;
+    unsigned long words = size >> 2, next, run;
 
-    address_start = (uint32_t*)data;
-    address_end = (uint32_t*)((uint8_t*)data + size);
+    while (words)
+    {
+        next = *posn + 1;
+        if (next == 521)
+        {
+            CRYPT_GC_MixTable(keys);
+            if (mixes) (*mixes)++;
+            next = 0;
+        }
 
-    while (address_start < address_end)
+        run = 521 - next;
+        if (run > words) run = words;
+
+        CRYPT_XorKeys(out, in, &keys[next], run);
+        *posn = next + run - 1;
+        out += run << 2;
+        in += run << 2;
+        words -= run;
+    }
+
+    if (size & 3)
     {
-        tmp = CRYPT_GC_GetNextKey(c);
-        *address_start++ = *address_start ^ LE32(tmp);
+        next = *posn + 1;
+        if (next == 521)
+        {
+            CRYPT_GC_MixTable(keys);
+            if (mixes) (*mixes)++;
+            next = 0;
+        }
+
+        CRYPT_XorPartial(out, in, keys[next], size & 3);
+        *posn = next;
     }
 }
 
+// Undoes one CRYPT_GC_MixTable, for rolling back to a snapshot.
+static void CRYPT_GC_UnmixTable(uint32_t* keys)
+{
+    uint32_t x;
+
+    for (x = 520; x >= 32; x--) keys[x] ^= keys[x - 32];
+    for (x = 32; x > 0; x--) keys[x - 1] ^= keys[x + 488];
+}
+
+void CRYPT_GC_MixKeys(CRYPT_SETUP* cs)
+{
+    CRYPT_GC_MixTable(cs->keys);
+    cs->gc_block_ptr = cs->keys;
+    cs->mix_count++;
+}
+
+void CRYPT_GC_UnmixKeys(CRYPT_SETUP* cs)
+{
+    CRYPT_GC_UnmixTable(cs->keys);
+    cs->mix_count--;
+}
+
+unsigned long CRYPT_GC_GetNextKey(CRYPT_SETUP* cs)
+{
+    cs->gc_block_ptr++;
+    if (cs->gc_block_ptr == cs->gc_block_end_ptr) CRYPT_GC_MixKeys(cs);
+    return *cs->gc_block_ptr;
+}
+
+void CRYPT_GC_CreateKeys(CRYPT_SETUP* cs,uint32_t seed)
+{
+    cs->gc_seed = seed;
+    CRYPT_GC_BuildTable(cs->keys, seed);
+    cs->gc_block_end_ptr = &(cs->keys[521]);
+    cs->gc_block_ptr = &(cs->keys[520]);
+    cs->mix_count = 0;
+}
+
+void CRYPT_GC_CryptDataTo(CRYPT_SETUP* c,void* dst,const void* src,
+                          unsigned long size)
+{
+    uint32_t posn = c->gc_block_ptr - c->keys;
+
+    CRYPT_GC_CryptStream(c->keys, &posn, &c->mix_count, dst, src, size);
+    c->gc_block_ptr = &c->keys[posn];
+}
+
+void CRYPT_GC_CryptData(CRYPT_SETUP* c,void* data,unsigned long size)
+{
+    CRYPT_GC_CryptDataTo(c, data, data, size);
+}
+
+const CRYPT_OPS CRYPT_GC_Ops = {
+    { CRYPT_GC_CryptData, CRYPT_GC_CryptData },
+    { CRYPT_GC_CryptDataTo, CRYPT_GC_CryptDataTo }
+};
+
+void CRYPT_GC_CreateState(CRYPT_GC_STATE* st, uint32_t seed)
+{
+    st->seed = seed;
+    CRYPT_GC_BuildTable(st->keys, seed);
+    st->posn = 520;
+}
+
+void CRYPT_GC_CryptState(CRYPT_GC_STATE* st, void* data, unsigned long size)
+{
+    CRYPT_GC_CryptStream(st->keys, &st->posn, NULL, data, data, size);
+}
+
 void CRYPT_GC_DEBUG_PrintKeys(CRYPT_SETUP* cs,char* title)
 {
     uint32_t x,y;
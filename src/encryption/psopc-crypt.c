@@ -1,16 +1,11 @@
 #include <stdio.h>
 #include "sylverant/encryption.h"
+#include "crypt-xor.h"
 
-#if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
-#define LE32(x) (((x >> 24) & 0x00FF) | \
-                 ((x >>  8) & 0xFF00) | \
-                 ((x & 0xFF00) <<  8) | \
-                 ((x & 0x00FF) << 24))
-#else
-#define LE32(x) x
-#endif
+// The cipher itself only works on the key table and position, so that both
+// CRYPT_SETUP and the smaller CRYPT_PC_STATE can use it.
 
-void CRYPT_PC_MixKeys(CRYPT_SETUP* pc)
+static void CRYPT_PC_MixTable(uint32_t* keys)
 {
     uint32_t esi,edi,eax,ebp,edx;
     edi = 1;
@@ -18,10 +13,10 @@ void CRYPT_PC_MixKeys(CRYPT_SETUP* pc)
     eax = edi;
     while (edx > 0)
     {
-        esi = pc->keys[eax + 0x1F];
-        ebp = pc->keys[eax];
+        esi = keys[eax + 0x1F];
+        ebp = keys[eax];
         ebp = ebp - esi;
-        pc->keys[eax] = ebp;
+        keys[eax] = ebp;
         eax++;
         edx--;
     }
@@ -30,23 +25,23 @@ void CRYPT_PC_MixKeys(CRYPT_SETUP* pc)
     eax = edi;
     while (edx > 0)
     {
-        esi = pc->keys[eax - 0x18];
-        ebp = pc->keys[eax];
+        esi = keys[eax - 0x18];
+        ebp = keys[eax];
         ebp = ebp - esi;
-        pc->keys[eax] = ebp;
+        keys[eax] = ebp;
         eax++;
         edx--;
     }
 }
 
-void CRYPT_PC_CreateKeys(CRYPT_SETUP* pc, uint32_t val)
+static void CRYPT_PC_BuildTable(uint32_t* keys, uint32_t val)
 {
     uint32_t esi,ebx,edi,eax,edx,var1;
     esi = 1;
     ebx = val;
     edi = 0x15;
-    pc->keys[56] = ebx;
-    pc->keys[55] = ebx;
+    keys[56] = ebx;
+    keys[55] = ebx;
     while (edi <= 0x46E)
     {
         eax = edi;
@@ -54,38 +49,116 @@ void CRYPT_PC_CreateKeys(CRYPT_SETUP* pc, uint32_t val)
         edx = eax - (var1 * 55);
         ebx = ebx - esi;
         edi = edi + 0x15;
-        pc->keys[edx] = esi;
+        keys[edx] = esi;
         esi = ebx;
-        ebx = pc->keys[edx];
+        ebx = keys[edx];
     }
-    CRYPT_PC_MixKeys(pc);
-    CRYPT_PC_MixKeys(pc);
-    CRYPT_PC_MixKeys(pc);
-    CRYPT_PC_MixKeys(pc);
-    pc->pc_posn = 56;
+    CRYPT_PC_MixTable(keys);
+    CRYPT_PC_MixTable(keys);
+    CRYPT_PC_MixTable(keys);
+    CRYPT_PC_MixTable(keys);
 }
 
-static uint32_t CRYPT_PC_GetNextKey(CRYPT_SETUP* pc)
-{    
-    uint32_t re;
-    if (pc->pc_posn == 56)
+// Words 1 through 55 of the table are the key stream, and the table is only
+// mixed again once they've all been used. Rather than fetching one key at a
+// time, each pass XORs the data with whatever is left of the current table.
+// A trailing partial word still uses up a whole key.
+static void CRYPT_PC_CryptStream(uint32_t* keys, uint32_t* posn,
+                                 uint32_t* mixes, void* dst, const void* src,
+                                 unsigned long size)
+{
+    uint8_t *out = (uint8_t*)dst;
+    const uint8_t *in = (const uint8_t*)src;
+    unsigned long words = size >> 2, run;
+
+    while (words)
     {
-        CRYPT_PC_MixKeys(pc);
-        pc->pc_posn = 1;
+        if (*posn == 56)
+        {
+            CRYPT_PC_MixTable(keys);
+            if (mixes) (*mixes)++;
+            *posn = 1;
+        }
+
+        run = 56 - *posn;
+        if (run > words) run = words;
+
+        CRYPT_XorKeys(out, in, &keys[*posn], run);
+        *posn += run;
+        out += run << 2;
+        in += run << 2;
+        words -= run;
     }
-    re = pc->keys[pc->pc_posn];
-    pc->pc_posn++;
-    return re;
+
+    if (size & 3)
+    {
+        if (*posn == 56)
+        {
+            CRYPT_PC_MixTable(keys);
+            if (mixes) (*mixes)++;
+            *posn = 1;
+        }
+
+        CRYPT_XorPartial(out, in, keys[(*posn)++], size & 3);
+    }
+}
+
+// Undoes one CRYPT_PC_MixTable, for rolling back to a snapshot.
+static void CRYPT_PC_UnmixTable(uint32_t* keys)
+{
+    uint32_t x;
+
+    for (x = 55; x >= 0x19; x--) keys[x] += keys[x - 0x18];
+    for (x = 0x18; x >= 1; x--) keys[x] += keys[x + 0x1F];
+}
+
+void CRYPT_PC_MixKeys(CRYPT_SETUP* pc)
+{
+    CRYPT_PC_MixTable(pc->keys);
+    pc->mix_count++;
+}
+
+void CRYPT_PC_UnmixKeys(CRYPT_SETUP* pc)
+{
+    CRYPT_PC_UnmixTable(pc->keys);
+    pc->mix_count--;
+}
+
+void CRYPT_PC_CreateKeys(CRYPT_SETUP* pc, uint32_t val)
+{
+    CRYPT_PC_BuildTable(pc->keys, val);
+    pc->pc_posn = 56;
+    pc->mix_count = 0;
 }
 
 void CRYPT_PC_CryptData(CRYPT_SETUP* pc,void* data,unsigned long size)
 {
-    uint32_t x, tmp;
-    for (x = 0; x < size; x += 4) {
-        tmp = *((uint32_t *)(data + x));
-        tmp = LE32(tmp) ^ CRYPT_PC_GetNextKey(pc);
-        *((uint32_t *)(data + x)) = LE32(tmp);
-    }
+    CRYPT_PC_CryptStream(pc->keys, &pc->pc_posn, &pc->mix_count,
+                         data, data, size);
+}
+
+void CRYPT_PC_CryptDataTo(CRYPT_SETUP* pc,void* dst,const void* src,
+                          unsigned long size)
+{
+    CRYPT_PC_CryptStream(pc->keys, &pc->pc_posn, &pc->mix_count,
+                         dst, src, size);
+}
+
+const CRYPT_OPS CRYPT_PC_Ops = {
+    { CRYPT_PC_CryptData, CRYPT_PC_CryptData },
+    { CRYPT_PC_CryptDataTo, CRYPT_PC_CryptDataTo }
+};
+
+void CRYPT_PC_CreateState(CRYPT_PC_STATE* st, uint32_t seed)
+{
+    st->keys[0] = 0;
+    CRYPT_PC_BuildTable(st->keys, seed);
+    st->posn = 56;
+}
+
+void CRYPT_PC_CryptState(CRYPT_PC_STATE* st, void* data, unsigned long size)
+{
+    CRYPT_PC_CryptStream(st->keys, &st->posn, NULL, data, data, size);
 }
 
 void CRYPT_PC_DEBUG_PrintKeys(CRYPT_SETUP* cs,char* title)
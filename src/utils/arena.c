@@ -0,0 +1,144 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sylverant/memory.h"
+
+#define ARENA_DEFAULT   16384
+
+/* Chunks past the first one, which is part of the arena object itself. */
+typedef struct arena_chunk {
+    struct arena_chunk *next;
+    size_t pad;
+    uint8_t data[];
+} arena_chunk_t;
+
+struct sylverant_arena {
+    arena_chunk_t *chunks;              /* Extra chunks, newest first */
+    uint8_t *ptr;                       /* Next free byte in current chunk */
+    uint8_t *end;
+    size_t chunk_size;
+    size_t used;
+    uint8_t first[];
+};
+
+static void arena_dtor(void *d) {
+    sylverant_arena_t *a = (sylverant_arena_t *)d;
+    arena_chunk_t *c, *next;
+
+    for(c = a->chunks; c; c = next) {
+        next = c->next;
+        free(c);
+    }
+}
+
+sylverant_arena_t *arena_create(size_t size) {
+    sylverant_arena_t *a;
+
+    if(!size)
+        size = ARENA_DEFAULT;
+
+    if(!(a = (sylverant_arena_t *)ref_alloc_tagged(sizeof(sylverant_arena_t) +
+                                                   size, &arena_dtor,
+                                                   "arena")))
+        return NULL;
+
+    a->chunks = NULL;
+    a->ptr = a->first;
+    a->end = a->first + size;
+    a->chunk_size = size < ARENA_DEFAULT ? ARENA_DEFAULT : size;
+    a->used = 0;
+
+    return a;
+}
+
+static void *arena_get(sylverant_arena_t *a, size_t sz, size_t align) {
+    uintptr_t p = ((uintptr_t)a->ptr + align - 1) & ~(uintptr_t)(align - 1);
+    arena_chunk_t *c;
+    size_t csz;
+
+    /* Start a new chunk if this doesn't fit in the current one. Whatever was
+       left in the old one is just wasted, which is fine, since the only thing
+       that doesn't fit in a fresh chunk is something too big to fit anyway. */
+    if(p > (uintptr_t)a->end || (uintptr_t)a->end - p < sz) {
+        csz = sz + ARENA_ALIGN > a->chunk_size ? sz + ARENA_ALIGN :
+            a->chunk_size;
+
+        if(!(c = (arena_chunk_t *)malloc(sizeof(arena_chunk_t) + csz)))
+            return NULL;
+
+        c->next = a->chunks;
+        a->chunks = c;
+        a->end = c->data + csz;
+        p = ((uintptr_t)c->data + align - 1) & ~(uintptr_t)(align - 1);
+    }
+
+    a->ptr = (uint8_t *)p + sz;
+    a->used += sz;
+    return (void *)p;
+}
+
+void *arena_alloc(sylverant_arena_t *a, size_t sz) {
+    return arena_get(a, ARENA_SIZE(sz), ARENA_ALIGN);
+}
+
+char *arena_strdup(sylverant_arena_t *a, const char *s) {
+    size_t len;
+    char *rv;
+
+    if(!s)
+        return NULL;
+
+    /* Strings don't need to be aligned, so pack them in. */
+    len = strlen(s) + 1;
+
+    if((rv = (char *)arena_get(a, len, 1)))
+        memcpy(rv, s, len);
+
+    return rv;
+}
+
+void *arena_memdup(sylverant_arena_t *a, const void *p, size_t sz) {
+    void *rv;
+
+    if(!p)
+        return NULL;
+
+    if((rv = arena_alloc(a, sz)))
+        memcpy(rv, p, sz);
+
+    return rv;
+}
+
+size_t arena_used(sylverant_arena_t *a) {
+    return a->used;
+}
+
+size_t arena_chunks(sylverant_arena_t *a) {
+    arena_chunk_t *c;
+    size_t rv = 0;
+
+    for(c = a->chunks; c; c = c->next) {
+        ++rv;
+    }
+
+    return rv;
+}
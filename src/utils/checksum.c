@@ -1,7 +1,7 @@
 /*
     This file is part of Sylverant PSO Server.
 
-    Copyright (C) 2009 Lawrence Sebald
+    Copyright (C) 2009, 2026 Lawrence Sebald
 
     This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU Affero General Public License version 3
@@ -16,25 +16,276 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <stddef.h>
+#include <pthread.h>
+
 #include "sylverant/checksum.h"
 
-/* Calculate a CRC32 checksum over a given block of data. Somewhat inspired by
-   the CRC32 function in Figure 14-6 of http://www.hackersdelight.org/crc.pdf */
-uint32_t sylverant_crc32(const uint8_t *data, int size) {
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define HAVE_CRC32_PCLMUL
+#endif
+
+#define CRC32_POLY 0xEDB88320
+
+/* Lookup tables for slicing-by-16. crc32_table[0] is the usual byte at a time
+   table, and crc32_table[k][i] is the CRC of byte i followed by k zero bytes,
+   so that 16 bytes can be folded in with 16 independent lookups. */
+static uint32_t crc32_table[16][256];
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+
+/* crc32_x2n_table[k] is x^(2^k) modulo the CRC polynomial, for combining. */
+static uint32_t crc32_x2n_table[32];
+
+static uint32_t crc32_update_sliced(uint32_t crc, const uint8_t *data,
+                                    size_t size);
+static uint32_t (*crc32_update)(uint32_t crc, const uint8_t *data,
+                                size_t size) = &crc32_update_sliced;
+
+static uint32_t crc32_update_sliced(uint32_t crc, const uint8_t *data,
+                                    size_t size) {
+    uint32_t a, b, c, d;
+
+    while(size >= 16) {
+        /* Assembled a byte at a time so this works on big endian machines
+           too. Compilers turn these into plain loads on little endian. */
+        a = (data[0] | (data[1] << 8) | (data[2] << 16) |
+             ((uint32_t)data[3] << 24)) ^ crc;
+        b = data[4] | (data[5] << 8) | (data[6] << 16) |
+            ((uint32_t)data[7] << 24);
+        c = data[8] | (data[9] << 8) | (data[10] << 16) |
+            ((uint32_t)data[11] << 24);
+        d = data[12] | (data[13] << 8) | (data[14] << 16) |
+            ((uint32_t)data[15] << 24);
+
+        crc = crc32_table[15][a & 0xFF] ^ crc32_table[14][(a >> 8) & 0xFF] ^
+              crc32_table[13][(a >> 16) & 0xFF] ^ crc32_table[12][a >> 24] ^
+              crc32_table[11][b & 0xFF] ^ crc32_table[10][(b >> 8) & 0xFF] ^
+              crc32_table[9][(b >> 16) & 0xFF] ^ crc32_table[8][b >> 24] ^
+              crc32_table[7][c & 0xFF] ^ crc32_table[6][(c >> 8) & 0xFF] ^
+              crc32_table[5][(c >> 16) & 0xFF] ^ crc32_table[4][c >> 24] ^
+              crc32_table[3][d & 0xFF] ^ crc32_table[2][(d >> 8) & 0xFF] ^
+              crc32_table[1][(d >> 16) & 0xFF] ^ crc32_table[0][d >> 24];
+
+        data += 16;
+        size -= 16;
+    }
+
+    while(size--) {
+        crc = crc32_table[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    }
+
+    return crc;
+}
+
+#ifdef HAVE_CRC32_PCLMUL
+/* Folding with carry-less multiplication, as described in Intel's "Fast CRC
+   Computation for Generic Polynomials Using PCLMULQDQ Instruction" paper. The
+   constants are the bit-reflected ones for the CRC32 polynomial from the end
+   of that paper. This needs at least 64 bytes, and works on a multiple of 16
+   bytes, leaving the rest to the table code. */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_fold_pclmul(uint32_t crc, const uint8_t *data,
+                                  size_t size) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01C6E41596, 0x0154442BD4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00CCAA009E, 0x01751997D0);
+    const __m128i k5 = _mm_set_epi64x(0, 0x0163CD6124);
+    const __m128i poly = _mm_set_epi64x(0x01F7011641, 0x01DB710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+    __m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+    x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+    x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+    x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+    x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    data += 64;
+    size -= 64;
+
+    /* Fold four blocks of 16 bytes at a time. */
+    while(size >= 64) {
+        x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(data + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(data + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(data + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(data + 0x30)));
+
+        data += 64;
+        size -= 64;
+    }
+
+    /* Fold the four blocks down into one. */
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+    /* Then any single blocks of 16 bytes that are left. */
+    while(size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)data));
+
+        data += 16;
+        size -= 16;
+    }
+
+    /* Fold 128 bits down to 64. */
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    /* Barrett reduction down to 32 bits. */
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc32_update_pclmul(uint32_t crc, const uint8_t *data,
+                                    size_t size) {
+    size_t bulk;
+
+    if(size >= 64) {
+        bulk = size & ~(size_t)15;
+        crc = crc32_fold_pclmul(crc, data, bulk);
+        data += bulk;
+        size -= bulk;
+    }
+
+    return crc32_update_sliced(crc, data, size);
+}
+#endif
+
+/* Multiply a and b modulo the CRC polynomial, in the bit-reflected form the
+   CRC uses (so x^0 is 1 << 31). This is from zlib's crc32.c. */
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b) {
+    uint32_t m = (uint32_t)1 << 31, p = 0;
+
+    for(;;) {
+        if(a & m) {
+            p ^= b;
+
+            if(!(a & (m - 1)))
+                break;
+        }
+
+        m >>= 1;
+        b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+    }
+
+    return p;
+}
+
+/* Return x^(n * 2^k) modulo the CRC polynomial. */
+static uint32_t crc32_x2nmodp(uint64_t n, unsigned int k) {
+    uint32_t p = (uint32_t)1 << 31;
+
+    while(n) {
+        if(n & 1)
+            p = crc32_multmodp(crc32_x2n_table[k & 31], p);
+
+        n >>= 1;
+        ++k;
+    }
+
+    return p;
+}
+
+static void crc32_init_tables(void) {
+    uint32_t crc;
     int i, j;
-    uint32_t rv = 0xFFFFFFFF;
 
-    for(i = 0; i < size; ++i) {
-        rv ^= data[i];
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
-        rv = (0xEDB88320 & (-(rv & 1))) ^ (rv >> 1);
+    for(i = 0; i < 256; ++i) {
+        crc = (uint32_t)i;
+
+        for(j = 0; j < 8; ++j) {
+            crc = (CRC32_POLY & (-(crc & 1))) ^ (crc >> 1);
+        }
+
+        crc32_table[0][i] = crc;
+    }
+
+    for(i = 0; i < 256; ++i) {
+        for(j = 1; j < 16; ++j) {
+            crc = crc32_table[j - 1][i];
+            crc32_table[j][i] = (crc >> 8) ^ crc32_table[0][crc & 0xFF];
+        }
     }
 
-    return ~rv;
+    crc = (uint32_t)1 << 30;                /* x^1 */
+    crc32_x2n_table[0] = crc;
+
+    for(i = 1; i < 32; ++i) {
+        crc = crc32_multmodp(crc, crc);
+        crc32_x2n_table[i] = crc;
+    }
+
+#ifdef HAVE_CRC32_PCLMUL
+    __builtin_cpu_init();
+
+    if(__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1"))
+        crc32_update = &crc32_update_pclmul;
+#endif
+}
+
+/* Calculate a CRC32 checksum over a given block of data. Large blocks are
+   folded with PCLMULQDQ where the CPU has it, and everything else goes
+   through the slicing-by-16 tables. */
+uint32_t sylverant_crc32(const uint8_t *data, int size) {
+    pthread_once(&crc32_once, &crc32_init_tables);
+
+    if(size <= 0)
+        return 0;
+
+    return ~crc32_update(0xFFFFFFFF, data, (size_t)size);
+}
+
+void sylverant_crc32_init(sylverant_crc32_t *ctx) {
+    pthread_once(&crc32_once, &crc32_init_tables);
+    ctx->crc = 0xFFFFFFFF;
+}
+
+void sylverant_crc32_update(sylverant_crc32_t *ctx, const void *data,
+                            size_t size) {
+    ctx->crc = crc32_update(ctx->crc, (const uint8_t *)data, size);
+}
+
+uint32_t sylverant_crc32_final(sylverant_crc32_t *ctx) {
+    return ~ctx->crc;
+}
+
+/* Appending len2 bytes to the first block multiplies its CRC by x^(8 * len2),
+   after which the CRC of the second block can simply be XORed in. */
+uint32_t sylverant_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2) {
+    pthread_once(&crc32_once, &crc32_init_tables);
+    return crc32_multmodp(crc32_x2nmodp(len2, 3), crc1) ^ crc2;
 }
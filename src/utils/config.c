@@ -756,3 +756,13 @@ void sylverant_free_config(sylverant_config_t *cfg) {
         free(cfg);
     }
 }
+
+static int use_arenas = 0;
+
+void sylverant_config_arenas(int enable) {
+    use_arenas = enable;
+}
+
+int sylverant_config_arenas_enabled(void) {
+    return use_arenas;
+}
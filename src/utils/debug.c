@@ -1,7 +1,7 @@
 /*
     This file is part of Sylverant PSO Server.
 
-    Copyright (C) 2009, 2011, 2019, 2020 Lawrence Sebald
+    Copyright (C) 2009, 2011, 2019, 2020, 2026 Lawrence Sebald
 
     This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU Affero General Public License version 3
@@ -17,6 +17,7 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <time.h>
@@ -27,6 +28,13 @@
 static int min_level = DBG_LOG;
 static FILE *dfp = NULL;
 
+/* Each thread keeps the timestamp from its last message, up to the seconds,
+   and only formats it again when the second changes. The milliseconds (and
+   the end of the prefix) go in right after it. */
+static __thread time_t ts_sec = -1;
+static __thread char ts_buf[64];
+static __thread int ts_len;
+
 void debug_set_threshold(int level) {
     min_level = level;
 }
@@ -77,6 +85,7 @@ int fdebug(FILE *fp, int level, const char *fmt, ...) {
 int vfdebug(FILE *fp, const char *fmt, va_list args) {
     struct timeval rawtime;
     struct tm cooked;
+    unsigned int ms;
 
     if(!fp || !fmt)
         return -1;
@@ -84,13 +93,25 @@ int vfdebug(FILE *fp, const char *fmt, va_list args) {
     /* Get the timestamp */
     gettimeofday(&rawtime, NULL);
 
-    /* Get UTC */
-    gmtime_r(&rawtime.tv_sec, &cooked);
-
-    /* Print the timestamp */
-    fprintf(fp, "[%u:%02u:%02u: %02u:%02u:%02u.%03u]: ", cooked.tm_year + 1900,
-            cooked.tm_mon + 1, cooked.tm_mday, cooked.tm_hour, cooked.tm_min,
-            cooked.tm_sec, (unsigned int)(rawtime.tv_usec / 1000));
+    if(rawtime.tv_sec != ts_sec) {
+        /* Get UTC */
+        gmtime_r(&rawtime.tv_sec, &cooked);
+
+        ts_len = snprintf(ts_buf, sizeof(ts_buf) - 7,
+                          "[%u:%02u:%02u: %02u:%02u:%02u.",
+                          cooked.tm_year + 1900, cooked.tm_mon + 1,
+                          cooked.tm_mday, cooked.tm_hour, cooked.tm_min,
+                          cooked.tm_sec);
+        memcpy(ts_buf + ts_len + 3, "]: ", 4);
+        ts_sec = rawtime.tv_sec;
+    }
+
+    /* Fill in the milliseconds and print the timestamp */
+    ms = (unsigned int)(rawtime.tv_usec / 1000);
+    ts_buf[ts_len] = '0' + ms / 100;
+    ts_buf[ts_len + 1] = '0' + (ms / 10) % 10;
+    ts_buf[ts_len + 2] = '0' + ms % 10;
+    fputs(ts_buf, fp);
 
     vfprintf(fp, fmt, args);
     fflush(fp);
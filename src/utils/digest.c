@@ -0,0 +1,500 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sylverant/digest.h"
+#include "sylverant/checksum.h"
+#include "sylverant/utils.h"
+
+/* The index file is laid out as a header, then an array of entries sorted by
+   the hash of their path (and then the path itself), then a table of the
+   paths, each with a NUL terminator. Everything is in the host's byte order,
+   since the index is only a cache of things on the local disk anyway. */
+#define DIGEST_MAGIC        "SYLDGST1"
+
+typedef struct digest_hdr {
+    char magic[8];
+    uint32_t count;
+    uint32_t strtab_size;
+} digest_hdr_t;
+
+/* 64 bytes each, so that each lookup only touches one cache line. */
+typedef struct digest_ent {
+    uint64_t path_hash;
+    uint32_t path_off;
+    uint32_t path_len;
+    uint64_t size;
+    int64_t mtime_sec;
+    uint32_t mtime_nsec;
+    uint32_t crc32;
+    uint64_t inode;
+    uint8_t md5[16];
+} digest_ent_t;
+
+/* Entries added or updated since the index was opened. */
+typedef struct digest_pending {
+    struct digest_pending *next;
+    digest_ent_t ent;
+    char path[];
+} digest_pending_t;
+
+/* Flags for each entry in the mapped index. */
+#define DIGEST_SEEN         0x01        /* Asked for since opening */
+#define DIGEST_STALE        0x02        /* Replaced by a pending entry */
+
+struct sylverant_digest_cache {
+    char *fn;
+
+    void *map;
+    size_t map_len;
+    const digest_ent_t *ents;
+    uint32_t count;
+    const char *strtab;
+    uint32_t strtab_size;
+    uint8_t *flags;
+
+    digest_pending_t **buckets;
+    size_t nbuckets;
+    size_t npending;
+    int dirty;
+};
+
+/* Hash files by mapping them this much at a time. */
+#define DIGEST_WINDOW       (1 << 26)
+
+#if defined(__APPLE__)
+#define ST_MTIME_NSEC(st)   ((st).st_mtimespec.tv_nsec)
+#else
+#define ST_MTIME_NSEC(st)   ((st).st_mtim.tv_nsec)
+#endif
+
+/* FNV-1a, 64-bit. */
+static uint64_t path_hash(const char *path, size_t len) {
+    uint64_t h = 0xCBF29CE484222325ULL;
+    size_t i;
+
+    for(i = 0; i < len; ++i) {
+        h ^= (uint8_t)path[i];
+        h *= 0x100000001B3ULL;
+    }
+
+    return h;
+}
+
+static void map_index(sylverant_digest_cache_t *c) {
+    const digest_hdr_t *hdr;
+    struct stat st;
+    uint64_t ents_size;
+    void *map;
+    int fd;
+
+    if((fd = open(c->fn, O_RDONLY)) < 0)
+        return;
+
+    if(fstat(fd, &st) || st.st_size < (off_t)sizeof(digest_hdr_t)) {
+        close(fd);
+        return;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(map == MAP_FAILED)
+        return;
+
+    /* Make sure the sizes in the header add up. Individual entries are only
+       checked as they're looked at, so that opening a big index is cheap. */
+    hdr = (const digest_hdr_t *)map;
+    ents_size = (uint64_t)hdr->count * sizeof(digest_ent_t);
+
+    if(memcmp(hdr->magic, DIGEST_MAGIC, 8) ||
+       sizeof(digest_hdr_t) + ents_size + hdr->strtab_size !=
+       (uint64_t)st.st_size ||
+       !(c->flags = (uint8_t *)calloc(hdr->count ? hdr->count : 1, 1))) {
+        munmap(map, (size_t)st.st_size);
+        return;
+    }
+
+    c->map = map;
+    c->map_len = (size_t)st.st_size;
+    c->count = hdr->count;
+    c->ents = (const digest_ent_t *)(hdr + 1);
+    c->strtab = (const char *)(c->ents + c->count);
+    c->strtab_size = hdr->strtab_size;
+}
+
+sylverant_digest_cache_t *sylverant_digest_open(const char *fn) {
+    sylverant_digest_cache_t *c;
+
+    if(!(c = (sylverant_digest_cache_t *)calloc(1,
+                                                sizeof(sylverant_digest_cache_t))))
+        return NULL;
+
+    c->nbuckets = 256;
+
+    if(!(c->fn = strdup(fn)) ||
+       !(c->buckets = (digest_pending_t **)calloc(c->nbuckets,
+                                                  sizeof(digest_pending_t *)))) {
+        free(c->fn);
+        free(c);
+        return NULL;
+    }
+
+    map_index(c);
+    return c;
+}
+
+void sylverant_digest_close(sylverant_digest_cache_t *c) {
+    digest_pending_t *p, *next;
+    size_t i;
+
+    if(!c)
+        return;
+
+    for(i = 0; i < c->nbuckets; ++i) {
+        for(p = c->buckets[i]; p; p = next) {
+            next = p->next;
+            free(p);
+        }
+    }
+
+    if(c->map)
+        munmap(c->map, c->map_len);
+
+    free(c->flags);
+    free(c->buckets);
+    free(c->fn);
+    free(c);
+}
+
+/* Does the entry in the mapped index have the given path? */
+static int ent_path_is(const sylverant_digest_cache_t *c, const digest_ent_t *e,
+                       const char *path, size_t len) {
+    return e->path_len == len && (uint64_t)e->path_off + len <
+           c->strtab_size && !memcmp(c->strtab + e->path_off, path, len);
+}
+
+static long map_find(const sylverant_digest_cache_t *c, uint64_t h,
+                     const char *path, size_t len) {
+    uint32_t lo = 0, hi = c->count, mid;
+
+    /* Find the first entry with this hash... */
+    while(lo < hi) {
+        mid = lo + ((hi - lo) >> 1);
+
+        if(c->ents[mid].path_hash < h)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* ...then look through everything with the same hash. */
+    for(; lo < c->count && c->ents[lo].path_hash == h; ++lo) {
+        if(ent_path_is(c, &c->ents[lo], path, len))
+            return (long)lo;
+    }
+
+    return -1;
+}
+
+static digest_pending_t *pending_find(const sylverant_digest_cache_t *c,
+                                      uint64_t h, const char *path,
+                                      size_t len) {
+    digest_pending_t *p;
+
+    for(p = c->buckets[h & (c->nbuckets - 1)]; p; p = p->next) {
+        if(p->ent.path_hash == h && p->ent.path_len == len &&
+           !memcmp(p->path, path, len))
+            return p;
+    }
+
+    return NULL;
+}
+
+static void pending_grow(sylverant_digest_cache_t *c) {
+    digest_pending_t **nb, *p, *next;
+    size_t i, n = c->nbuckets << 1;
+
+    /* Not being able to grow just means longer chains, so ignore failure. */
+    if(!(nb = (digest_pending_t **)calloc(n, sizeof(digest_pending_t *))))
+        return;
+
+    for(i = 0; i < c->nbuckets; ++i) {
+        for(p = c->buckets[i]; p; p = next) {
+            next = p->next;
+            p->next = nb[p->ent.path_hash & (n - 1)];
+            nb[p->ent.path_hash & (n - 1)] = p;
+        }
+    }
+
+    free(c->buckets);
+    c->buckets = nb;
+    c->nbuckets = n;
+}
+
+static int ent_matches(const digest_ent_t *e, const struct stat *st) {
+    return e->size == (uint64_t)st->st_size &&
+        e->mtime_sec == (int64_t)st->st_mtime &&
+        e->mtime_nsec == (uint32_t)ST_MTIME_NSEC(*st) &&
+        e->inode == (uint64_t)st->st_ino;
+}
+
+static void ent_to_digest(const digest_ent_t *e, sylverant_digest_t *rv) {
+    rv->size = e->size;
+    rv->mtime_sec = e->mtime_sec;
+    rv->mtime_nsec = e->mtime_nsec;
+    rv->crc32 = e->crc32;
+    rv->inode = e->inode;
+    memcpy(rv->md5, e->md5, 16);
+}
+
+/* Compute the CRC32 and MD5 of the file together, in one pass over it. */
+static int hash_file(int fd, const struct stat *st, digest_ent_t *e) {
+    sylverant_crc32_t crc;
+    md5_ctx_t md5;
+    off_t off = 0;
+    size_t len;
+    void *map;
+
+    sylverant_crc32_init(&crc);
+    md5_init(&md5);
+
+    while(off < st->st_size) {
+        if(st->st_size - off > DIGEST_WINDOW)
+            len = DIGEST_WINDOW;
+        else
+            len = (size_t)(st->st_size - off);
+
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off);
+
+        if(map == MAP_FAILED)
+            return -1;
+
+        madvise(map, len, MADV_SEQUENTIAL);
+        sylverant_crc32_update(&crc, map, len);
+        md5_update(&md5, map, len);
+        munmap(map, len);
+        off += len;
+    }
+
+    e->size = (uint64_t)st->st_size;
+    e->mtime_sec = (int64_t)st->st_mtime;
+    e->mtime_nsec = (uint32_t)ST_MTIME_NSEC(*st);
+    e->inode = (uint64_t)st->st_ino;
+    e->crc32 = sylverant_crc32_final(&crc);
+    md5_final(&md5, e->md5);
+
+    return 0;
+}
+
+int sylverant_digest_get(sylverant_digest_cache_t *c, const char *path,
+                         sylverant_digest_t *rv) {
+    size_t len = strlen(path);
+    uint64_t h = path_hash(path, len);
+    digest_pending_t *p;
+    digest_ent_t ent;
+    struct stat st;
+    long i = -1;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    /* Anything looked at already this time around is newer than the index. */
+    if((p = pending_find(c, h, path, len))) {
+        if(ent_matches(&p->ent, &st)) {
+            close(fd);
+            ent_to_digest(&p->ent, rv);
+            return 1;
+        }
+    }
+    else if((i = map_find(c, h, path, len)) >= 0) {
+        c->flags[i] |= DIGEST_SEEN;
+
+        if(ent_matches(&c->ents[i], &st)) {
+            close(fd);
+            ent_to_digest(&c->ents[i], rv);
+            return 1;
+        }
+    }
+
+    /* Either we've never seen it or it has changed, so hash it. */
+    if(hash_file(fd, &st, &ent)) {
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    ent.path_hash = h;
+    ent.path_len = (uint32_t)len;
+    ent.path_off = 0;
+
+    if(!p) {
+        if(!(p = (digest_pending_t *)malloc(sizeof(digest_pending_t) + len +
+                                            1))) {
+            /* We still have the digest, just can't cache it. */
+            ent_to_digest(&ent, rv);
+            return 0;
+        }
+
+        memcpy(p->path, path, len + 1);
+        p->next = c->buckets[h & (c->nbuckets - 1)];
+        c->buckets[h & (c->nbuckets - 1)] = p;
+
+        if(++c->npending > c->nbuckets)
+            pending_grow(c);
+
+        if(i >= 0)
+            c->flags[i] |= DIGEST_STALE;
+    }
+
+    p->ent = ent;
+    c->dirty = 1;
+    ent_to_digest(&ent, rv);
+    return 0;
+}
+
+typedef struct digest_out {
+    digest_ent_t ent;
+    const char *path;
+} digest_out_t;
+
+static int out_cmp(const void *a, const void *b) {
+    const digest_out_t *x = (const digest_out_t *)a;
+    const digest_out_t *y = (const digest_out_t *)b;
+
+    if(x->ent.path_hash != y->ent.path_hash)
+        return x->ent.path_hash < y->ent.path_hash ? -1 : 1;
+
+    return strcmp(x->path, y->path);
+}
+
+int sylverant_digest_save(sylverant_digest_cache_t *c, int prune) {
+    digest_out_t *out;
+    digest_pending_t *p;
+    digest_hdr_t hdr;
+    size_t i, n = 0, tmplen;
+    uint32_t j, off = 0;
+    char *tmp;
+    FILE *fp;
+    int err = 0;
+
+    if(!c->dirty && !prune)
+        return 0;
+
+    if(!(out = (digest_out_t *)malloc((c->count + c->npending + 1) *
+                                      sizeof(digest_out_t))))
+        return -1;
+
+    /* Keep whatever is still good out of the old index... */
+    for(j = 0; j < c->count; ++j) {
+        const digest_ent_t *e = &c->ents[j];
+
+        if((c->flags[j] & DIGEST_STALE) ||
+           (prune && !(c->flags[j] & DIGEST_SEEN)))
+            continue;
+
+        /* Leave out anything that doesn't make sense. */
+        if((uint64_t)e->path_off + e->path_len >= c->strtab_size ||
+           c->strtab[e->path_off + e->path_len] != '\0')
+            continue;
+
+        out[n].ent = *e;
+        out[n++].path = c->strtab + e->path_off;
+    }
+
+    /* ...and add in everything new. */
+    for(i = 0; i < c->nbuckets; ++i) {
+        for(p = c->buckets[i]; p; p = p->next) {
+            out[n].ent = p->ent;
+            out[n++].path = p->path;
+        }
+    }
+
+    qsort(out, n, sizeof(digest_out_t), &out_cmp);
+
+    for(i = 0; i < n; ++i) {
+        out[i].ent.path_off = off;
+        off += out[i].ent.path_len + 1;
+    }
+
+    memcpy(hdr.magic, DIGEST_MAGIC, 8);
+    hdr.count = (uint32_t)n;
+    hdr.strtab_size = off;
+
+    /* Write to a temporary file and move it into place, so that nothing ever
+       sees a half-written index (including our own mapping of the old one). */
+    tmplen = strlen(c->fn) + 5;
+
+    if(!(tmp = (char *)malloc(tmplen))) {
+        free(out);
+        return -1;
+    }
+
+    snprintf(tmp, tmplen, "%s.tmp", c->fn);
+
+    if(!(fp = fopen(tmp, "wb"))) {
+        free(tmp);
+        free(out);
+        return -1;
+    }
+
+    if(fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+        err = 1;
+
+    for(i = 0; i < n && !err; ++i) {
+        if(fwrite(&out[i].ent, sizeof(digest_ent_t), 1, fp) != 1)
+            err = 1;
+    }
+
+    for(i = 0; i < n && !err; ++i) {
+        if(fwrite(out[i].path, out[i].ent.path_len + 1, 1, fp) != 1)
+            err = 1;
+    }
+
+    if(fflush(fp) || fsync(fileno(fp)))
+        err = 1;
+
+    if(fclose(fp))
+        err = 1;
+
+    if(err || rename(tmp, c->fn)) {
+        unlink(tmp);
+        free(tmp);
+        free(out);
+        return -1;
+    }
+
+    free(tmp);
+    free(out);
+    c->dirty = 0;
+    return 0;
+}
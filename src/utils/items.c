@@ -29,6 +29,7 @@
 
 #include "sylverant/items.h"
 #include "sylverant/debug.h"
+#include "sylverant/config.h"
 #include "sylverant/memory.h"
 
 #ifndef LIBXML_TREE_ENABLED
@@ -687,6 +688,14 @@ static int handle_tool(xmlNode *n, sylverant_tool_t *t) {
     return 0;
 }
 
+/* Allocate part of the limits list, out of its arena if it has one. */
+static void *limits_alloc(sylverant_limits_t *l, size_t sz) {
+    if(l->arena)
+        return arena_alloc((sylverant_arena_t *)l->arena, sz);
+
+    return malloc(sz);
+}
+
 static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
     xmlChar *code_str;
     uint32_t code;
@@ -724,7 +733,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
         {
             sylverant_weapon_t *w;
 
-            w = (sylverant_weapon_t *)malloc(sizeof(sylverant_weapon_t));
+            w = (sylverant_weapon_t *)limits_alloc(l, sizeof(sylverant_weapon_t));
             if(!w) {
                 debug(DBG_ERROR, "Couldn't allocate space for item\n");
                 perror("malloc");
@@ -758,7 +767,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
                 {
                     sylverant_frame_t *f;
 
-                    f = (sylverant_frame_t *)malloc(sizeof(sylverant_frame_t));
+                    f = (sylverant_frame_t *)limits_alloc(l, sizeof(sylverant_frame_t));
                     if(!f) {
                         debug(DBG_ERROR, "Couldn't allocate space for item\n");
                         perror("malloc");
@@ -785,7 +794,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
                     sylverant_barrier_t *b;
 
                     b = (sylverant_barrier_t *)
-                    malloc(sizeof(sylverant_barrier_t));
+                    limits_alloc(l, sizeof(sylverant_barrier_t));
                     if(!b) {
                         debug(DBG_ERROR, "Couldn't allocate space for item\n");
                         perror("malloc");
@@ -811,7 +820,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
                 {
                     sylverant_unit_t *u;
 
-                    u = (sylverant_unit_t *)malloc(sizeof(sylverant_unit_t));
+                    u = (sylverant_unit_t *)limits_alloc(l, sizeof(sylverant_unit_t));
                     if(!u) {
                         debug(DBG_ERROR, "Couldn't allocate space for item\n");
                         perror("malloc");
@@ -852,7 +861,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
         {
             sylverant_mag_t *m;
 
-            m = (sylverant_mag_t *)malloc(sizeof(sylverant_mag_t));
+            m = (sylverant_mag_t *)limits_alloc(l, sizeof(sylverant_mag_t));
             if(!m) {
                 debug(DBG_ERROR, "Couldn't allocate space for item\n");
                 perror("malloc");
@@ -883,7 +892,7 @@ static int handle_item(xmlNode *n, sylverant_limits_t *l, int swap) {
         {
             sylverant_tool_t *t;
 
-            t = (sylverant_tool_t *)malloc(sizeof(sylverant_tool_t));
+            t = (sylverant_tool_t *)limits_alloc(l, sizeof(sylverant_tool_t));
             if(!t) {
                 debug(DBG_ERROR, "Couldn't allocate space for item\n");
                 perror("malloc");
@@ -933,8 +942,9 @@ int sylverant_read_limits(const char *f, sylverant_limits_t **l) {
     }
 
     /* Allocate space for the base of the list. */
-    rv = (sylverant_limits_t *)ref_alloc(sizeof(sylverant_limits_t),
-                                         &sylverant_real_free_limits);
+    rv = (sylverant_limits_t *)ref_alloc_tagged(sizeof(sylverant_limits_t),
+                                                &sylverant_real_free_limits,
+                                                "limits");
 
     if(!rv) {
         debug(DBG_ERROR, "Cannot make space for items list\n");
@@ -945,18 +955,34 @@ int sylverant_read_limits(const char *f, sylverant_limits_t **l) {
     /* Clear out the list. */
     memset(rv, 0, sizeof(sylverant_limits_t));
 
+    /* In arena mode, everything in the list comes out of the arena, so it all
+       gets freed in one go. */
+    if(sylverant_config_arenas_enabled() && !(rv->arena = arena_create(0))) {
+        debug(DBG_ERROR, "Cannot make arena for items list\n");
+        ref_free(rv, 1);
+        *l = NULL;
+        return -2;
+    }
+
     /* Allocate space for each of the buckets. */
-    rv->weapons = (iq_t *)malloc(sizeof(iq_t));
-    rv->guards = (iq_t *)malloc(sizeof(iq_t));
-    rv->mags = (iq_t *)malloc(sizeof(iq_t));
-    rv->tools = (iq_t *)malloc(sizeof(iq_t));
+    rv->weapons = (iq_t *)limits_alloc(rv, sizeof(iq_t));
+    rv->guards = (iq_t *)limits_alloc(rv, sizeof(iq_t));
+    rv->mags = (iq_t *)limits_alloc(rv, sizeof(iq_t));
+    rv->tools = (iq_t *)limits_alloc(rv, sizeof(iq_t));
 
     if(!rv->weapons || !rv->guards || !rv->mags || !rv->tools) {
-        /* The standard says that free(NULL) does nothing, so... this works. */
-        free(rv->weapons);
-        free(rv->guards);
-        free(rv->mags);
-        free(rv->tools);
+        if(rv->arena) {
+            ref_release(rv->arena);
+        }
+        else {
+            /* The standard says that free(NULL) does nothing, so... this
+               works. */
+            free(rv->weapons);
+            free(rv->guards);
+            free(rv->mags);
+            free(rv->tools);
+        }
+
         ref_free(rv, 1);
         *l = NULL;
         return -3;
@@ -1267,6 +1293,19 @@ static void sylverant_real_free_limits(void *ll) {
     if(!l)
         return;
 
+    if(l->name) {
+        free(l->name);
+        l->name = NULL;
+    }
+
+    /* If the list was built in an arena, everything else goes with it. */
+    if(l->arena) {
+        ref_release(l->arena);
+        l->arena = NULL;
+        l->weapons = l->guards = l->mags = l->tools = NULL;
+        return;
+    }
+
     /* Go through each list to clean up the information in it. */
     if(l->weapons) {
         clean_list(l->weapons);
@@ -1288,11 +1327,6 @@ static void sylverant_real_free_limits(void *ll) {
         l->tools = NULL;
     }
 
-    if(l->name) {
-        free(l->name);
-        l->name = NULL;
-    }
-
     /* The structure itself will be freed by the reference counting code. */
 }
 
@@ -1,7 +1,7 @@
 /*
     This file is part of Sylverant PSO Server.
 
-    Copyright (C) 2009, 2011, 2019, 2020, 2025 Lawrence Sebald
+    Copyright (C) 2009, 2011, 2019, 2020, 2025, 2026 Lawrence Sebald
 
     This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU Affero General Public License version 3
@@ -17,16 +17,70 @@
 */
 
 #include <stdio.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <stdarg.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <sys/time.h>
 
 #include "sylverant/log.h"
 
-static int min_level = SYL_LOG_INFO;
+int syl_log_min_level = SYL_LOG_INFO;
 static FILE *dfp = NULL;
 
+/* In async mode, lines go into a ring of fixed size slots, and a writer thread
+   takes them out and writes them. A line that doesn't fit in one slot takes up
+   as many in a row as it needs, with the first one saying how many. This is
+   the bounded queue from Dmitry Vyukov, with the twist that a producer claims
+   all of a line's slots at once: since the writer frees slots in order, if the
+   last one is free, so are all of the others. Each slot's sequence number says
+   what it's waiting for -- equal to its position when it's free for a
+   producer to fill, and one past that once there's a line in it. */
+#define LOG_SLOT_SIZE   256
+#define LOG_SLOT_DATA   (LOG_SLOT_SIZE - sizeof(atomic_size_t) - \
+                         sizeof(FILE *) - 2 * sizeof(uint32_t))
+#define LOG_LINE_MAX    4096
+
+typedef struct log_slot {
+    atomic_size_t seq;
+    FILE *fp;
+    uint32_t len;                       /* Length of the line, in bytes */
+    uint32_t count;                     /* Slots the line takes up */
+    char data[LOG_SLOT_DATA];
+} log_slot_t;
+
+typedef struct log_ring {
+    log_slot_t *slots;
+    size_t mask;
+    int policy;
+
+    /* Producers share the enqueue position, the writer owns the dequeue
+       position. Keep them apart so they don't fight over a cache line. */
+    _Alignas(64) atomic_size_t enqueue;
+    _Alignas(64) size_t dequeue;
+    atomic_size_t written;              /* Everything before this is out */
+
+    atomic_int sleeping;                /* Writer is (about to be) waiting */
+    atomic_int waiters;                 /* Producers or flushes waiting */
+    atomic_int running;
+    atomic_ulong dropped;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;                /* Something for the writer to do */
+    pthread_cond_t done;                /* The writer made progress */
+    pthread_t thread;
+} log_ring_t;
+
+/* The ring, while async mode is on, and how many threads are in the middle of
+   putting a line in it (so it isn't freed out from under them). */
+static _Atomic(log_ring_t *) ring = NULL;
+static atomic_int ring_users = 0;
+
 static const char *levels[] = {
     "TRACE",
     "DEBUG",
@@ -45,7 +99,7 @@ static const char *levelname(int level) {
 }
 
 void syl_log_set_level(int level) {
-    min_level = level;
+    syl_log_min_level = level;
 }
 
 FILE *syl_log_set_file(FILE *fp) {
@@ -85,35 +139,402 @@ int syl_flogf(FILE *fp, int level, const char *fn, int line,
     return rv;
 }
 
-int syl_vflogf(FILE *fp, int level, const char *fn, int line, const char *fmt,
-               va_list args) {
+/* The timestamp only changes once a second, so each thread keeps the last one
+   it made and only formats a new one when the second changes. */
+static __thread time_t ts_sec = -1;
+static __thread char ts_buf[64];
+
+static int log_prefix(char *buf, size_t len, int level, const char *fn,
+                      int line) {
     struct timeval rawtime;
     struct tm cooked;
-    char timestamp[200];
     const char *lname;
 
-    if(!fp || !fmt)
-        return -1;
-
-    if(level < min_level)
-        return 0;
-
     lname = levelname(level);
 
     /* Get the timestamp */
     gettimeofday(&rawtime, NULL);
 
-    /* Get UTC */
-    gmtime_r(&rawtime.tv_sec, &cooked);
+    if(rawtime.tv_sec != ts_sec) {
+        /* Get UTC */
+        gmtime_r(&rawtime.tv_sec, &cooked);
 
-    /* Print the timestamp and level of the log in common log format style... */
-    strftime(timestamp, 200, "%d/%b/%Y:%H:%M:%S %z", &cooked);
+        /* Print the timestamp of the log in common log format style... */
+        strftime(ts_buf, sizeof(ts_buf), "%d/%b/%Y:%H:%M:%S %z", &cooked);
+        ts_sec = rawtime.tv_sec;
+    }
 
     if(lname)
-        fprintf(fp, "[%s:%d] [%s] [%s]: ", fn, line, timestamp, lname);
+        return snprintf(buf, len, "[%s:%d] [%s] [%s]: ", fn, line, ts_buf,
+                        lname);
     else
-        fprintf(fp, "[%s:%d] [%s] [%d]: ", fn, line, timestamp, level);
+        return snprintf(buf, len, "[%s:%d] [%s] [%d]: ", fn, line, ts_buf,
+                        level);
+}
+
+static void ring_wake(log_ring_t *r, pthread_cond_t *c) {
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_broadcast(c);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Wait a little while for something to change. The timeout means a wakeup
+   that's missed just makes things a bit slower, rather than hanging. */
+static void ring_wait(log_ring_t *r, pthread_cond_t *c, long ms) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += ms * 1000000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+
+    pthread_mutex_lock(&r->lock);
+    pthread_cond_timedwait(c, &r->lock, &ts);
+    pthread_mutex_unlock(&r->lock);
+}
+
+/* Put a line in the ring. Returns 0 on success or -1 if it was dropped. */
+static int ring_put(log_ring_t *r, FILE *fp, const char *buf, size_t len) {
+    size_t pos, last, seq, count, i, n;
+    log_slot_t *s;
+    int nl = 0;
+
+    /* Anything that wouldn't fit even with the ring empty gets cut short, but
+       still ends the line if it was going to. */
+    if(len > (r->mask + 1) / 2 * LOG_SLOT_DATA) {
+        nl = buf[len - 1] == '\n';
+        len = (r->mask + 1) / 2 * LOG_SLOT_DATA;
+    }
+
+    count = len ? (len + LOG_SLOT_DATA - 1) / LOG_SLOT_DATA : 1;
+    pos = atomic_load_explicit(&r->enqueue, memory_order_relaxed);
+
+    for(;;) {
+        last = pos + count - 1;
+        s = &r->slots[last & r->mask];
+        seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+
+        if(seq == last) {
+            if(atomic_compare_exchange_weak_explicit(&r->enqueue, &pos,
+                                                     pos + count,
+                                                     memory_order_relaxed,
+                                                     memory_order_relaxed))
+                break;
+        }
+        else if((ptrdiff_t)(seq - last) < 0) {
+            /* Full, so either give up or wait for the writer to catch up. */
+            if(r->policy == SYL_LOG_ASYNC_DROP) {
+                atomic_fetch_add_explicit(&r->dropped, 1,
+                                          memory_order_relaxed);
+                return -1;
+            }
+
+            atomic_fetch_add(&r->waiters, 1);
+            ring_wake(r, &r->wake);
+            ring_wait(r, &r->done, 10);
+            atomic_fetch_sub(&r->waiters, 1);
+            pos = atomic_load_explicit(&r->enqueue, memory_order_relaxed);
+        }
+        else {
+            /* Someone else got there first. */
+            pos = atomic_load_explicit(&r->enqueue, memory_order_relaxed);
+        }
+    }
+
+    /* Fill in the slots, and mark the first one full last of all, since that's
+       what the writer looks at. */
+    for(i = 0; i < count; ++i) {
+        s = &r->slots[(pos + i) & r->mask];
+        n = len - i * LOG_SLOT_DATA;
+        memcpy(s->data, buf + i * LOG_SLOT_DATA,
+               n < LOG_SLOT_DATA ? n : LOG_SLOT_DATA);
+    }
+
+    if(nl)
+        s->data[(len - 1) % LOG_SLOT_DATA] = '\n';
+
+    s = &r->slots[pos & r->mask];
+    s->fp = fp;
+    s->len = (uint32_t)len;
+    s->count = (uint32_t)count;
+
+    for(i = count; i > 0; --i) {
+        atomic_store_explicit(&r->slots[(pos + i - 1) & r->mask].seq,
+                              pos + i, memory_order_release);
+    }
+
+    if(atomic_load(&r->sleeping))
+        ring_wake(r, &r->wake);
+
+    return 0;
+}
+
+/* Write out every line that's ready, returning how many there were. Files are
+   only flushed when the batch is done (or it moves to another file), so a
+   burst of lines goes out in a few big writes. */
+static int ring_drain(log_ring_t *r) {
+    size_t pos = r->dequeue, count, len, i, n;
+    log_slot_t *s;
+    FILE *fp, *last = NULL;
+    int lines = 0;
+
+    for(;;) {
+        s = &r->slots[pos & r->mask];
+
+        if(atomic_load_explicit(&s->seq, memory_order_acquire) != pos + 1)
+            break;
+
+        fp = s->fp;
+        len = s->len;
+        count = s->count;
+
+        if(last && fp != last)
+            fflush(last);
+
+        for(i = 0; i < count; ++i) {
+            s = &r->slots[(pos + i) & r->mask];
+            n = len - i * LOG_SLOT_DATA;
+            fwrite(s->data, 1, n < LOG_SLOT_DATA ? n : LOG_SLOT_DATA, fp);
+        }
+
+        /* Hand the slots back to the producers, for the next time around. */
+        for(i = 0; i < count; ++i) {
+            atomic_store_explicit(&r->slots[(pos + i) & r->mask].seq,
+                                  pos + i + r->mask + 1,
+                                  memory_order_release);
+        }
+
+        pos += count;
+        last = fp;
+        ++lines;
+    }
+
+    if(last)
+        fflush(last);
+
+    r->dequeue = pos;
+    atomic_store_explicit(&r->written, pos, memory_order_release);
+    return lines;
+}
+
+static void *ring_thread(void *d) {
+    log_ring_t *r = (log_ring_t *)d;
+
+    while(atomic_load(&r->running)) {
+        if(ring_drain(r)) {
+            if(atomic_load(&r->waiters))
+                ring_wake(r, &r->done);
+
+            continue;
+        }
+
+        /* Nothing to do, so wait for a producer to say otherwise. Checking
+           again after saying so closes the gap where one might have put a
+           line in without waking anything. */
+        atomic_store(&r->sleeping, 1);
+
+        if(!ring_drain(r))
+            ring_wait(r, &r->wake, 100);
+
+        atomic_store(&r->sleeping, 0);
+
+        if(atomic_load(&r->waiters))
+            ring_wake(r, &r->done);
+    }
+
+    /* Write out anything left before going. */
+    ring_drain(r);
+    ring_wake(r, &r->done);
+    return NULL;
+}
+
+int syl_log_start_async(size_t size, int policy) {
+    log_ring_t *r;
+    size_t count = 16, i;
+
+    if(policy != SYL_LOG_ASYNC_DROP && policy != SYL_LOG_ASYNC_BLOCK)
+        return -1;
+
+    if(atomic_load(&ring))
+        return -1;
+
+    while(count * LOG_SLOT_SIZE < size) {
+        count <<= 1;
+    }
+
+    if(!(r = (log_ring_t *)calloc(1, sizeof(log_ring_t))))
+        return -1;
+
+    if(!(r->slots = (log_slot_t *)malloc(count * sizeof(log_slot_t)))) {
+        free(r);
+        return -1;
+    }
+
+    for(i = 0; i < count; ++i) {
+        atomic_init(&r->slots[i].seq, i);
+    }
+
+    r->mask = count - 1;
+    r->policy = policy;
+    atomic_init(&r->running, 1);
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    pthread_cond_init(&r->done, NULL);
+
+    if(pthread_create(&r->thread, NULL, &ring_thread, r)) {
+        pthread_cond_destroy(&r->done);
+        pthread_cond_destroy(&r->wake);
+        pthread_mutex_destroy(&r->lock);
+        free(r->slots);
+        free(r);
+        return -1;
+    }
+
+    atomic_store(&ring, r);
+    return 0;
+}
+
+int syl_log_flush(void) {
+    log_ring_t *r;
+    size_t target;
+
+    atomic_fetch_add(&ring_users, 1);
+
+    if(!(r = atomic_load(&ring))) {
+        atomic_fetch_sub(&ring_users, 1);
+
+        if(dfp)
+            fflush(dfp);
+
+        return 0;
+    }
+
+    target = atomic_load(&r->enqueue);
+    atomic_fetch_add(&r->waiters, 1);
+
+    /* Lines are claimed before they're filled in, so this also waits for any
+       line that was still being put in when the flush started. */
+    while((ptrdiff_t)(atomic_load_explicit(&r->written, memory_order_acquire) -
+                      target) < 0) {
+        ring_wake(r, &r->wake);
+        ring_wait(r, &r->done, 10);
+    }
+
+    atomic_fetch_sub(&r->waiters, 1);
+    atomic_fetch_sub(&ring_users, 1);
+    return 0;
+}
+
+unsigned long syl_log_dropped(void) {
+    log_ring_t *r;
+    unsigned long rv = 0;
+
+    atomic_fetch_add(&ring_users, 1);
+
+    if((r = atomic_load(&ring)))
+        rv = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+
+    atomic_fetch_sub(&ring_users, 1);
+    return rv;
+}
+
+void syl_log_stop_async(void) {
+    log_ring_t *r;
+
+    if(!(r = atomic_exchange(&ring, NULL)))
+        return;
+
+    /* New lines go straight to their files from here on, but wait for any
+       that are already on their way into the ring. */
+    while(atomic_load(&ring_users)) {
+        sched_yield();
+    }
+
+    atomic_store(&r->running, 0);
+    ring_wake(r, &r->wake);
+    pthread_join(r->thread, NULL);
+
+    pthread_cond_destroy(&r->done);
+    pthread_cond_destroy(&r->wake);
+    pthread_mutex_destroy(&r->lock);
+    free(r->slots);
+    free(r);
+}
+
+/* Format a line and put it in the ring. The caller has to have registered in
+   ring_users, which this takes care of undoing. */
+static int ring_logf(log_ring_t *r, FILE *fp, int level, const char *fn,
+                     int line, const char *fmt, va_list args) {
+    char buf[LOG_LINE_MAX], *big = NULL, *out = buf;
+    va_list args2;
+    int plen, mlen, rv = 0;
+    size_t flen;
+
+    /* Format the whole line here, so the writer only has to copy it out. Most
+       lines fit in the buffer on the stack, the rest get one that's big
+       enough. */
+    plen = log_prefix(buf, sizeof(buf), level, fn, line);
+
+    if(plen < 0 || plen >= (int)sizeof(buf))
+        plen = 0;
+
+    va_copy(args2, args);
+    mlen = vsnprintf(buf + plen, sizeof(buf) - plen, fmt, args);
+
+    if(mlen >= (int)sizeof(buf) - plen && (big = (char *)malloc(plen + mlen +
+                                                                 1))) {
+        memcpy(big, buf, plen);
+        vsnprintf(big + plen, mlen + 1, fmt, args2);
+        out = big;
+    }
+    else if(mlen >= (int)sizeof(buf) - plen) {
+        /* Cut it short, but keep the newline at the end (if the format has
+           one, since the rest of the line is gone). */
+        mlen = sizeof(buf) - plen - 1;
+        flen = strlen(fmt);
+
+        if(flen && fmt[flen - 1] == '\n')
+            buf[plen + mlen - 1] = '\n';
+    }
+
+    va_end(args2);
+
+    if(mlen < 0)
+        mlen = 0;
+
+    if(ring_put(r, fp, out, plen + mlen))
+        rv = -1;
+
+    atomic_fetch_sub(&ring_users, 1);
+    free(big);
+    return rv;
+}
+
+int syl_vflogf(FILE *fp, int level, const char *fn, int line, const char *fmt,
+               va_list args) {
+    char buf[LOG_LINE_MAX];
+    log_ring_t *r;
+
+    if(!fp || !fmt)
+        return -1;
+
+    if(level < syl_log_min_level)
+        return 0;
+
+    /* Only register as a user of the ring if it looks like there is one, so
+       logging without async mode doesn't have to touch anything shared. If
+       it's gone by the time that's done, the line goes out directly. */
+    if(atomic_load_explicit(&ring, memory_order_relaxed)) {
+        atomic_fetch_add(&ring_users, 1);
+
+        if((r = atomic_load(&ring)))
+            return ring_logf(r, fp, level, fn, line, fmt, args);
+
+        atomic_fetch_sub(&ring_users, 1);
+    }
 
+    log_prefix(buf, sizeof(buf), level, fn, line);
+    fputs(buf, fp);
     vfprintf(fp, fmt, args);
     fflush(fp);
     return 0;
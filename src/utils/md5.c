@@ -40,6 +40,10 @@
 
 #include <stdint.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 /* Initial values used in starting the MD5 checksum */
 static const uint32_t md5initial[4] = {
@@ -142,11 +146,83 @@ int main(int argc, char *argv[]) {
         (a) += (b); \
     }
 
-typedef struct kos_md5_cxt {
-    uint64_t size;
-    uint32_t hash[4];
-    uint8_t  buf[64];
-} kos_md5_cxt_t;
+/* All 64 steps of one block. Written as a macro so that the same thing can be
+   used on plain integers and on vectors of them (see md5_batch). */
+#define MD5_ROUNDS(a, b, c, d, w) { \
+        /* First Round */ \
+        MD5_FH(a, b, c, d, w[ 0],  7, md5tab[ 0]); \
+        MD5_FH(d, a, b, c, w[ 1], 12, md5tab[ 1]); \
+        MD5_FH(c, d, a, b, w[ 2], 17, md5tab[ 2]); \
+        MD5_FH(b, c, d, a, w[ 3], 22, md5tab[ 3]); \
+        MD5_FH(a, b, c, d, w[ 4],  7, md5tab[ 4]); \
+        MD5_FH(d, a, b, c, w[ 5], 12, md5tab[ 5]); \
+        MD5_FH(c, d, a, b, w[ 6], 17, md5tab[ 6]); \
+        MD5_FH(b, c, d, a, w[ 7], 22, md5tab[ 7]); \
+        MD5_FH(a, b, c, d, w[ 8],  7, md5tab[ 8]); \
+        MD5_FH(d, a, b, c, w[ 9], 12, md5tab[ 9]); \
+        MD5_FH(c, d, a, b, w[10], 17, md5tab[10]); \
+        MD5_FH(b, c, d, a, w[11], 22, md5tab[11]); \
+        MD5_FH(a, b, c, d, w[12],  7, md5tab[12]); \
+        MD5_FH(d, a, b, c, w[13], 12, md5tab[13]); \
+        MD5_FH(c, d, a, b, w[14], 17, md5tab[14]); \
+        MD5_FH(b, c, d, a, w[15], 22, md5tab[15]); \
+        \
+        /* Second Round */ \
+        MD5_GH(a, b, c, d, w[ 1],  5, md5tab[16]); \
+        MD5_GH(d, a, b, c, w[ 6],  9, md5tab[17]); \
+        MD5_GH(c, d, a, b, w[11], 14, md5tab[18]); \
+        MD5_GH(b, c, d, a, w[ 0], 20, md5tab[19]); \
+        MD5_GH(a, b, c, d, w[ 5],  5, md5tab[20]); \
+        MD5_GH(d, a, b, c, w[10],  9, md5tab[21]); \
+        MD5_GH(c, d, a, b, w[15], 14, md5tab[22]); \
+        MD5_GH(b, c, d, a, w[ 4], 20, md5tab[23]); \
+        MD5_GH(a, b, c, d, w[ 9],  5, md5tab[24]); \
+        MD5_GH(d, a, b, c, w[14],  9, md5tab[25]); \
+        MD5_GH(c, d, a, b, w[ 3], 14, md5tab[26]); \
+        MD5_GH(b, c, d, a, w[ 8], 20, md5tab[27]); \
+        MD5_GH(a, b, c, d, w[13],  5, md5tab[28]); \
+        MD5_GH(d, a, b, c, w[ 2],  9, md5tab[29]); \
+        MD5_GH(c, d, a, b, w[ 7], 14, md5tab[30]); \
+        MD5_GH(b, c, d, a, w[12], 20, md5tab[31]); \
+        \
+        /* Third Round */ \
+        MD5_HH(a, b, c, d, w[ 5],  4, md5tab[32]); \
+        MD5_HH(d, a, b, c, w[ 8], 11, md5tab[33]); \
+        MD5_HH(c, d, a, b, w[11], 16, md5tab[34]); \
+        MD5_HH(b, c, d, a, w[14], 23, md5tab[35]); \
+        MD5_HH(a, b, c, d, w[ 1],  4, md5tab[36]); \
+        MD5_HH(d, a, b, c, w[ 4], 11, md5tab[37]); \
+        MD5_HH(c, d, a, b, w[ 7], 16, md5tab[38]); \
+        MD5_HH(b, c, d, a, w[10], 23, md5tab[39]); \
+        MD5_HH(a, b, c, d, w[13],  4, md5tab[40]); \
+        MD5_HH(d, a, b, c, w[ 0], 11, md5tab[41]); \
+        MD5_HH(c, d, a, b, w[ 3], 16, md5tab[42]); \
+        MD5_HH(b, c, d, a, w[ 6], 23, md5tab[43]); \
+        MD5_HH(a, b, c, d, w[ 9],  4, md5tab[44]); \
+        MD5_HH(d, a, b, c, w[12], 11, md5tab[45]); \
+        MD5_HH(c, d, a, b, w[15], 16, md5tab[46]); \
+        MD5_HH(b, c, d, a, w[ 2], 23, md5tab[47]); \
+        \
+        /* Last Round */ \
+        MD5_IH(a, b, c, d, w[ 0],  6, md5tab[48]); \
+        MD5_IH(d, a, b, c, w[ 7], 10, md5tab[49]); \
+        MD5_IH(c, d, a, b, w[14], 15, md5tab[50]); \
+        MD5_IH(b, c, d, a, w[ 5], 21, md5tab[51]); \
+        MD5_IH(a, b, c, d, w[12],  6, md5tab[52]); \
+        MD5_IH(d, a, b, c, w[ 3], 10, md5tab[53]); \
+        MD5_IH(c, d, a, b, w[10], 15, md5tab[54]); \
+        MD5_IH(b, c, d, a, w[ 1], 21, md5tab[55]); \
+        MD5_IH(a, b, c, d, w[ 8],  6, md5tab[56]); \
+        MD5_IH(d, a, b, c, w[15], 10, md5tab[57]); \
+        MD5_IH(c, d, a, b, w[ 6], 15, md5tab[58]); \
+        MD5_IH(b, c, d, a, w[13], 21, md5tab[59]); \
+        MD5_IH(a, b, c, d, w[ 4],  6, md5tab[60]); \
+        MD5_IH(d, a, b, c, w[11], 10, md5tab[61]); \
+        MD5_IH(c, d, a, b, w[ 2], 15, md5tab[62]); \
+        MD5_IH(b, c, d, a, w[ 9], 21, md5tab[63]); \
+    }
+
+typedef md5_ctx_t kos_md5_cxt_t;
 
 static void kos_md5_start(kos_md5_cxt_t *cxt) {
     cxt->size = 0;
@@ -173,77 +249,7 @@ static void kos_md5_process(kos_md5_cxt_t *cxt, const uint8_t *input) {
                (input[(i << 2) + 2] << 16) | (input[(i << 2) + 3] << 24);
     }
 
-    /* First Round */
-    MD5_FH(a, b, c, d, w[ 0],  7, md5tab[ 0]);
-    MD5_FH(d, a, b, c, w[ 1], 12, md5tab[ 1]);
-    MD5_FH(c, d, a, b, w[ 2], 17, md5tab[ 2]);
-    MD5_FH(b, c, d, a, w[ 3], 22, md5tab[ 3]);
-    MD5_FH(a, b, c, d, w[ 4],  7, md5tab[ 4]);
-    MD5_FH(d, a, b, c, w[ 5], 12, md5tab[ 5]);
-    MD5_FH(c, d, a, b, w[ 6], 17, md5tab[ 6]);
-    MD5_FH(b, c, d, a, w[ 7], 22, md5tab[ 7]);
-    MD5_FH(a, b, c, d, w[ 8],  7, md5tab[ 8]);
-    MD5_FH(d, a, b, c, w[ 9], 12, md5tab[ 9]);
-    MD5_FH(c, d, a, b, w[10], 17, md5tab[10]);
-    MD5_FH(b, c, d, a, w[11], 22, md5tab[11]);
-    MD5_FH(a, b, c, d, w[12],  7, md5tab[12]);
-    MD5_FH(d, a, b, c, w[13], 12, md5tab[13]);
-    MD5_FH(c, d, a, b, w[14], 17, md5tab[14]);
-    MD5_FH(b, c, d, a, w[15], 22, md5tab[15]);
-
-    /* Second Round */
-    MD5_GH(a, b, c, d, w[ 1],  5, md5tab[16]);
-    MD5_GH(d, a, b, c, w[ 6],  9, md5tab[17]);
-    MD5_GH(c, d, a, b, w[11], 14, md5tab[18]);
-    MD5_GH(b, c, d, a, w[ 0], 20, md5tab[19]);
-    MD5_GH(a, b, c, d, w[ 5],  5, md5tab[20]);
-    MD5_GH(d, a, b, c, w[10],  9, md5tab[21]);
-    MD5_GH(c, d, a, b, w[15], 14, md5tab[22]);
-    MD5_GH(b, c, d, a, w[ 4], 20, md5tab[23]);
-    MD5_GH(a, b, c, d, w[ 9],  5, md5tab[24]);
-    MD5_GH(d, a, b, c, w[14],  9, md5tab[25]);
-    MD5_GH(c, d, a, b, w[ 3], 14, md5tab[26]);
-    MD5_GH(b, c, d, a, w[ 8], 20, md5tab[27]);
-    MD5_GH(a, b, c, d, w[13],  5, md5tab[28]);
-    MD5_GH(d, a, b, c, w[ 2],  9, md5tab[29]);
-    MD5_GH(c, d, a, b, w[ 7], 14, md5tab[30]);
-    MD5_GH(b, c, d, a, w[12], 20, md5tab[31]);
-
-    /* Third Round */
-    MD5_HH(a, b, c, d, w[ 5],  4, md5tab[32]);
-    MD5_HH(d, a, b, c, w[ 8], 11, md5tab[33]);
-    MD5_HH(c, d, a, b, w[11], 16, md5tab[34]);
-    MD5_HH(b, c, d, a, w[14], 23, md5tab[35]);
-    MD5_HH(a, b, c, d, w[ 1],  4, md5tab[36]);
-    MD5_HH(d, a, b, c, w[ 4], 11, md5tab[37]);
-    MD5_HH(c, d, a, b, w[ 7], 16, md5tab[38]);
-    MD5_HH(b, c, d, a, w[10], 23, md5tab[39]);
-    MD5_HH(a, b, c, d, w[13],  4, md5tab[40]);
-    MD5_HH(d, a, b, c, w[ 0], 11, md5tab[41]);
-    MD5_HH(c, d, a, b, w[ 3], 16, md5tab[42]);
-    MD5_HH(b, c, d, a, w[ 6], 23, md5tab[43]);
-    MD5_HH(a, b, c, d, w[ 9],  4, md5tab[44]);
-    MD5_HH(d, a, b, c, w[12], 11, md5tab[45]);
-    MD5_HH(c, d, a, b, w[15], 16, md5tab[46]);
-    MD5_HH(b, c, d, a, w[ 2], 23, md5tab[47]);
-
-    /* Last Round */
-    MD5_IH(a, b, c, d, w[ 0],  6, md5tab[48]);
-    MD5_IH(d, a, b, c, w[ 7], 10, md5tab[49]);
-    MD5_IH(c, d, a, b, w[14], 15, md5tab[50]);
-    MD5_IH(b, c, d, a, w[ 5], 21, md5tab[51]);
-    MD5_IH(a, b, c, d, w[12],  6, md5tab[52]);
-    MD5_IH(d, a, b, c, w[ 3], 10, md5tab[53]);
-    MD5_IH(c, d, a, b, w[10], 15, md5tab[54]);
-    MD5_IH(b, c, d, a, w[ 1], 21, md5tab[55]);
-    MD5_IH(a, b, c, d, w[ 8],  6, md5tab[56]);
-    MD5_IH(d, a, b, c, w[15], 10, md5tab[57]);
-    MD5_IH(c, d, a, b, w[ 6], 15, md5tab[58]);
-    MD5_IH(b, c, d, a, w[13], 21, md5tab[59]);
-    MD5_IH(a, b, c, d, w[ 4],  6, md5tab[60]);
-    MD5_IH(d, a, b, c, w[11], 10, md5tab[61]);
-    MD5_IH(c, d, a, b, w[ 2], 15, md5tab[62]);
-    MD5_IH(b, c, d, a, w[ 9], 21, md5tab[63]);
+    MD5_ROUNDS(a, b, c, d, w);
 
     /* Save out what we have */
     cxt->hash[0] += a;
@@ -253,15 +259,15 @@ static void kos_md5_process(kos_md5_cxt_t *cxt, const uint8_t *input) {
 }
 
 static void kos_md5_hash_block(kos_md5_cxt_t *cxt, const uint8_t *input,
-                               uint32_t size) {
-    uint32_t left, copy;
+                               size_t size) {
+    size_t left, copy;
 
     /* Figure out what we had left over from last time (if anything) */
-    left = (uint32_t)((cxt->size >> 3) & 0x3F);
+    left = (size_t)((cxt->size >> 3) & 0x3F);
     copy = 64 - left;
 
     /* Update the size */
-    cxt->size += (size << 3);
+    cxt->size += ((uint64_t)size << 3);
 
     /* Deal with what was left over, if we have enough data to do so */
     if(left && size >= copy) {
@@ -312,6 +318,65 @@ static void kos_md5_finish(kos_md5_cxt_t *cxt, uint8_t output[16]) {
     }
 }
 
+void md5_init(md5_ctx_t *ctx) {
+    kos_md5_start(ctx);
+}
+
+void md5_update(md5_ctx_t *ctx, const void *input, size_t size) {
+    kos_md5_hash_block(ctx, (const uint8_t *)input, size);
+}
+
+void md5_final(md5_ctx_t *ctx, uint8_t output[16]) {
+    kos_md5_finish(ctx, output);
+}
+
+/* Hash a file by mapping it in a window at a time, rather than reading it into
+   a buffer. The window keeps the address space used bounded for large files
+   (and on 32-bit systems), and is a multiple of any sane page size. */
+#define MD5_FILE_WINDOW (1 << 26)
+
+int md5_file(const char *fn, uint8_t output[16]) {
+    md5_ctx_t cxt;
+    struct stat st;
+    off_t off = 0;
+    size_t len;
+    void *map;
+    int fd;
+
+    if((fd = open(fn, O_RDONLY)) < 0)
+        return -1;
+
+    if(fstat(fd, &st)) {
+        close(fd);
+        return -1;
+    }
+
+    kos_md5_start(&cxt);
+
+    while(off < st.st_size) {
+        if(st.st_size - off > MD5_FILE_WINDOW)
+            len = MD5_FILE_WINDOW;
+        else
+            len = (size_t)(st.st_size - off);
+
+        map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, off);
+
+        if(map == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+
+        madvise(map, len, MADV_SEQUENTIAL);
+        kos_md5_hash_block(&cxt, (const uint8_t *)map, len);
+        munmap(map, len);
+        off += len;
+    }
+
+    close(fd);
+    kos_md5_finish(&cxt, output);
+    return 0;
+}
+
 /* Convenience function for computing an MD5 of a complete block. */
 void md5(const uint8_t *input, uint32_t size, uint8_t output[16]) {
     kos_md5_cxt_t cxt;
@@ -320,3 +385,206 @@ void md5(const uint8_t *input, uint32_t size, uint8_t output[16]) {
     kos_md5_hash_block(&cxt, input, size);
     kos_md5_finish(&cxt, output);
 }
+
+/* Multi-buffer MD5. MD5 can't be sped up much on a single message, since
+   every step depends on the one before it, but the same steps can be done for
+   several unrelated messages at once in the lanes of a vector register. Each
+   lane works through its own message (and then its padding), and when one
+   finishes, the next message in the batch takes over that lane. */
+#define MD5_MAX_LANES 16
+
+typedef struct md5_lane {
+    const uint8_t *data;                /* Next full block of the input */
+    const uint8_t *tail;                /* Next block of buf */
+    uint32_t full;                      /* Full blocks of input left */
+    uint32_t tail_blocks;               /* Blocks of buf left */
+    int idx;                            /* Input in this lane, or -1 */
+    uint8_t buf[128];                   /* Last partial block and padding */
+} md5_lane_t;
+
+typedef void (*md5_compress_t)(uint32_t st[4][MD5_MAX_LANES],
+                               const uint8_t *blk[MD5_MAX_LANES]);
+
+#ifdef __GNUC__
+#if defined(__BIG_ENDIAN__) || defined(WORDS_BIGENDIAN)
+#define MD5_LE32(x) __builtin_bswap32(x)
+#else
+#define MD5_LE32(x) (x)
+#endif
+
+/* Compress one block for each lane. st[i][l] is word i of the hash in lane l.
+   The MD5 macros work just as well on vectors as they do on plain integers,
+   so this is the same code as kos_md5_process, just with a vector type. */
+#define MD5_COMPRESS_VEC(name, vtype, lanes, attr) \
+attr static void name(uint32_t st[4][MD5_MAX_LANES], \
+                      const uint8_t *blk[MD5_MAX_LANES]) { \
+    vtype a, b, c, d, a0, b0, c0, d0, w[16]; \
+    uint32_t words[16][lanes], tmp; \
+    int i, l; \
+    \
+    memcpy(&a0, st[0], sizeof(vtype)); \
+    memcpy(&b0, st[1], sizeof(vtype)); \
+    memcpy(&c0, st[2], sizeof(vtype)); \
+    memcpy(&d0, st[3], sizeof(vtype)); \
+    a = a0; \
+    b = b0; \
+    c = c0; \
+    d = d0; \
+    \
+    /* Transpose the blocks, so that w[i] holds word i of every lane. */ \
+    for(l = 0; l < lanes; ++l) { \
+        for(i = 0; i < 16; ++i) { \
+            memcpy(&tmp, blk[l] + (i << 2), 4); \
+            words[i][l] = MD5_LE32(tmp); \
+        } \
+    } \
+    \
+    memcpy(w, words, sizeof(w)); \
+    \
+    MD5_ROUNDS(a, b, c, d, w); \
+    \
+    a += a0; \
+    b += b0; \
+    c += c0; \
+    d += d0; \
+    memcpy(st[0], &a, sizeof(vtype)); \
+    memcpy(st[1], &b, sizeof(vtype)); \
+    memcpy(st[2], &c, sizeof(vtype)); \
+    memcpy(st[3], &d, sizeof(vtype)); \
+}
+
+typedef uint32_t md5_v4_t __attribute__((vector_size(16)));
+MD5_COMPRESS_VEC(md5_compress_x4, md5_v4_t, 4, )
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_MD5_X86_LANES
+typedef uint32_t md5_v8_t __attribute__((vector_size(32)));
+typedef uint32_t md5_v16_t __attribute__((vector_size(64)));
+MD5_COMPRESS_VEC(md5_compress_x8, md5_v8_t, 8,
+                 __attribute__((target("avx2"))))
+MD5_COMPRESS_VEC(md5_compress_x16, md5_v16_t, 16,
+                 __attribute__((target("avx512f"))))
+#endif
+
+static void md5_lane_start(md5_lane_t *lane, uint32_t st[4][MD5_MAX_LANES],
+                           int l, int idx, const uint8_t *input,
+                           uint32_t size) {
+    uint64_t bits = (uint64_t)size << 3;
+    uint32_t left = size & 0x3F;
+    uint8_t *end;
+    int i;
+
+    lane->idx = idx;
+    lane->data = input;
+    lane->full = size >> 6;
+    lane->tail = lane->buf;
+    lane->tail_blocks = left < 56 ? 1 : 2;
+
+    /* The leftover bytes, the padding, and the length all go into buf, so
+       the last block or two can be fed in just like the rest. */
+    memset(lane->buf, 0, sizeof(lane->buf));
+    memcpy(lane->buf, input + (size & ~0x3F), left);
+    lane->buf[left] = 0x80;
+    end = lane->buf + (lane->tail_blocks << 6) - 8;
+
+    for(i = 0; i < 8; ++i) {
+        end[i] = (uint8_t)(bits >> (i << 3));
+    }
+
+    for(i = 0; i < 4; ++i) {
+        st[i][l] = md5initial[i];
+    }
+}
+
+static void md5_batch_lanes(const uint8_t *const inputs[],
+                            const uint32_t sizes[], int count,
+                            uint8_t outputs[][16], int width,
+                            md5_compress_t compress) {
+    md5_lane_t lanes[MD5_MAX_LANES];
+    uint32_t st[4][MD5_MAX_LANES];
+    const uint8_t *blk[MD5_MAX_LANES];
+    int next = 0, active = 0, l, i;
+
+    memset(st, 0, sizeof(st));
+
+    for(l = 0; l < width; ++l) {
+        lanes[l].idx = -1;
+    }
+
+    for(;;) {
+        /* Write out anything that's done and fill up any idle lanes. */
+        for(l = 0; l < width; ++l) {
+            if(lanes[l].idx >= 0 && !lanes[l].full && !lanes[l].tail_blocks) {
+                for(i = 0; i < 16; ++i) {
+                    outputs[lanes[l].idx][i] =
+                        (uint8_t)(st[i >> 2][l] >> ((i & 0x03) << 3));
+                }
+
+                lanes[l].idx = -1;
+                --active;
+            }
+
+            if(lanes[l].idx < 0 && next < count) {
+                md5_lane_start(&lanes[l], st, l, next, inputs[next],
+                               sizes[next]);
+                ++next;
+                ++active;
+            }
+        }
+
+        if(!active)
+            break;
+
+        for(l = 0; l < width; ++l) {
+            if(lanes[l].idx < 0) {
+                /* Idle lanes still get hashed, but nothing uses them. */
+                blk[l] = md5padding;
+            }
+            else if(lanes[l].full) {
+                blk[l] = lanes[l].data;
+                lanes[l].data += 64;
+                --lanes[l].full;
+            }
+            else {
+                blk[l] = lanes[l].tail;
+                lanes[l].tail += 64;
+                --lanes[l].tail_blocks;
+            }
+        }
+
+        compress(st, blk);
+    }
+}
+#endif /* __GNUC__ */
+
+/* Compute the MD5 of each of a set of independent blocks of data. */
+void md5_batch(const uint8_t *const inputs[], const uint32_t sizes[],
+               int count, uint8_t outputs[][16]) {
+#ifdef __GNUC__
+    int width = 4;
+    md5_compress_t compress = &md5_compress_x4;
+
+#ifdef HAVE_MD5_X86_LANES
+    __builtin_cpu_init();
+
+    /* Only go wide when there's enough to fill most of the lanes. */
+    if(count >= 12 && __builtin_cpu_supports("avx512f")) {
+        width = 16;
+        compress = &md5_compress_x16;
+    }
+    else if(count >= 6 && __builtin_cpu_supports("avx2")) {
+        width = 8;
+        compress = &md5_compress_x8;
+    }
+#endif
+
+    if(count >= 2) {
+        md5_batch_lanes(inputs, sizes, count, outputs, width, compress);
+        return;
+    }
+#endif
+
+    while(count-- > 0) {
+        md5(*inputs++, *sizes++, *outputs++);
+    }
+}
@@ -1,7 +1,7 @@
 /*
     This file is part of Sylverant PSO Server.
 
-    Copyright (C) 2014, 2021 Lawrence Sebald
+    Copyright (C) 2014, 2021, 2026 Lawrence Sebald
 
     This program is free software: you can redistribute it and/or modify
     it under the terms of the GNU Affero General Public License version 3
@@ -19,52 +19,458 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 #include "sylverant/memory.h"
 
 /* So... Fair warning, this stuff is a bit ugly. It should work nicely enough
    though... */
 
+#ifdef REF_DEBUG
+/* One place objects are allocated from (or really, one tag, file and line),
+   and how many of the objects from there are still around. These are never
+   freed, and are only ever added to the front of a hash chain, so they can be
+   looked up without a lock. */
+typedef struct ref_site {
+    struct ref_site *next;
+    const char *tag;
+    const char *file;
+    int line;
+    atomic_size_t live;
+    atomic_size_t bytes;
+    atomic_size_t total;
+} ref_site_t;
+
+#define REF_SITE_BUCKETS 1024
+
+static _Atomic(ref_site_t *) ref_sites[REF_SITE_BUCKETS];
+#endif
+
 /* Underlying structure that represents a reference object. This version is
-   not padded out to a nice size, which is taken care of below. */
+   not padded out to a nice size, which is taken care of below. With debugging
+   on, the header grows by 16 bytes to say where the object came from. */
 struct ref_unpadded {
     void (*dtor)(void *);
-    uint32_t refcnt;
+    atomic_uint refcnt;
     uint32_t magic;
+    uint32_t sclass;
+#ifdef REF_DEBUG
+    ref_site_t *site;
+    size_t size;
+#endif
 };
 
 #define USZ sizeof(struct ref_unpadded)
+#ifdef REF_DEBUG
+#define PSZ 48
+#else
 #define PSZ 32
+#endif
 #define RMAGIC 0x1BADC0DE
+#define RFREE  0xDEADC0DE               /* Block is sitting in a pool */
+#define RPOISON 0xDEADBEEF              /* Same, and its contents are poisoned */
 
 /* Actual reference structure, to give us a nicely sized structure that we can
    use for reference counting. */
 struct ref {
     struct ref_unpadded r;
-    uint8_t padding[PSZ - USZ];
+    union {
+        struct ref *next;               /* Next free block, while in a pool */
+        uint8_t padding[PSZ - USZ];
+    };
+};
+
+/* Small objects come out of pools of fixed size blocks (size classes), carved
+   out of bigger slabs, rather than each being its own malloc. Each thread
+   keeps a few free blocks of each size to itself, so most allocations and
+   frees don't have to take any lock at all, and only go to the shared pool
+   for a batch of blocks at a time. Anything bigger than the largest class
+   goes straight to malloc. Slabs are never given back, but since each one is
+   only ever split into blocks of one size, they don't fragment either. */
+static const size_t ref_class_size[] = {
+    64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, 2048, 3072, 4096
 };
 
-void *ref_alloc(size_t sz, void (*dtor)(void *)) {
+#define REF_CLASSES     (sizeof(ref_class_size) / sizeof(ref_class_size[0]))
+#define REF_LARGE       0xFFFFFFFF      /* sclass for malloc'd objects */
+#define REF_SLAB_SIZE   65536
+#define REF_CACHE_MAX   32              /* Per class, per thread */
+#define REF_CACHE_MOVE  (REF_CACHE_MAX / 2)
+
+/* Poison patterns for freed and newly allocated objects. */
+#define REF_POISON_FREE 0xDD
+#define REF_POISON_NEW  0xCD
+
+typedef struct ref_slab {
+    struct ref_slab *next;
+} ref_slab_t;
+
+typedef struct ref_pool {
+    pthread_mutex_t lock;
+    struct ref *free;
+    ref_slab_t *slabs;
+    size_t nslabs;
+    size_t blocks;
+    size_t nfree;
+} ref_pool_t;
+
+typedef struct ref_tcache {
+    struct ref_tcache *next;
+    struct ref_tcache *prev;
+    struct ref *free[REF_CLASSES];
+    atomic_int count[REF_CLASSES];
+} ref_tcache_t;
+
+static ref_pool_t pools[REF_CLASSES];
+static ref_tcache_t tcaches = { .next = &tcaches, .prev = &tcaches };
+static pthread_mutex_t tcache_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key;
+static __thread ref_tcache_t *tcache;
+static atomic_size_t large_in_use;
+static atomic_int poison;
+
+static void tcache_flush(ref_tcache_t *tc, unsigned int c, int count);
+
+/* Give everything in a thread's cache back to the shared pools when the
+   thread exits. */
+static void tcache_dtor(void *d) {
+    ref_tcache_t *tc = (ref_tcache_t *)d;
+    unsigned int i;
+
+    for(i = 0; i < REF_CLASSES; ++i) {
+        tcache_flush(tc, i, atomic_load_explicit(&tc->count[i],
+                                                 memory_order_relaxed));
+    }
+
+    pthread_mutex_lock(&tcache_lock);
+    tc->prev->next = tc->next;
+    tc->next->prev = tc->prev;
+    pthread_mutex_unlock(&tcache_lock);
+
+    free(tc);
+    tcache = NULL;
+}
+
+static void pool_init(void) {
+    unsigned int i;
+
+    for(i = 0; i < REF_CLASSES; ++i) {
+        pthread_mutex_init(&pools[i].lock, NULL);
+    }
+
+    pthread_key_create(&tcache_key, &tcache_dtor);
+}
+
+static ref_tcache_t *tcache_get(void) {
+    ref_tcache_t *tc;
+
+    if((tc = tcache))
+        return tc;
+
+    pthread_once(&pool_once, &pool_init);
+
+    if(!(tc = (ref_tcache_t *)calloc(1, sizeof(ref_tcache_t))))
+        return NULL;
+
+    pthread_mutex_lock(&tcache_lock);
+    tc->next = tcaches.next;
+    tc->prev = &tcaches;
+    tcaches.next->prev = tc;
+    tcaches.next = tc;
+    pthread_mutex_unlock(&tcache_lock);
+
+    pthread_setspecific(tcache_key, tc);
+    tcache = tc;
+    return tc;
+}
+
+static unsigned int size_class(size_t sz) {
+    unsigned int i;
+
+    for(i = 0; i < REF_CLASSES; ++i) {
+        if(sz <= ref_class_size[i])
+            return i;
+    }
+
+    return REF_LARGE;
+}
+
+/* Move count blocks from the thread's cache back to the shared pool. */
+static void tcache_flush(ref_tcache_t *tc, unsigned int c, int count) {
+    ref_pool_t *p = &pools[c];
+    struct ref *first, *last;
+    int i;
+
+    if(count <= 0)
+        return;
+
+    first = last = tc->free[c];
+
+    for(i = 1; i < count; ++i) {
+        last = last->next;
+    }
+
+    tc->free[c] = last->next;
+    atomic_store_explicit(&tc->count[c],
+                          atomic_load_explicit(&tc->count[c],
+                                               memory_order_relaxed) - count,
+                          memory_order_relaxed);
+
+    pthread_mutex_lock(&p->lock);
+    last->next = p->free;
+    p->free = first;
+    p->nfree += count;
+    pthread_mutex_unlock(&p->lock);
+}
+
+/* Move a batch of blocks from the shared pool into the thread's cache, carving
+   up a new slab first if the pool is empty. */
+static int tcache_refill(ref_tcache_t *tc, unsigned int c) {
+    ref_pool_t *p = &pools[c];
+    size_t bsz = ref_class_size[c], i, n;
+    ref_slab_t *slab;
+    struct ref *r, *first, *last;
+    uint8_t *base;
+
+    pthread_mutex_lock(&p->lock);
+
+    if(!p->free) {
+        if(!(slab = (ref_slab_t *)malloc(REF_SLAB_SIZE))) {
+            pthread_mutex_unlock(&p->lock);
+            return -1;
+        }
+
+        slab->next = p->slabs;
+        p->slabs = slab;
+        ++p->nslabs;
+
+        /* The start of the slab is taken up by the link to the next one, so
+           start with the first whole block after that. */
+        base = (uint8_t *)slab + PSZ;
+        n = (REF_SLAB_SIZE - PSZ) / bsz;
+
+        for(i = n; i > 0; --i) {
+            r = (struct ref *)(base + (i - 1) * bsz);
+            r->r.magic = RFREE;
+            r->r.sclass = c;
+            r->next = p->free;
+            p->free = r;
+        }
+
+        p->blocks += n;
+        p->nfree += n;
+    }
+
+    first = last = p->free;
+
+    for(n = 1; n < REF_CACHE_MOVE && last->next; ++n) {
+        last = last->next;
+    }
+
+    p->free = last->next;
+    p->nfree -= n;
+    pthread_mutex_unlock(&p->lock);
+
+    last->next = tc->free[c];
+    tc->free[c] = first;
+    atomic_store_explicit(&tc->count[c],
+                          atomic_load_explicit(&tc->count[c],
+                                               memory_order_relaxed) + (int)n,
+                          memory_order_relaxed);
+    return 0;
+}
+
+static void poison_check(struct ref *r) {
+    const uint8_t *ptr = ((const uint8_t *)r) + PSZ;
+    size_t i, len = ref_class_size[r->r.sclass] - PSZ;
+
+    for(i = 0; i < len; ++i) {
+        if(ptr[i] != REF_POISON_FREE) {
+            fprintf(stderr, "ref_alloc: object at %p was written to after "
+                    "being freed (offset %zu)\n", (void *)ptr, i);
+            abort();
+        }
+    }
+}
+
+static struct ref *pool_alloc(unsigned int c) {
+    ref_tcache_t *tc;
     struct ref *r;
+
+    if(!(tc = tcache_get()))
+        return NULL;
+
+    if(!tc->free[c] && tcache_refill(tc, c))
+        return NULL;
+
+    r = tc->free[c];
+    tc->free[c] = r->next;
+    atomic_store_explicit(&tc->count[c],
+                          atomic_load_explicit(&tc->count[c],
+                                               memory_order_relaxed) - 1,
+                          memory_order_relaxed);
+
+    if(r->r.magic == RPOISON)
+        poison_check(r);
+
+    if(atomic_load_explicit(&poison, memory_order_relaxed))
+        memset(((uint8_t *)r) + PSZ, REF_POISON_NEW,
+               ref_class_size[c] - PSZ);
+
+    return r;
+}
+
+#ifdef REF_DEBUG
+static ref_site_t *site_get(const char *tag, const char *file, int line) {
+    uintptr_t h;
+    _Atomic(ref_site_t *) *b;
+    ref_site_t *head, *s, *ns = NULL;
+
+    h = ((uintptr_t)tag * 31 + (uintptr_t)file) * 31 + (uintptr_t)line;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6DU;
+    h ^= h >> 12;
+    b = &ref_sites[h & (REF_SITE_BUCKETS - 1)];
+    head = atomic_load_explicit(b, memory_order_acquire);
+
+    for(;;) {
+        for(s = head; s; s = s->next) {
+            if(s->tag == tag && s->file == file && s->line == line) {
+                free(ns);
+                return s;
+            }
+        }
+
+        if(!ns) {
+            if(!(ns = (ref_site_t *)calloc(1, sizeof(ref_site_t))))
+                return NULL;
+
+            ns->tag = tag;
+            ns->file = file;
+            ns->line = line;
+        }
+
+        /* If someone else got in first, look through what they added. */
+        ns->next = head;
+        if(atomic_compare_exchange_weak_explicit(b, &head, ns,
+                                                 memory_order_release,
+                                                 memory_order_acquire))
+            return ns;
+    }
+}
+
+static const char *site_name(const ref_site_t *s) {
+    return s->tag ? s->tag : s->file;
+}
+#endif
+
+static void ref_dealloc(struct ref *rf) {
+    ref_tcache_t *tc;
+    unsigned int c = rf->r.sclass;
+
+#ifdef REF_DEBUG
+    if(rf->r.site) {
+        atomic_fetch_sub_explicit(&rf->r.site->live, 1, memory_order_relaxed);
+        atomic_fetch_sub_explicit(&rf->r.site->bytes, rf->r.size,
+                                  memory_order_relaxed);
+    }
+#endif
+
+    if(c == REF_LARGE) {
+        rf->r.magic = RFREE;
+        atomic_fetch_sub_explicit(&large_in_use, 1, memory_order_relaxed);
+        free(rf);
+        return;
+    }
+
+    if(atomic_load_explicit(&poison, memory_order_relaxed)) {
+        memset(((uint8_t *)rf) + PSZ, REF_POISON_FREE,
+               ref_class_size[c] - PSZ);
+        rf->r.magic = RPOISON;
+    }
+    else {
+        rf->r.magic = RFREE;
+    }
+
+    /* If this thread can't get a cache, the block goes right back to the
+       shared pool. */
+    if(!(tc = tcache_get())) {
+        pthread_mutex_lock(&pools[c].lock);
+        rf->next = pools[c].free;
+        pools[c].free = rf;
+        ++pools[c].nfree;
+        pthread_mutex_unlock(&pools[c].lock);
+        return;
+    }
+
+    rf->next = tc->free[c];
+    tc->free[c] = rf;
+
+    if(atomic_fetch_add_explicit(&tc->count[c], 1, memory_order_relaxed) + 1 >=
+       REF_CACHE_MAX)
+        tcache_flush(tc, c, REF_CACHE_MOVE);
+}
+
+void *ref_alloc_at(size_t sz, void (*dtor)(void *), const char *tag,
+                   const char *file, int line) {
+    struct ref *r;
+    unsigned int c;
     uint8_t *ptr;
 
     assert(PSZ == sizeof(struct ref));
 
-    /* Allocate space for the object and the reference counting overhead. */
-    if(!(r = (struct ref *)malloc(sz + PSZ)))
+    if(sz > SIZE_MAX - PSZ)
         return NULL;
 
+    /* Allocate space for the object and the reference counting overhead. */
+    if((c = size_class(sz + PSZ)) != REF_LARGE) {
+        if(!(r = pool_alloc(c)))
+            return NULL;
+    }
+    else {
+        if(!(r = (struct ref *)malloc(sz + PSZ)))
+            return NULL;
+
+        atomic_fetch_add_explicit(&large_in_use, 1, memory_order_relaxed);
+    }
+
     /* Fill in the reference couting data. */
     r->r.dtor = dtor;
-    r->r.refcnt = 1;
+    atomic_init(&r->r.refcnt, 1);
     r->r.magic = RMAGIC;
+    r->r.sclass = c;
+
+#ifdef REF_DEBUG
+    if(!file)
+        file = "(unknown)";
+
+    r->r.size = sz;
+
+    if((r->r.site = site_get(tag, file, line))) {
+        atomic_fetch_add_explicit(&r->r.site->live, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&r->r.site->bytes, sz, memory_order_relaxed);
+        atomic_fetch_add_explicit(&r->r.site->total, 1, memory_order_relaxed);
+    }
+#else
+    (void)tag;
+    (void)file;
+    (void)line;
+#endif
 
     /* Return the actual pointer to the object. */
     ptr = ((uint8_t *)r) + PSZ;
     return (void *)ptr;
 }
 
+/* For anything that calls it without going through the macro in memory.h. */
+void *(ref_alloc)(size_t sz, void (*dtor)(void *)) {
+    return ref_alloc_at(sz, dtor, NULL, NULL, 0);
+}
+
 void *ref_retain(void *r) {
     uint8_t *ptr = (uint8_t *)r;
     struct ref *rf;
@@ -80,7 +486,9 @@ void *ref_retain(void *r) {
     if(rf->r.magic != RMAGIC)
         return NULL;
 
-    ++rf->r.refcnt;
+    /* Whoever gave us the pointer already holds a reference, so nothing else
+       can be depending on the order of this. */
+    atomic_fetch_add_explicit(&rf->r.refcnt, 1, memory_order_relaxed);
 
     return r;
 }
@@ -100,12 +508,18 @@ void *ref_release(void *r) {
     if(rf->r.magic != RMAGIC)
         return NULL;
 
-    /* Decrement the reference count and deallocate the object, if needed. */
-    if(!--rf->r.refcnt) {
+    /* Decrement the reference count and deallocate the object, if needed. The
+       release makes sure everything this thread did with the object happens
+       before the count drops, and the acquire fence makes sure the thread that
+       frees it sees everything every other thread did before letting go. */
+    if(atomic_fetch_sub_explicit(&rf->r.refcnt, 1,
+                                 memory_order_release) == 1) {
+        atomic_thread_fence(memory_order_acquire);
+
         if(rf->r.dtor)
             rf->r.dtor(r);
 
-        free(rf);
+        ref_dealloc(rf);
         r = NULL;
     }
 
@@ -131,8 +545,176 @@ void *ref_free(void *r, int skip_dtor) {
     if(!skip_dtor && rf->r.dtor)
         rf->r.dtor(r);
 
-    free(rf);
+    ref_dealloc(rf);
     r = NULL;
 
     return r;
 }
+
+void ref_pool_poison(int enable) {
+    atomic_store(&poison, enable ? 1 : 0);
+}
+
+int ref_pool_stats(ref_pool_stats_t *st, int max) {
+    ref_tcache_t *tc;
+    size_t cached[REF_CLASSES] = { 0 };
+    unsigned int i;
+    int n = 0;
+
+    pthread_once(&pool_once, &pool_init);
+
+    /* The per-thread counts are only a snapshot, since the threads keep going
+       while we look. */
+    pthread_mutex_lock(&tcache_lock);
+
+    for(tc = tcaches.next; tc != &tcaches; tc = tc->next) {
+        for(i = 0; i < REF_CLASSES; ++i) {
+            cached[i] += atomic_load_explicit(&tc->count[i],
+                                              memory_order_relaxed);
+        }
+    }
+
+    pthread_mutex_unlock(&tcache_lock);
+
+    for(i = 0; i < REF_CLASSES && n < max; ++i, ++n) {
+        pthread_mutex_lock(&pools[i].lock);
+        st[n].size = ref_class_size[i];
+        st[n].slabs = pools[i].nslabs;
+        st[n].blocks = pools[i].blocks;
+        st[n].free = pools[i].nfree;
+        pthread_mutex_unlock(&pools[i].lock);
+
+        st[n].cached = cached[i];
+
+        if(st[n].free + st[n].cached <= st[n].blocks)
+            st[n].in_use = st[n].blocks - st[n].free - st[n].cached;
+        else
+            st[n].in_use = 0;
+    }
+
+    /* Last of all, the objects too big for any class. */
+    if(n < max) {
+        memset(&st[n], 0, sizeof(ref_pool_stats_t));
+        st[n].in_use = atomic_load_explicit(&large_in_use,
+                                            memory_order_relaxed);
+        ++n;
+    }
+
+    return n;
+}
+
+#ifdef REF_DEBUG
+int ref_tag_stats(ref_tag_stats_t *st, int max) {
+    ref_site_t *s;
+    const char *name;
+    int i, j, n = 0;
+
+    for(i = 0; i < REF_SITE_BUCKETS; ++i) {
+        s = atomic_load_explicit(&ref_sites[i], memory_order_acquire);
+
+        for(; s; s = s->next) {
+            name = site_name(s);
+
+            /* The same tag can come from any number of places. */
+            for(j = 0; j < n; ++j) {
+                if(!strcmp(st[j].tag, name))
+                    break;
+            }
+
+            if(j == n) {
+                if(n == max)
+                    continue;
+
+                st[n].tag = name;
+                st[n].live = st[n].bytes = st[n].total = 0;
+                ++n;
+            }
+
+            st[j].live += atomic_load_explicit(&s->live, memory_order_relaxed);
+            st[j].bytes += atomic_load_explicit(&s->bytes,
+                                                memory_order_relaxed);
+            st[j].total += atomic_load_explicit(&s->total,
+                                                memory_order_relaxed);
+        }
+    }
+
+    return n;
+}
+
+static int tag_cmp(const void *a, const void *b) {
+    const ref_tag_stats_t *x = (const ref_tag_stats_t *)a;
+    const ref_tag_stats_t *y = (const ref_tag_stats_t *)b;
+
+    if(x->bytes != y->bytes)
+        return x->bytes < y->bytes ? 1 : -1;
+
+    return strcmp(x->tag, y->tag);
+}
+
+void ref_debug_dump(FILE *fp) {
+    ref_tag_stats_t *st;
+    ref_site_t *s;
+    size_t live;
+    char where[256];
+    int i, n = 0;
+
+    /* Count the sites, since there can't be more tags than that. */
+    for(i = 0; i < REF_SITE_BUCKETS; ++i) {
+        s = atomic_load_explicit(&ref_sites[i], memory_order_acquire);
+
+        for(; s; s = s->next) {
+            ++n;
+        }
+    }
+
+    if(!n) {
+        fprintf(fp, "No reference counted objects allocated\n");
+        return;
+    }
+
+    if(!(st = (ref_tag_stats_t *)malloc(n * sizeof(ref_tag_stats_t)))) {
+        fprintf(fp, "Out of memory dumping reference counted objects\n");
+        return;
+    }
+
+    /* Biggest users of memory first. */
+    n = ref_tag_stats(st, n);
+    qsort(st, n, sizeof(ref_tag_stats_t), &tag_cmp);
+
+    fprintf(fp, "%-32s %10s %12s %10s\n", "tag", "live", "bytes", "total");
+
+    for(i = 0; i < n; ++i) {
+        fprintf(fp, "%-32s %10zu %12zu %10zu\n", st[i].tag, st[i].live,
+                st[i].bytes, st[i].total);
+    }
+
+    free(st);
+
+    fprintf(fp, "\n%-48s %10s %12s\n", "site", "live", "bytes");
+
+    for(i = 0; i < REF_SITE_BUCKETS; ++i) {
+        s = atomic_load_explicit(&ref_sites[i], memory_order_acquire);
+
+        for(; s; s = s->next) {
+            if(!(live = atomic_load_explicit(&s->live, memory_order_relaxed)))
+                continue;
+
+            snprintf(where, sizeof(where), "%s:%d", s->file, s->line);
+            fprintf(fp, "%-48s %10zu %12zu  %s\n", where, live,
+                    atomic_load_explicit(&s->bytes, memory_order_relaxed),
+                    s->tag ? s->tag : "");
+        }
+    }
+}
+#else
+int ref_tag_stats(ref_tag_stats_t *st, int max) {
+    (void)st;
+    (void)max;
+    return 0;
+}
+
+void ref_debug_dump(FILE *fp) {
+    fprintf(fp, "Reference counted objects aren't tracked (configure with "
+            "--enable-ref-debug)\n");
+}
+#endif
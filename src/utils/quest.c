@@ -29,6 +29,7 @@
 
 #include "sylverant/quest.h"
 #include "sylverant/debug.h"
+#include "sylverant/config.h"
 #include "sylverant/memory.h"
 
 #ifndef LIBXML_TREE_ENABLED
@@ -674,7 +675,8 @@ static int handle_quest(xmlNode *n, sylverant_quest_category_t *c) {
 
     c->quests = (sylverant_quest_t **)tmp;
 
-    q = (sylverant_quest_t *)ref_alloc(sizeof(sylverant_quest_t), &quest_dtor);
+    q = (sylverant_quest_t *)ref_alloc_tagged(sizeof(sylverant_quest_t),
+                                              &quest_dtor, "quest");
     if(!q) {
         debug(DBG_ERROR, "Couldn't allocate space for quest\n");
         perror("ref_alloc");
@@ -994,6 +996,127 @@ err:
     return rv;
 }
 
+/* Space a string takes up in the arena, rounded up so that it also covers any
+   padding before the next aligned allocation. */
+static size_t str_size(const char *s) {
+    return s ? ARENA_SIZE(strlen(s) + 1) : 0;
+}
+
+/* Move everything a quest points to into the arena, and have the quest hold a
+   reference to the arena. The quest itself stays where it is, since it has a
+   reference count of its own (and may well outlive the list). If anything
+   can't be copied, the quest is left alone and -1 is returned (what was
+   copied just goes to waste until the arena is freed). */
+static int quest_to_arena(sylverant_quest_t *q, sylverant_arena_t *a) {
+    struct sylverant_quest_enemy *types, *ids;
+    uint8_t *regs;
+    char *long_desc, *prefix, *onload, *beforeload;
+
+    types = arena_memdup(a, q->monster_types, q->num_monster_types *
+                         sizeof(struct sylverant_quest_enemy));
+    ids = arena_memdup(a, q->monster_ids, q->num_monster_ids *
+                       sizeof(struct sylverant_quest_enemy));
+    regs = arena_memdup(a, q->synced_regs, q->num_sync);
+    long_desc = arena_strdup(a, q->long_desc);
+    prefix = arena_strdup(a, q->prefix);
+    onload = arena_strdup(a, q->onload_script_file);
+    beforeload = arena_strdup(a, q->beforeload_script_file);
+
+    if((q->monster_types && !types) || (q->monster_ids && !ids) ||
+       (q->synced_regs && !regs) || (q->long_desc && !long_desc) ||
+       (q->prefix && !prefix) || (q->onload_script_file && !onload) ||
+       (q->beforeload_script_file && !beforeload))
+        return -1;
+
+    quest_dtor(q);
+
+    q->monster_types = types;
+    q->monster_ids = ids;
+    q->synced_regs = regs;
+    q->long_desc = long_desc;
+    q->prefix = prefix;
+    q->onload_script_file = onload;
+    q->beforeload_script_file = beforeload;
+    q->arena = ref_retain(a);
+
+    return 0;
+}
+
+/* Copy a finished list into an arena, sized up front so that it should all fit
+   in the first chunk. If it doesn't, the arena just adds more chunks, which
+   costs an allocation or two but is otherwise harmless. If the copy can't be
+   done at all, the list is left alone. */
+static void list_to_arena(sylverant_quest_list_t *list) {
+    sylverant_arena_t *a;
+    sylverant_quest_category_t *cats, *cat;
+    sylverant_quest_t *q;
+    size_t sz;
+    int i, j;
+
+    sz = ARENA_ALIGN + ARENA_SIZE(list->cat_count *
+                                  sizeof(sylverant_quest_category_t));
+
+    for(i = 0; i < list->cat_count; ++i) {
+        cat = &list->cats[i];
+        sz += ARENA_SIZE(cat->quest_count * sizeof(sylverant_quest_t *));
+
+        for(j = 0; j < cat->quest_count; ++j) {
+            q = cat->quests[j];
+            sz += ARENA_SIZE(q->num_monster_types *
+                             sizeof(struct sylverant_quest_enemy)) +
+                ARENA_SIZE(q->num_monster_ids *
+                           sizeof(struct sylverant_quest_enemy)) +
+                ARENA_SIZE(q->num_sync) + str_size(q->long_desc) +
+                str_size(q->prefix) + str_size(q->onload_script_file) +
+                str_size(q->beforeload_script_file);
+        }
+    }
+
+    if(!(a = arena_create(sz))) {
+        debug(DBG_WARN, "Couldn't make arena for quest list\n");
+        return;
+    }
+
+    /* Copy the categories and their lists of quests first, so that there's
+       nothing to undo but the arena if one of them doesn't fit. */
+    cats = arena_memdup(a, list->cats, list->cat_count *
+                        sizeof(sylverant_quest_category_t));
+
+    if(list->cats && !cats)
+        goto err;
+
+    for(i = 0; i < list->cat_count; ++i) {
+        cat = &cats[i];
+        cat->quests = arena_memdup(a, list->cats[i].quests, cat->quest_count *
+                                   sizeof(sylverant_quest_t *));
+
+        if(list->cats[i].quests && !cat->quests)
+            goto err;
+    }
+
+    /* A quest that can't be moved just keeps its own copies of everything. */
+    for(i = 0; i < list->cat_count; ++i) {
+        cat = &cats[i];
+
+        for(j = 0; j < cat->quest_count; ++j) {
+            if(quest_to_arena(cat->quests[j], a))
+                debug(DBG_WARN, "Couldn't move quest %s into arena\n",
+                      cat->quests[j]->name);
+        }
+
+        free(list->cats[i].quests);
+    }
+
+    free(list->cats);
+    list->cats = cats;
+    list->arena = a;
+    return;
+
+err:
+    debug(DBG_WARN, "Couldn't copy quest list into arena\n");
+    ref_release(a);
+}
+
 int sylverant_quests_read(const char *filename, sylverant_quest_list_t *rv) {
     xmlParserCtxtPtr cxt;
     xmlDoc *doc;
@@ -1070,6 +1193,9 @@ int sylverant_quests_read(const char *filename, sylverant_quest_list_t *rv) {
         n = n->next;
     }
 
+    if(sylverant_config_arenas_enabled())
+        list_to_arena(rv);
+
     /* Cleanup/error handling below... */
 err_clean:
     if(irv < 0) {
@@ -1090,6 +1216,12 @@ static void quest_dtor(void *o) {
     if(!q)
         return;
 
+    /* Everything the quest points to lives in the arena, if it has one. */
+    if(q->arena) {
+        ref_release(q->arena);
+        return;
+    }
+
     xmlFree(q->long_desc);
     xmlFree(q->prefix);
     xmlFree(q->onload_script_file);
@@ -1110,12 +1242,49 @@ void sylverant_quests_destroy(sylverant_quest_list_t *list) {
             ref_release(cat->quests[j]);
         }
 
-        /* Free the list of quests. */
-        free(cat->quests);
+        /* Free the list of quests, unless it's part of the arena. */
+        if(!list->arena)
+            free(cat->quests);
     }
 
     /* Free the list of categories, and we're done. */
-    free(list->cats);
+    if(list->arena) {
+        ref_release(list->arena);
+        list->arena = NULL;
+    }
+    else {
+        free(list->cats);
+    }
+
     list->cats = NULL;
     list->cat_count = 0;
 }
+
+static void list_dtor(void *o) {
+    sylverant_quests_destroy((sylverant_quest_list_t *)o);
+}
+
+int sylverant_quests_read_shared(const char *filename,
+                                 sylverant_quest_list_t **rv) {
+    sylverant_quest_list_t *list;
+    int irv;
+
+    list = (sylverant_quest_list_t *)
+        ref_alloc_tagged(sizeof(sylverant_quest_list_t), &list_dtor,
+                         "quest_list");
+    if(!list) {
+        debug(DBG_ERROR, "Couldn't allocate space for quest list\n");
+        *rv = NULL;
+        return -2;
+    }
+
+    /* The list is already cleaned up if reading it failed. */
+    if((irv = sylverant_quests_read(filename, list))) {
+        ref_free(list, 1);
+        *rv = NULL;
+        return irv;
+    }
+
+    *rv = list;
+    return 0;
+}
@@ -0,0 +1,262 @@
+/*
+    This file is part of Sylverant PSO Server.
+
+    Copyright (C) 2026 Lawrence Sebald
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Affero General Public License version 3
+    as published by the Free Software Foundation.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Affero General Public License for more details.
+
+    You should have received a copy of the GNU Affero General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "sylverant/rcu.h"
+#include "sylverant/memory.h"
+
+/* Each thread that has ever read something gets one of these, registered in a
+   list that whoever is freeing things walks through. The epoch is the global
+   epoch as of when the thread started reading, or 0 if it isn't reading. The
+   links belong to the list (and its lock), the rest only to the thread. */
+typedef struct rcu_reader {
+    struct rcu_reader *next;
+    struct rcu_reader *prev;
+    atomic_uint_fast64_t epoch;
+    unsigned int nest;
+    int registered;
+} rcu_reader_t;
+
+/* An object waiting for the readers to be done with it. */
+typedef struct rcu_retired {
+    struct rcu_retired *next;
+    void *obj;
+    uint64_t epoch;
+} rcu_retired_t;
+
+struct ref_rcu {
+    _Atomic(void *) ptr;
+};
+
+/* The lock covers the list of readers and the retired objects. The epoch is
+   only ever changed with it held, but is read without it. Starting the epoch
+   at 1 keeps 0 free to mean "not reading". */
+static pthread_mutex_t rcu_lock = PTHREAD_MUTEX_INITIALIZER;
+static rcu_reader_t readers = { .next = &readers, .prev = &readers };
+static rcu_retired_t *retired;
+static int retired_count;
+static atomic_uint_fast64_t rcu_epoch = 1;
+static pthread_once_t rcu_once = PTHREAD_ONCE_INIT;
+static pthread_key_t rcu_key;
+static __thread rcu_reader_t self;
+
+/* Take the thread out of the list when it exits. */
+static void reader_dtor(void *d) {
+    rcu_reader_t *r = (rcu_reader_t *)d;
+
+    pthread_mutex_lock(&rcu_lock);
+    r->prev->next = r->next;
+    r->next->prev = r->prev;
+    pthread_mutex_unlock(&rcu_lock);
+
+    r->registered = 0;
+}
+
+static void rcu_init(void) {
+    pthread_key_create(&rcu_key, &reader_dtor);
+}
+
+static void reader_register(void) {
+    pthread_once(&rcu_once, &rcu_init);
+
+    pthread_mutex_lock(&rcu_lock);
+    self.next = readers.next;
+    self.prev = &readers;
+    readers.next->prev = &self;
+    readers.next = &self;
+    pthread_mutex_unlock(&rcu_lock);
+
+    pthread_setspecific(rcu_key, &self);
+    self.registered = 1;
+}
+
+void ref_rcu_read_lock(void) {
+    uint64_t e;
+
+    if(!self.registered)
+        reader_register();
+
+    if(self.nest++)
+        return;
+
+    /* Seeing an epoch means seeing everything retired before it started, so
+       nothing this thread can find is older than the epoch it announces. The
+       fence keeps anything read in the section from being read before the
+       epoch is announced, and pairs with the one in rcu_advance. */
+    e = atomic_load_explicit(&rcu_epoch, memory_order_acquire);
+    atomic_store_explicit(&self.epoch, e, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void ref_rcu_read_unlock(void) {
+    if(--self.nest)
+        return;
+
+    /* Everything done in the section has to be done before the object can be
+       freed out from under it. */
+    atomic_store_explicit(&self.epoch, 0, memory_order_release);
+}
+
+/* Move the epoch forward, if every thread that's reading has seen the current
+   one. Must be called with the lock held. */
+static int rcu_advance(void) {
+    uint64_t e = atomic_load_explicit(&rcu_epoch, memory_order_relaxed), re;
+    rcu_reader_t *r;
+
+    atomic_thread_fence(memory_order_seq_cst);
+
+    for(r = readers.next; r != &readers; r = r->next) {
+        re = atomic_load_explicit(&r->epoch, memory_order_acquire);
+
+        if(re && re != e)
+            return 0;
+    }
+
+    atomic_store_explicit(&rcu_epoch, e + 1, memory_order_release);
+    return 1;
+}
+
+/* Move the epoch as far along as it'll go, and free everything that no thread
+   can still be reading. Anything retired in epoch e could only have been seen
+   by threads that were reading in e or before, and the epoch can't get to
+   e + 2 until all of them are done. Returns the epoch it got to. */
+static uint64_t rcu_collect(int *left) {
+    rcu_retired_t *done = NULL, **pp, *t;
+    uint64_t e;
+
+    pthread_mutex_lock(&rcu_lock);
+
+    /* Two steps is as far as it needs to go to free everything. */
+    if(rcu_advance())
+        rcu_advance();
+
+    e = atomic_load_explicit(&rcu_epoch, memory_order_relaxed);
+    pp = &retired;
+
+    while((t = *pp)) {
+        if(t->epoch + 2 <= e) {
+            *pp = t->next;
+            t->next = done;
+            done = t;
+            --retired_count;
+        }
+        else {
+            pp = &t->next;
+        }
+    }
+
+    if(left)
+        *left = retired_count;
+
+    pthread_mutex_unlock(&rcu_lock);
+
+    /* Release them without the lock, in case a destructor retires something
+       else. */
+    while(done) {
+        t = done->next;
+        ref_release(done->obj);
+        free(done);
+        done = t;
+    }
+
+    return e;
+}
+
+static void rcu_retire(void *obj) {
+    rcu_retired_t *t;
+
+    if(!obj)
+        return;
+
+    /* If there's no memory to remember it in, just wait for the readers. */
+    if(!(t = (rcu_retired_t *)malloc(sizeof(rcu_retired_t)))) {
+        ref_rcu_synchronize();
+        ref_release(obj);
+        return;
+    }
+
+    t->obj = obj;
+
+    pthread_mutex_lock(&rcu_lock);
+    t->epoch = atomic_load_explicit(&rcu_epoch, memory_order_relaxed);
+    t->next = retired;
+    retired = t;
+    ++retired_count;
+    pthread_mutex_unlock(&rcu_lock);
+}
+
+ref_rcu_t *ref_rcu_create(void *obj) {
+    ref_rcu_t *r;
+
+    if(!(r = (ref_rcu_t *)malloc(sizeof(ref_rcu_t))))
+        return NULL;
+
+    atomic_init(&r->ptr, obj);
+    return r;
+}
+
+void ref_rcu_destroy(ref_rcu_t *r) {
+    if(!r)
+        return;
+
+    rcu_retire(atomic_load_explicit(&r->ptr, memory_order_relaxed));
+    free(r);
+    rcu_collect(NULL);
+}
+
+void *ref_rcu_deref(ref_rcu_t *r) {
+    return atomic_load_explicit(&r->ptr, memory_order_acquire);
+}
+
+void *ref_rcu_get(ref_rcu_t *r) {
+    void *rv;
+
+    ref_rcu_read_lock();
+    rv = ref_retain(atomic_load_explicit(&r->ptr, memory_order_acquire));
+    ref_rcu_read_unlock();
+
+    return rv;
+}
+
+void ref_rcu_publish(ref_rcu_t *r, void *obj) {
+    /* The new object has to be completely set up before anyone can see it. */
+    rcu_retire(atomic_exchange_explicit(&r->ptr, obj, memory_order_acq_rel));
+    rcu_collect(NULL);
+}
+
+int ref_rcu_reclaim(void) {
+    int left;
+
+    rcu_collect(&left);
+    return left;
+}
+
+void ref_rcu_synchronize(void) {
+    struct timespec ts = { 0, 1000000 };
+    uint64_t target = atomic_load_explicit(&rcu_epoch,
+                                           memory_order_relaxed) + 2;
+
+    while(rcu_collect(NULL) < target) {
+        nanosleep(&ts, NULL);
+    }
+}
@@ -23,6 +23,7 @@
 #include <ctype.h>
 #include <limits.h>
 #include <errno.h>
+#include <stddef.h>
 
 #include <sys/socket.h>
 #include <arpa/inet.h>
@@ -32,6 +33,7 @@
 
 #include "sylverant/config.h"
 #include "sylverant/debug.h"
+#include "sylverant/memory.h"
 
 #ifndef LIBXML_TREE_ENABLED
 #error You must have libxml2 with tree support built-in.
@@ -46,6 +48,24 @@ static const char language_codes[LANGUAGE_CODE_COUNT][3] = {
     "jp", "en", "de", "fr", "es", "cs", "ct", "kr"
 };
 
+/* All of the plain strings in the ship config, for copying it to an arena. */
+#define SHIP_STR(x) offsetof(sylverant_ship_t, x)
+static const size_t ship_strings[] = {
+    SHIP_STR(shipgate_host), SHIP_STR(name), SHIP_STR(ship_cert),
+    SHIP_STR(ship_key), SHIP_STR(shipgate_ca), SHIP_STR(gm_file),
+    SHIP_STR(quests_file), SHIP_STR(quests_dir), SHIP_STR(bans_file),
+    SHIP_STR(scripts_file), SHIP_STR(bb_param_dir), SHIP_STR(v2_param_dir),
+    SHIP_STR(bb_map_dir), SHIP_STR(v2_map_dir), SHIP_STR(gc_map_dir),
+    SHIP_STR(v2_ptdata_file), SHIP_STR(gc_ptdata_file),
+    SHIP_STR(bb_ptdata_file), SHIP_STR(v2_pmtdata_file),
+    SHIP_STR(gc_pmtdata_file), SHIP_STR(bb_pmtdata_file),
+    SHIP_STR(v2_rtdata_file), SHIP_STR(gc_rtdata_file),
+    SHIP_STR(bb_rtdata_file), SHIP_STR(smutdata_file), SHIP_STR(sg_data_dir),
+    SHIP_STR(ship_host), SHIP_STR(ship_host6)
+};
+#define SHIP_STRINGS (sizeof(ship_strings) / sizeof(ship_strings[0]))
+#define SHIP_STRING(c, i) (*(char **)((uint8_t *)(c) + ship_strings[i]))
+
 static int handle_shipgate(xmlNode *n, sylverant_ship_t *cfg) {
     xmlChar *ip, *port, *ca, *addr;
     int rv;
@@ -1177,6 +1197,98 @@ err:
     return rv;
 }
 
+static size_t str_size(const char *s) {
+    return s ? strlen(s) + 1 : 0;
+}
+
+/* Copy a finished config into an arena, sized up front so that it should all
+   fit in the first chunk. If it doesn't, the arena just adds more chunks, which
+   costs an allocation or two but is otherwise harmless. If the copy can't be
+   done at all, the config is left alone and returned as-is. */
+static sylverant_ship_t *ship_to_arena(sylverant_ship_t *cfg) {
+    sylverant_arena_t *a;
+    sylverant_ship_t *rv;
+    size_t sz, isz, lsz, esz, j;
+    int i;
+
+    isz = cfg->info_file_count * sizeof(sylverant_info_file_t);
+    lsz = cfg->limits_count * sizeof(sylverant_limit_config_t);
+    esz = cfg->event_count * sizeof(sylverant_event_t);
+
+    /* Put the structures first, so the strings after them don't have to be
+       padded out to keep anything aligned. */
+    sz = ARENA_ALIGN + ARENA_SIZE(sizeof(sylverant_ship_t)) + ARENA_SIZE(isz) +
+        ARENA_SIZE(lsz) + ARENA_SIZE(esz);
+
+    for(j = 0; j < SHIP_STRINGS; ++j) {
+        sz += str_size(SHIP_STRING(cfg, j));
+    }
+
+    for(i = 0; i < cfg->info_file_count; ++i) {
+        sz += str_size(cfg->info_files[i].desc) +
+            str_size(cfg->info_files[i].filename);
+    }
+
+    for(i = 0; i < cfg->limits_count; ++i) {
+        sz += str_size(cfg->limits[i].name) +
+            str_size(cfg->limits[i].filename);
+    }
+
+    if(!(a = arena_create(sz))) {
+        debug(DBG_WARN, "Couldn't make arena for ship config\n");
+        return cfg;
+    }
+
+    /* Everything copied so far goes away with the arena if anything fails. */
+    if(!(rv = (sylverant_ship_t *)arena_alloc(a, sizeof(sylverant_ship_t))))
+        goto err;
+
+    memcpy(rv, cfg, sizeof(sylverant_ship_t));
+    rv->arena = a;
+
+    rv->info_files = arena_memdup(a, cfg->info_files, isz);
+    rv->limits = arena_memdup(a, cfg->limits, lsz);
+    rv->events = arena_memdup(a, cfg->events, esz);
+
+    if((cfg->info_files && !rv->info_files) || (cfg->limits && !rv->limits) ||
+       (cfg->events && !rv->events))
+        goto err;
+
+    for(j = 0; j < SHIP_STRINGS; ++j) {
+        SHIP_STRING(rv, j) = arena_strdup(a, SHIP_STRING(cfg, j));
+
+        if(SHIP_STRING(cfg, j) && !SHIP_STRING(rv, j))
+            goto err;
+    }
+
+    for(i = 0; i < cfg->info_file_count; ++i) {
+        rv->info_files[i].desc = arena_strdup(a, cfg->info_files[i].desc);
+        rv->info_files[i].filename =
+            arena_strdup(a, cfg->info_files[i].filename);
+
+        if((cfg->info_files[i].desc && !rv->info_files[i].desc) ||
+           (cfg->info_files[i].filename && !rv->info_files[i].filename))
+            goto err;
+    }
+
+    for(i = 0; i < cfg->limits_count; ++i) {
+        rv->limits[i].name = arena_strdup(a, cfg->limits[i].name);
+        rv->limits[i].filename = arena_strdup(a, cfg->limits[i].filename);
+
+        if((cfg->limits[i].name && !rv->limits[i].name) ||
+           (cfg->limits[i].filename && !rv->limits[i].filename))
+            goto err;
+    }
+
+    sylverant_free_ship_config(cfg);
+    return rv;
+
+err:
+    debug(DBG_WARN, "Couldn't copy ship config into arena\n");
+    ref_release(a);
+    return cfg;
+}
+
 int sylverant_read_ship_config(const char *f, sylverant_ship_t **cfg) {
     xmlParserCtxtPtr cxt;
     xmlDoc *doc;
@@ -1297,6 +1409,9 @@ int sylverant_read_ship_config(const char *f, sylverant_ship_t **cfg) {
     if(rv->limits_count && rv->limits_default == -1)
         rv->limits_default = 0;
 
+    if(sylverant_config_arenas_enabled())
+        rv = ship_to_arena(rv);
+
     *cfg = rv;
 
     /* Cleanup/error handling below... */
@@ -1322,6 +1437,13 @@ err:
 void sylverant_free_ship_config(sylverant_ship_t *cfg) {
     int j;
 
+    /* An arena config is entirely inside of its arena, so that's all there is
+       to clean up. */
+    if(cfg && cfg->arena) {
+        ref_release(cfg->arena);
+        return;
+    }
+
     /* Make sure we actually have a valid configuration pointer. */
     if(cfg) {
         if(cfg->info_files) {